@@ -0,0 +1,118 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "aot.h"
+
+uint8_t rom[ROM_SIZE];
+
+typedef struct {
+	const char *rom_path;
+	const char *output_path;
+	const char *symbol;
+	QuirkProfile quirk_profile;
+} AotOptions;
+
+void print_usage() {
+	printf(
+		"Usage: chip8_aot path/to/chip8_rom.ch8 [options]\n"
+		"  --output PATH     Write the C translation unit to PATH (default: standard output)\n"
+		"  --symbol NAME     Name of the AotProgram, and prefix of its blocks (default %s)\n"
+		"  --quirks NAME     Quirk profile the program runs with: default, vip, chip48 or schip (default: default)\n",
+		DEFAULT_AOT_SYMBOL
+	);
+}
+
+bool is_c_identifier(const char *text) {
+	if (!isalpha((unsigned char) *text) && *text != '_') {
+		return false;
+	}
+	for (; *text != '\0'; ++text) {
+		if (!isalnum((unsigned char) *text) && *text != '_') {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parse_options(int argc, const char *argv[], AotOptions *options) {
+	options->rom_path = NULL;
+	options->output_path = NULL;
+	options->symbol = DEFAULT_AOT_SYMBOL;
+	options->quirk_profile = QUIRKS_DEFAULT;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-') {
+			if (options->rom_path != NULL) {
+				return false;
+			}
+			options->rom_path = arg;
+			continue;
+		}
+
+		if (value == NULL) {
+			return false;
+		}
+		++i;
+
+		if (strcmp(arg, "--output") == 0) {
+			options->output_path = value;
+		} else if (strcmp(arg, "--symbol") == 0 && is_c_identifier(value)) {
+			options->symbol = value;
+		} else if (strcmp(arg, "--quirks") == 0 && parse_quirk_profile(value, &options->quirk_profile)) {
+			continue;
+		} else {
+			return false;
+		}
+	}
+
+	return options->rom_path != NULL;
+}
+
+int main(int argc, const char *argv[]) {
+	AotOptions options;
+	if (!parse_options(argc, argv, &options)) {
+		fprintf(stderr, "Invalid arguments\n");
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	size_t bytes_read;
+	if (!load_rom(options.rom_path, rom, &bytes_read)) {
+		return EXIT_FAILURE;
+	}
+	if (bytes_read == 0) {
+		fprintf(stderr, "Empty ROM %s\n", options.rom_path);
+		return EXIT_FAILURE;
+	}
+
+	CpuState *cpu_state = malloc(sizeof(CpuState));
+	if (cpu_state == NULL) {
+		return EXIT_FAILURE;
+	}
+	init_state(cpu_state, rom);
+	set_quirk_profile(cpu_state, options.quirk_profile);
+
+	FILE *file_ptr = options.output_path != NULL ? fopen(options.output_path, "w") : stdout;
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open output file %s\n", options.output_path);
+		free(cpu_state);
+		return EXIT_FAILURE;
+	}
+
+	size_t blocks = write_aot_program(file_ptr, cpu_state, bytes_read, options.symbol);
+	bool ok = !ferror(file_ptr);
+	if (file_ptr != stdout) {
+		ok = fclose(file_ptr) == 0 && ok;
+	}
+	fprintf(stderr, "Translated %zu block(s) from %zu byte(s) of ROM\n", blocks, bytes_read);
+
+	free(cpu_state);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
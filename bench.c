@@ -0,0 +1,527 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "jit.h"
+#include "threaded.h"
+
+#define DEFAULT_BENCH_OUTPUT "bench.json"
+#define DEFAULT_BENCH_REPETITIONS 10
+#define DEFAULT_BENCH_MIN_SAMPLE_MILLIS 10
+#define MAX_BENCH_REPETITIONS 1000
+#define MAX_BENCH_ROMS 16
+#define BENCH_NAME_SIZE 96
+
+// Every macro benchmark runs with virtual timers ticking once every this many instructions
+#define BENCH_INSTRUCTIONS_PER_TICK DEFAULT_INSTRUCTIONS_PER_FRAME
+// Instructions run by each call into a core in the macro benchmarks
+#define BENCH_MACRO_CHUNK 1000
+
+struct BenchContext;
+
+/*
+ * Runs iterations operations, and returns the number of CHIP-8 instructions they executed, or 0 if they aren't
+ * instructions.
+ */
+typedef uint64_t BenchFunction(struct BenchContext *context, uint64_t iterations);
+
+typedef struct BenchContext {
+	CpuState *cpu_state;
+	CpuState *other_cpu_state;
+	JitContext *jit;
+
+	// Parameters of the benchmark being run
+	uint16_t instruction;
+	Instruction *handler;
+	uint8_t stack_size;
+	uint32_t (*core)(CpuState *cpu_state, uint32_t count);
+} BenchContext;
+
+typedef struct {
+	const char *output_path;
+	const char *filter;
+	uint32_t repetitions;
+	uint32_t min_sample_millis;
+	const char *rom_paths[MAX_BENCH_ROMS];
+	uint32_t roms;
+} BenchOptions;
+
+typedef struct {
+	FILE *json;
+	const BenchOptions *options;
+	uint32_t benchmarks;
+} BenchReport;
+
+typedef struct {
+	Opcode opcode;
+	const char *name;
+	uint16_t instruction;
+} HandlerBenchmark;
+
+/*
+ * One representative instruction for each handler, run on the state set up by reset_bench_state.
+ */
+const HandlerBenchmark HANDLER_BENCHMARKS[] = {
+	{OPCODE_CLEAR_SCREEN, "clear_screen", 0x00E0},
+	{OPCODE_RETURN_SUBROUTINE, "return_subroutine", 0x00EE},
+	{OPCODE_JUMP, "jump", 0x1200},
+	{OPCODE_JUMP_SUBROUTINE, "jump_subroutine", 0x2200},
+	{OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE, "skip_if_equal_to_immediate", 0x3112},
+	{OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE, "skip_if_different_from_immediate", 0x4112},
+	{OPCODE_SKIP_IF_REGISTERS_EQUAL, "skip_if_registers_equal", 0x5120},
+	{OPCODE_SET_REGISTER_TO_IMMEDIATE, "set_register_to_immediate", 0x6134},
+	{OPCODE_ADD_IMMEDIATE_TO_REGISTER, "add_immediate_to_register", 0x7134},
+	{OPCODE_COPY_REGISTER, "copy_register", 0x8120},
+	{OPCODE_BITWISE_OR, "bitwise_or", 0x8121},
+	{OPCODE_BITWISE_AND, "bitwise_and", 0x8122},
+	{OPCODE_BITWISE_XOR, "bitwise_xor", 0x8123},
+	{OPCODE_ADD_REGISTER_TO_REGISTER, "add_register_to_register", 0x8124},
+	{OPCODE_SUB_REGISTER_FROM_REGISTER, "sub_register_from_register", 0x8125},
+	{OPCODE_SHIFT_RIGHT, "shift_right", 0x8126},
+	{OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER, "negative_sub_register_from_register", 0x8127},
+	{OPCODE_SHIFT_LEFT, "shift_left", 0x812E},
+	{OPCODE_SKIP_IF_REGISTERS_DIFFERENT, "skip_if_registers_different", 0x9120},
+	{OPCODE_SET_INDEX_REGISTER, "set_index_register", 0xA300},
+	{OPCODE_JUMP_WITH_OFFSET, "jump_with_offset", 0xB200},
+	{OPCODE_SET_REGISTER_TO_BITMASKED_RAND, "set_register_to_bitmasked_rand", 0xC1C7},
+	{OPCODE_DRAW, "draw", 0xD125},
+	{OPCODE_SKIP_PRESSED, "skip_pressed", 0xE59E},
+	{OPCODE_SKIP_NOT_PRESSED, "skip_not_pressed", 0xE5A1},
+	{OPCODE_READ_DELAY, "read_delay", 0xF107},
+	{OPCODE_WAIT_FOR_KEY, "wait_for_key", 0xF10A},
+	{OPCODE_SET_DELAY, "set_delay", 0xF115},
+	{OPCODE_SET_SOUND, "set_sound", 0xF118},
+	{OPCODE_ADD_TO_INDEX, "add_to_index", 0xF11E},
+	{OPCODE_POINT_TO_CHAR, "point_to_char", 0xF129},
+	{OPCODE_DECIMAL_DECODE, "decimal_decode", 0xF133},
+	{OPCODE_SAVE_REGISTERS, "save_registers", 0xFF55},
+	{OPCODE_LOAD_REGISTERS, "load_registers", 0xFF65},
+};
+
+#define NUMBER_OF_HANDLER_BENCHMARKS (sizeof(HANDLER_BENCHMARKS) / sizeof(HANDLER_BENCHMARKS[0]))
+
+// Sprite heights and X coordinates for draw: byte aligned, unaligned, and clipped at the right edge
+const uint8_t DRAW_BENCH_HEIGHTS[] = {1, 5, 8, 15};
+const uint8_t DRAW_BENCH_XS[] = {0, 3, 60};
+
+/*
+ * A busy loop in the style of a game: clear the screen, draw the font all over it, then some arithmetic, timers,
+ * random numbers, BCD, register loads and a subroutine call.
+ */
+const uint8_t SYNTHETIC_BENCH_ROM[] = {
+	0x00, 0xE0, // 200: CLS
+	0x60, 0x00, // 202: SETR V0 0
+	0x61, 0x00, // 204: SETR V1 0
+	0x62, 0x00, // 206: SETR V2 0
+	0xF2, 0x29, // 208: CHAR V2
+	0xD0, 0x15, // 20A: DRAW V0 V1 5
+	0x70, 0x08, // 20C: ADDI V0 8
+	0x72, 0x01, // 20E: ADDI V2 1
+	0x42, 0x10, // 210: SINE V2 0x10
+	0x62, 0x00, // 212: SETR V2 0
+	0x30, 0x40, // 214: SIEQ V0 0x40
+	0x12, 0x08, // 216: GOTO 0x208
+	0x60, 0x00, // 218: SETR V0 0
+	0x71, 0x06, // 21A: ADDI V1 6
+	0x31, 0x1E, // 21C: SIEQ V1 0x1E
+	0x12, 0x08, // 21E: GOTO 0x208
+	0xF3, 0x07, // 220: GETD V3
+	0x84, 0x34, // 222: ADD V4 V3
+	0xF4, 0x15, // 224: SETD V4
+	0xC5, 0xFF, // 226: RAND V5 0xFF
+	0xA3, 0x00, // 228: SETI 0x300
+	0xF5, 0x33, // 22A: BCD V5
+	0xF2, 0x65, // 22C: LOAD V2
+	0x22, 0x40, // 22E: CALL 0x240
+	0x12, 0x00, // 230: GOTO 0x200
+	0x00, 0x00, // 232
+	0x00, 0x00, // 234
+	0x00, 0x00, // 236
+	0x00, 0x00, // 238
+	0x00, 0x00, // 23A
+	0x00, 0x00, // 23C
+	0x00, 0x00, // 23E
+	0x80, 0x14, // 240: ADD V0 V1
+	0x81, 0x06, // 242: SHR V1
+	0x00, 0xEE, // 244: RET
+};
+
+// Results that are otherwise unused are stored here, so the compiler can't drop the work
+volatile uintptr_t bench_sink;
+
+uint64_t read_bench_nanoseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/*
+ * Registers, keys and index register chosen so that every handler takes its common path.
+ */
+void reset_bench_state(CpuState *cpu_state) {
+	init_state(cpu_state, NULL);
+	for (uint8_t r = 0; r < REGISTERS; ++r) {
+		cpu_state->register_bank[r] = 0x11 * r + 7;
+	}
+	cpu_state->index_register = 0x300;
+	set_key_pressed(cpu_state, 5, true);
+	use_virtual_timers(cpu_state, BENCH_INSTRUCTIONS_PER_TICK);
+}
+
+uint64_t bench_handler(BenchContext *context, uint64_t iterations) {
+	CpuState *cpu_state = context->cpu_state;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		// Keep the calls and returns within the stack
+		cpu_state->stack_size = context->stack_size;
+		context->handler(cpu_state, context->instruction);
+	}
+	return iterations;
+}
+
+uint64_t bench_decode(__attribute__((unused)) BenchContext *context, uint64_t iterations) {
+	uintptr_t sink = 0;
+	size_t next = 0;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		// Cycle through every kind of instruction
+		sink += (uintptr_t) decode(HANDLER_BENCHMARKS[next].instruction);
+		if (++next == NUMBER_OF_HANDLER_BENCHMARKS) {
+			next = 0;
+		}
+	}
+	bench_sink = sink;
+	return 0;
+}
+
+uint64_t bench_copy_state(BenchContext *context, uint64_t iterations) {
+	for (uint64_t i = 0; i < iterations; ++i) {
+		copy_state(context->other_cpu_state, context->cpu_state);
+	}
+	return 0;
+}
+
+uint64_t bench_state_equals(BenchContext *context, uint64_t iterations) {
+	uint64_t equal = 0;
+	for (uint64_t i = 0; i < iterations; ++i) {
+		equal += state_equals(context->other_cpu_state, context->cpu_state);
+	}
+	bench_sink = equal;
+	return 0;
+}
+
+uint64_t bench_expand_display(BenchContext *context, uint64_t iterations) {
+	uint32_t pixels[SCREEN_WIDTH * SCREEN_HEIGHT];
+	for (uint64_t i = 0; i < iterations; ++i) {
+		// Same colors as the SDL frontend
+		expand_display_to_argb(
+			context->cpu_state, pixels, SCREEN_WIDTH * sizeof(uint32_t), 0, SCREEN_HEIGHT, 0xFFFFFFFF, 0xFF000000
+		);
+	}
+	bench_sink = pixels[0];
+	return 0;
+}
+
+uint64_t bench_rom(BenchContext *context, uint64_t iterations) {
+	uint64_t executed = 0;
+	while (executed < iterations) {
+		uint32_t chunk = iterations - executed < BENCH_MACRO_CHUNK ? iterations - executed : BENCH_MACRO_CHUNK;
+		executed += context->core(context->cpu_state, chunk);
+	}
+	return executed;
+}
+
+JitContext bench_jit;
+
+uint32_t run_bench_jit(CpuState *cpu_state, uint32_t count) {
+	return jit_run(&bench_jit, cpu_state, count);
+}
+
+int compare_doubles(const void *left, const void *right) {
+	double a = *(const double *) left;
+	double b = *(const double *) right;
+	return (a > b) - (a < b);
+}
+
+void write_json_string(FILE *file_ptr, const char *text) {
+	fputc('"', file_ptr);
+	for (; *text != '\0'; ++text) {
+		if (*text == '"' || *text == '\\') {
+			fputc('\\', file_ptr);
+		}
+		fputc(*text, file_ptr);
+	}
+	fputc('"', file_ptr);
+}
+
+/*
+ * Times a benchmark: first doubles the iterations until a sample takes long enough, which also warms up caches and
+ * branch predictors, then takes the configured number of samples and reports their statistics.
+ */
+void run_benchmark(
+	BenchReport *report, const char *group, const char *name, BenchFunction *function, BenchContext *context
+) {
+	char full_name[BENCH_NAME_SIZE];
+	snprintf(full_name, sizeof(full_name), "%s/%s", group, name);
+	if (report->options->filter != NULL && strstr(full_name, report->options->filter) == NULL) {
+		return;
+	}
+
+	uint64_t min_sample_nanoseconds = (uint64_t) report->options->min_sample_millis * 1000000u;
+	uint64_t iterations = 1;
+	for (;;) {
+		uint64_t start = read_bench_nanoseconds();
+		function(context, iterations);
+		uint64_t elapsed = read_bench_nanoseconds() - start;
+		if (elapsed >= min_sample_nanoseconds) {
+			break;
+		}
+		// Jump close to the target once the timing is meaningful
+		if (elapsed > min_sample_nanoseconds / 16) {
+			iterations = iterations * min_sample_nanoseconds / elapsed + 1;
+		} else {
+			iterations *= 2;
+		}
+	}
+
+	double samples[MAX_BENCH_REPETITIONS];
+	uint32_t repetitions = report->options->repetitions;
+	uint64_t instructions = 0;
+	for (uint32_t i = 0; i < repetitions; ++i) {
+		uint64_t start = read_bench_nanoseconds();
+		instructions = function(context, iterations);
+		uint64_t elapsed = read_bench_nanoseconds() - start;
+		samples[i] = (double) elapsed / iterations;
+	}
+
+	double mean = 0;
+	for (uint32_t i = 0; i < repetitions; ++i) {
+		mean += samples[i];
+	}
+	mean /= repetitions;
+	double variance = 0;
+	for (uint32_t i = 0; i < repetitions; ++i) {
+		variance += (samples[i] - mean) * (samples[i] - mean);
+	}
+	double stddev = repetitions > 1 ? sqrt(variance / (repetitions - 1)) : 0;
+	qsort(samples, repetitions, sizeof(double), compare_doubles);
+	double median = repetitions % 2
+		? samples[repetitions / 2]
+		: (samples[repetitions / 2 - 1] + samples[repetitions / 2]) / 2;
+	double instructions_per_second = instructions > 0 ? instructions / (median * iterations) * 1e9 : 0;
+
+	printf("%-56s %12.2f ns/op  +- %6.2f", full_name, median, stddev);
+	if (instructions > 0) {
+		printf("  %14.0f instructions/s", instructions_per_second);
+	}
+	printf("\n");
+
+	FILE *json = report->json;
+	fprintf(json, "%s\n    {\"name\": ", report->benchmarks > 0 ? "," : "");
+	write_json_string(json, full_name);
+	fprintf(json, ", \"group\": ");
+	write_json_string(json, group);
+	fprintf(
+		json,
+		", \"iterations\": %llu, \"repetitions\": %u, "
+		"\"ns_per_op\": {\"min\": %.3f, \"median\": %.3f, \"mean\": %.3f, \"max\": %.3f, \"stddev\": %.3f}",
+		(unsigned long long) iterations, repetitions, samples[0], median, mean, samples[repetitions - 1], stddev
+	);
+	if (instructions > 0) {
+		fprintf(json, ", \"instructions_per_second\": %.0f", instructions_per_second);
+	}
+	fprintf(json, "}");
+	++report->benchmarks;
+}
+
+void run_handler_benchmarks(BenchReport *report, BenchContext *context) {
+	for (size_t i = 0; i < NUMBER_OF_HANDLER_BENCHMARKS; ++i) {
+		const HandlerBenchmark *benchmark = &HANDLER_BENCHMARKS[i];
+		reset_bench_state(context->cpu_state);
+		context->handler = INSTRUCTION_HANDLERS[benchmark->opcode];
+		context->instruction = benchmark->instruction;
+		context->stack_size = benchmark->opcode == OPCODE_RETURN_SUBROUTINE ? 1 : 0;
+		run_benchmark(report, "handler", benchmark->name, bench_handler, context);
+	}
+}
+
+void run_draw_benchmarks(BenchReport *report, BenchContext *context) {
+	for (size_t h = 0; h < sizeof(DRAW_BENCH_HEIGHTS); ++h) {
+		for (size_t x = 0; x < sizeof(DRAW_BENCH_XS); ++x) {
+			reset_bench_state(context->cpu_state);
+			context->cpu_state->register_bank[0] = DRAW_BENCH_XS[x];
+			context->cpu_state->register_bank[1] = 9;
+			// Any memory works as sprite data, the font is a realistic mix of bits
+			context->cpu_state->index_register = FONT_ADDRESS_START;
+			context->handler = draw;
+			context->instruction = 0xD010 | DRAW_BENCH_HEIGHTS[h];
+			context->stack_size = 0;
+
+			char name[BENCH_NAME_SIZE];
+			snprintf(name, sizeof(name), "height_%u_x_%u", DRAW_BENCH_HEIGHTS[h], DRAW_BENCH_XS[x]);
+			run_benchmark(report, "draw", name, bench_handler, context);
+		}
+	}
+}
+
+void run_state_benchmarks(BenchReport *report, BenchContext *context) {
+	run_benchmark(report, "decode", "decode", bench_decode, context);
+
+	reset_bench_state(context->cpu_state);
+	run_benchmark(report, "state", "copy_state", bench_copy_state, context);
+	copy_state(context->other_cpu_state, context->cpu_state);
+	run_benchmark(report, "state", "state_equals", bench_state_equals, context);
+
+	// Half the pixels lit
+	for (size_t i = 0; i < SCREEN_SIZE_BYTES; ++i) {
+		context->cpu_state->display[i] = i % 3 ? 0xA5 : 0x3C;
+	}
+	run_benchmark(report, "display", "expand_display_to_argb", bench_expand_display, context);
+}
+
+void run_rom_benchmarks(BenchReport *report, BenchContext *context, const char *rom_name, const uint8_t *rom) {
+	struct {
+		const char *name;
+		uint32_t (*core)(CpuState *cpu_state, uint32_t count);
+	} cores[3] = {
+		{"interpreter", run_instructions},
+		{"threaded", run_threaded},
+		{"jit", run_bench_jit},
+	};
+	uint32_t number_of_cores = context->jit != NULL ? 3 : 2;
+
+	for (uint32_t i = 0; i < number_of_cores; ++i) {
+		init_state(context->cpu_state, rom);
+		use_virtual_timers(context->cpu_state, BENCH_INSTRUCTIONS_PER_TICK);
+		context->core = cores[i].core;
+
+		char name[BENCH_NAME_SIZE];
+		snprintf(name, sizeof(name), "%s/%s", rom_name, cores[i].name);
+		run_benchmark(report, "rom", name, bench_rom, context);
+	}
+}
+
+void print_bench_usage() {
+	printf(
+		"Usage: chip8_bench [options] [path/to/rom.ch8...]\n"
+		"  --output PATH     Write the results as JSON to PATH (default %s)\n"
+		"  --filter TEXT     Only run the benchmarks whose name contains TEXT\n"
+		"  --repetitions N   Samples per benchmark (default %d)\n"
+		"  --min-time MS     Minimum duration of a sample in milliseconds (default %d)\n"
+		"Every ROM given is run as a macro benchmark, along with a built-in synthetic one.\n",
+		DEFAULT_BENCH_OUTPUT, DEFAULT_BENCH_REPETITIONS, DEFAULT_BENCH_MIN_SAMPLE_MILLIS
+	);
+}
+
+bool parse_bench_options(int argc, const char *argv[], BenchOptions *options) {
+	options->output_path = DEFAULT_BENCH_OUTPUT;
+	options->filter = NULL;
+	options->repetitions = DEFAULT_BENCH_REPETITIONS;
+	options->min_sample_millis = DEFAULT_BENCH_MIN_SAMPLE_MILLIS;
+	options->roms = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (arg[0] != '-') {
+			if (options->roms == MAX_BENCH_ROMS) {
+				return false;
+			}
+			options->rom_paths[options->roms++] = arg;
+			continue;
+		}
+
+		if (i + 1 == argc) {
+			return false;
+		}
+		const char *value = argv[++i];
+		char *end_ptr = NULL;
+		unsigned long number = strtoul(value, &end_ptr, 10);
+		bool is_number = end_ptr != value && *end_ptr == '\0';
+
+		if (strcmp(arg, "--output") == 0) {
+			options->output_path = value;
+		} else if (strcmp(arg, "--filter") == 0) {
+			options->filter = value;
+		} else if (strcmp(arg, "--repetitions") == 0 && is_number && number > 0 && number <= MAX_BENCH_REPETITIONS) {
+			options->repetitions = number;
+		} else if (strcmp(arg, "--min-time") == 0 && is_number && number > 0) {
+			options->min_sample_millis = number;
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+int main(int argc, const char *argv[]) {
+	BenchOptions options;
+	if (!parse_bench_options(argc, argv, &options)) {
+		fprintf(stderr, "Invalid arguments\n");
+		print_bench_usage();
+		return EXIT_FAILURE;
+	}
+
+	static uint8_t roms[MAX_BENCH_ROMS][ROM_SIZE];
+	for (uint32_t i = 0; i < options.roms; ++i) {
+		size_t bytes_read;
+		if (!load_rom(options.rom_paths[i], roms[i], &bytes_read)) {
+			return EXIT_FAILURE;
+		}
+	}
+	static uint8_t synthetic_rom[ROM_SIZE];
+	memcpy(synthetic_rom, SYNTHETIC_BENCH_ROM, sizeof(SYNTHETIC_BENCH_ROM));
+
+	BenchReport report;
+	report.options = &options;
+	report.benchmarks = 0;
+	report.json = fopen(options.output_path, "w");
+	if (report.json == NULL) {
+		fprintf(stderr, "Failed to open output file %s\n", options.output_path);
+		return EXIT_FAILURE;
+	}
+
+	BenchContext context;
+	context.cpu_state = malloc(sizeof(CpuState));
+	context.other_cpu_state = malloc(sizeof(CpuState));
+	if (context.cpu_state == NULL || context.other_cpu_state == NULL) {
+		return EXIT_FAILURE;
+	}
+	context.jit = CHIP8_JIT && jit_init(&bench_jit) ? &bench_jit : NULL;
+
+	fprintf(
+		report.json,
+		"{\n  \"config\": {\"repetitions\": %u, \"min_sample_ms\": %u, \"threaded_core\": %s, \"jit\": %s, "
+		"\"instructions_per_tick\": %d},\n  \"benchmarks\": [",
+		options.repetitions, options.min_sample_millis, CHIP8_THREADED_CORE ? "true" : "false",
+		context.jit != NULL ? "true" : "false", BENCH_INSTRUCTIONS_PER_TICK
+	);
+
+	run_handler_benchmarks(&report, &context);
+	run_draw_benchmarks(&report, &context);
+	run_state_benchmarks(&report, &context);
+	run_rom_benchmarks(&report, &context, "synthetic", synthetic_rom);
+	for (uint32_t i = 0; i < options.roms; ++i) {
+		// Name ROMs after their file, without the directories
+		const char *rom_name = options.rom_paths[i];
+		for (const char *c = rom_name; *c != '\0'; ++c) {
+			if (*c == '/' || *c == '\\') {
+				rom_name = c + 1;
+			}
+		}
+		run_rom_benchmarks(&report, &context, rom_name, roms[i]);
+	}
+
+	fprintf(report.json, "\n  ]\n}\n");
+	bool ok = fclose(report.json) == 0;
+	printf("Wrote %u benchmark(s) to %s\n", report.benchmarks, options.output_path);
+
+	if (context.jit != NULL) {
+		jit_destroy(context.jit);
+	}
+	free(context.cpu_state);
+	free(context.other_cpu_state);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,347 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "debug.h"
+#include "farm.h"
+#include "input_script.h"
+#include "save_state.h"
+#include "replay.h"
+
+#define DEFAULT_FRAMES 600
+
+#if CHIP8_AOT
+// Built from the output of chip8_aot
+extern const AotProgram aot_program;
+#endif
+
+uint8_t rom[ROM_SIZE];
+
+typedef struct {
+	const char *rom_path;
+	uint64_t instructions;
+	uint32_t frames;
+	uint32_t instructions_per_frame;
+	const char *input_path;
+	const char *display_path;
+	const char *state_path;
+	const char *load_state_path;
+	const char *save_state_path;
+	const char *replay_path;
+	bool wall_clock;
+	bool seeded;
+	uint64_t seed;
+	uint64_t sessions;
+	uint64_t threads;
+	bool lockstep;
+	QuirkProfile quirk_profile;
+	bool quirks_given;
+} HeadlessOptions;
+
+void print_usage() {
+	printf(
+		"Usage: chip8_headless path/to/chip8_rom.ch8 [options]\n"
+		"  --instructions N  Stop after N instructions\n"
+		"  --frames N        Stop after N frames, if --instructions isn't given (default %d)\n"
+		"  --ipf N           Instructions per frame (default %d)\n"
+		"  --input PATH      Scripted input, lines of \"FRAME KEYMASK\"\n"
+		"  --display PATH    Write the final display to PATH (default: standard output)\n"
+		"  --state PATH      Write the final registers, stack, timers and keyboard to PATH\n"
+		"  --load-state PATH Start from the save states in PATH, session N from state N modulo their count\n"
+		"  --save-state PATH Write the final state to PATH as a save state\n"
+		"  --seed N          Seed the random number generator of every session, overriding any loaded state\n"
+		"  --quirks NAME     Quirk profile: default, vip, chip48 or schip, loaded states and replays keep theirs (default: default)\n"
+		"  --replay PATH     Run the recorded replay in PATH as fast as possible, checking its state hashes\n"
+		"  --wall-clock      Run the timers in real time, instead of ticking them once per frame\n"
+		"  --sessions N      Run N copies of the ROM, and report the aggregate speed (default 1)\n"
+		"  --threads N       Worker threads for the sessions (default: one per core)\n"
+		"  --lockstep        Run the sessions in SIMD lockstep groups, needs virtual timers\n",
+		DEFAULT_FRAMES, DEFAULT_INSTRUCTIONS_PER_FRAME
+	);
+}
+
+bool parse_unsigned(const char *text, uint64_t *value) {
+	char *end_ptr = NULL;
+	unsigned long long parsed = strtoull(text, &end_ptr, 10);
+	if (end_ptr == text || *end_ptr != '\0') {
+		return false;
+	}
+	*value = parsed;
+	return true;
+}
+
+bool parse_options(int argc, const char *argv[], HeadlessOptions *options) {
+	options->rom_path = NULL;
+	options->instructions = 0;
+	options->frames = DEFAULT_FRAMES;
+	options->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+	options->input_path = NULL;
+	options->display_path = NULL;
+	options->state_path = NULL;
+	options->load_state_path = NULL;
+	options->save_state_path = NULL;
+	options->replay_path = NULL;
+	options->wall_clock = false;
+	options->seeded = false;
+	options->seed = 0;
+	options->sessions = 1;
+	options->threads = 0;
+	options->lockstep = false;
+	options->quirk_profile = QUIRKS_DEFAULT;
+	options->quirks_given = false;
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+		uint64_t number;
+
+		if (arg[0] != '-') {
+			if (options->rom_path != NULL) {
+				return false;
+			}
+			options->rom_path = arg;
+			continue;
+		}
+
+		if (strcmp(arg, "--wall-clock") == 0) {
+			options->wall_clock = true;
+			continue;
+		}
+		if (strcmp(arg, "--lockstep") == 0) {
+			options->lockstep = true;
+			continue;
+		}
+
+		if (value == NULL) {
+			return false;
+		}
+		++i;
+
+		if (strcmp(arg, "--instructions") == 0 && parse_unsigned(value, &number)) {
+			options->instructions = number;
+		} else if (strcmp(arg, "--frames") == 0 && parse_unsigned(value, &number)) {
+			options->frames = number;
+		} else if (strcmp(arg, "--ipf") == 0 && parse_unsigned(value, &number) && number > 0) {
+			options->instructions_per_frame = number;
+		} else if (strcmp(arg, "--sessions") == 0 && parse_unsigned(value, &number) && number > 0) {
+			options->sessions = number;
+		} else if (strcmp(arg, "--threads") == 0 && parse_unsigned(value, &number)) {
+			options->threads = number;
+		} else if (strcmp(arg, "--seed") == 0 && parse_unsigned(value, &number)) {
+			options->seeded = true;
+			options->seed = number;
+		} else if (strcmp(arg, "--input") == 0) {
+			options->input_path = value;
+		} else if (strcmp(arg, "--display") == 0) {
+			options->display_path = value;
+		} else if (strcmp(arg, "--state") == 0) {
+			options->state_path = value;
+		} else if (strcmp(arg, "--load-state") == 0) {
+			options->load_state_path = value;
+		} else if (strcmp(arg, "--save-state") == 0) {
+			options->save_state_path = value;
+		} else if (strcmp(arg, "--replay") == 0) {
+			options->replay_path = value;
+		} else if (strcmp(arg, "--quirks") == 0 && parse_quirk_profile(value, &options->quirk_profile)) {
+			options->quirks_given = true;
+		} else {
+			return false;
+		}
+	}
+
+	return options->rom_path != NULL;
+}
+
+bool write_output(const char *path, CpuState *cpu_state, void (*writer)(FILE *, CpuState *)) {
+	FILE *file_ptr = fopen(path, "w");
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open output file %s\n", path);
+		return false;
+	}
+	writer(file_ptr, cpu_state);
+	fclose(file_ptr);
+	return true;
+}
+
+/*
+ * Writes the display, state and save state of a session as requested by the options.
+ */
+bool write_outputs(const HeadlessOptions *options, CpuState *cpu_state) {
+	bool ok = true;
+	if (options->display_path != NULL) {
+		ok = write_output(options->display_path, cpu_state, write_display) && ok;
+	} else {
+		write_display(stdout, cpu_state);
+	}
+	if (options->state_path != NULL) {
+		ok = write_output(options->state_path, cpu_state, write_registers) && ok;
+	}
+	if (options->save_state_path != NULL) {
+		ok = save_state_to_file(options->save_state_path, cpu_state) && ok;
+	}
+	return ok;
+}
+
+/*
+ * Replays a recording from a reset, ignoring the options that control a normal run.
+ * The quirk profile is the one it was recorded with, unless --quirks asks for another.
+ */
+int run_replay_file(const HeadlessOptions *options) {
+	Replay replay;
+	if (!load_replay(&replay, options->replay_path)) {
+		return EXIT_FAILURE;
+	}
+	QuirkProfile quirk_profile = options->quirk_profile;
+	if (!options->quirks_given && !find_quirk_profile(replay.quirks, &quirk_profile)) {
+		fprintf(stderr, "The replay was recorded with unknown quirks (%#x)\n", replay.quirks);
+		free_replay(&replay);
+		return EXIT_FAILURE;
+	}
+	if (!check_replay_rom(&replay, rom, quirk_profile)) {
+		free_replay(&replay);
+		return EXIT_FAILURE;
+	}
+
+	CpuState *cpu_state = malloc(sizeof(CpuState));
+	if (cpu_state == NULL) {
+		free_replay(&replay);
+		return EXIT_FAILURE;
+	}
+	init_state(cpu_state, rom);
+	set_quirk_profile(cpu_state, quirk_profile);
+
+	JitContext jit;
+	bool use_jit = CHIP8_JIT && jit_init(&jit);
+
+	ReplayResult result;
+	double start = read_monotonic_seconds();
+	bool ok = run_replay(&replay, cpu_state, use_jit ? &jit : NULL, &result);
+	double elapsed = read_monotonic_seconds() - start;
+
+	if (!ok) {
+		fprintf(stderr, "Invalid replay file %s\n", options->replay_path);
+	} else {
+		fprintf(
+			stderr, "Replayed %u frame(s), %llu instruction(s) in %.3f s, %.0f instructions per second\n",
+			result.frames, (unsigned long long) result.executed, elapsed, elapsed > 0 ? result.executed / elapsed : 0
+		);
+		if (result.diverged) {
+			fprintf(
+				stderr, "Diverged from the recording at frame %u, %u state hash(es) checked\n",
+				result.diverged_frame, result.hashes_checked
+			);
+			ok = false;
+		} else {
+			fprintf(stderr, "Matched all %u recorded state hash(es)\n", result.hashes_checked);
+		}
+	}
+
+	ok = write_outputs(options, cpu_state) && ok;
+
+	if (use_jit) {
+		jit_destroy(&jit);
+	}
+	free(cpu_state);
+	free_replay(&replay);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+int main(int argc, const char *argv[]) {
+	HeadlessOptions options;
+	if (!parse_options(argc, argv, &options)) {
+		fprintf(stderr, "Invalid arguments\n");
+		print_usage();
+		return EXIT_FAILURE;
+	}
+
+	size_t bytes_read;
+	if (!load_rom(options.rom_path, rom, &bytes_read)) {
+		return EXIT_FAILURE;
+	}
+
+	if (options.replay_path != NULL) {
+		return run_replay_file(&options);
+	}
+
+	InputScript script;
+	init_input_script(&script);
+	if (options.input_path != NULL && !load_input_script(&script, options.input_path)) {
+		return EXIT_FAILURE;
+	}
+
+	Farm farm;
+	if (!init_farm(&farm, options.sessions, rom)) {
+		fprintf(stderr, "Failed to allocate %llu session(s)\n", (unsigned long long) options.sessions);
+		return EXIT_FAILURE;
+	}
+	farm.instructions = options.instructions;
+	farm.frames = options.frames;
+	farm.instructions_per_frame = options.instructions_per_frame;
+	farm.use_jit = CHIP8_JIT;
+	for (size_t i = 0; i < farm.size; ++i) {
+		set_quirk_profile(farm.sessions[i].cpu_state, options.quirk_profile);
+	}
+#if CHIP8_AOT
+	if (matches_aot_rom(&aot_program, rom, bytes_read)) {
+		farm.aot_program = &aot_program;
+		if (aot_program.quirk_profile != options.quirk_profile) {
+			fprintf(stderr, "The ROM was translated ahead of time with other quirks, interpreting it instead\n");
+		}
+	} else {
+		fprintf(stderr, "The ROM isn't the one translated ahead of time, interpreting it instead\n");
+	}
+#endif
+	farm.lockstep = options.lockstep;
+
+	if (options.load_state_path != NULL) {
+		SaveStateLibrary library;
+		if (!open_save_state_library(&library, options.load_state_path)) {
+			return EXIT_FAILURE;
+		}
+		size_t count = count_save_states(&library);
+		for (size_t i = 0; i < farm.size; ++i) {
+			if (!load_save_state(&library, i % (count > 0 ? count : 1), farm.sessions[i].cpu_state)) {
+				fprintf(stderr, "Invalid save state file %s\n", options.load_state_path);
+				return EXIT_FAILURE;
+			}
+		}
+		close_save_state_library(&library);
+	}
+
+	for (size_t i = 0; i < farm.size; ++i) {
+		// States saved with virtual timers keep their own tick schedule
+		if (!options.wall_clock && !has_virtual_timers(farm.sessions[i].cpu_state)) {
+			use_virtual_timers(farm.sessions[i].cpu_state, options.instructions_per_frame);
+		}
+		if (options.seeded) {
+			seed_random(farm.sessions[i].cpu_state, options.seed);
+		}
+		farm.sessions[i].input = script;
+	}
+
+	// A single session doesn't need any extra thread
+	run_farm(&farm, options.sessions == 1 ? 1 : options.threads);
+
+	FarmSession *first = &farm.sessions[0];
+	fprintf(
+		stderr, "Executed %llu instruction(s) in %u frame(s)\n",
+		(unsigned long long) first->executed, first->frames
+	);
+	if (farm.size > 1) {
+		fprintf(
+			stderr, "Ran %zu session(s) on %u thread(s) in %.3f s, %.0f instructions per second\n",
+			farm.size, farm.threads, farm.elapsed_seconds, farm_instructions_per_second(&farm)
+		);
+	}
+
+	// Only the first session is written out
+	bool ok = write_outputs(&options, first->cpu_state);
+
+	free_farm(&farm);
+	free_input_script(&script);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
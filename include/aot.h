@@ -0,0 +1,84 @@
+#ifndef CHIP8_AOT_H
+#define CHIP8_AOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "state.h"
+#include "cpu.h"
+#include "timers.h"
+#include "stats.h"
+#include "profiler.h"
+
+/*
+ * Ahead of time translation of a ROM to C.
+ * chip8_aot follows the jumps, calls and skips of a ROM from its entry point to find its basic blocks, and writes a
+ * translation unit with a C function per block, along with the table of blocks as an AotProgram.
+ * Once built into a runner, run_aot runs the blocks whose code is still the same as in the ROM, and interprets the rest:
+ * code only reached through computed jumps (BNNN), data run as code, and code rewritten by the program itself.
+ * Like the recompiler, it's left out of builds with stats or profiling, which need every instruction to go through
+ * the interpreter.
+ */
+#if !CHIP8_STATS && !CHIP8_PROFILE
+#define AOT_SUPPORTED 1
+#else
+#define AOT_SUPPORTED 0
+#endif
+
+/*
+ * If set, the headless runner is built along with the translation of a ROM, and runs it when given the same ROM.
+ */
+#ifndef CHIP8_AOT
+#define CHIP8_AOT 0
+#endif
+
+// Longer blocks are split, so they rarely go past the instructions left before the next timer tick
+#define AOT_MAX_BLOCK_INSTRUCTIONS 8
+#define DEFAULT_AOT_SYMBOL "aot_program"
+
+/*
+ * Runs the instructions of a block, all of them, and leaves the PC at the next one to run.
+ */
+typedef void AotBlockFunction(CpuState *cpu_state);
+
+typedef struct {
+	uint16_t address;
+	uint8_t length;
+	AotBlockFunction *function;
+} AotBlock;
+
+typedef struct {
+	// The ROM the program was translated from, a block only runs while its code in memory is still the same
+	const uint8_t *rom;
+	uint16_t rom_size;
+	const AotBlock *blocks;
+	size_t block_count;
+	// Blocks call the handlers of this profile, so they only run on states with the same quirks
+	uint8_t quirk_profile;
+} AotProgram;
+
+typedef struct {
+	const AotProgram *program;
+
+	AotBlockFunction *blocks[MEMORY_SIZE];
+	uint8_t block_lengths[MEMORY_SIZE];
+
+	// Blocks are only checked against the memory of this state, at this code generation
+	const CpuState *cpu_state;
+	uint32_t code_generation;
+} AotContext;
+
+size_t find_aot_blocks(CpuState *cpu_state, uint16_t rom_size, uint16_t *addresses, uint8_t *lengths);
+
+size_t write_aot_program(FILE *file_ptr, CpuState *cpu_state, uint16_t rom_size, const char *symbol);
+
+bool matches_aot_rom(const AotProgram *program, const uint8_t *rom, size_t rom_size);
+
+void aot_init(AotContext *aot, const AotProgram *program);
+
+uint32_t aot_run(AotContext *aot, CpuState *cpu_state, uint32_t count);
+
+#endif //CHIP8_AOT_H
@@ -2,7 +2,6 @@
 #define CHIP8_BEEPER_H
 
 #include <stdbool.h>
-#include "SDL_mixer.h"
 
 #include "state.h"
 
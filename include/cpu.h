@@ -10,13 +10,44 @@
 #include "registers.h"
 #include "instructions.h"
 #include "memory.h"
-
-typedef void Instruction(CpuState *, uint16_t);
+#include "decode_cache.h"
+#include "opcodes.h"
+#include "threaded.h"
+#include "superinstructions.h"
+#include "stats.h"
+#include "profiler.h"
+
+/*
+ * Selects the core behind run_instructions.
+ * If set, use the threaded-code interpreter in threaded.c.
+ * Otherwise, use the fetch, decode and execute loop.
+ */
+#ifndef CHIP8_THREADED_CORE
+#define CHIP8_THREADED_CORE 0
+#endif
+
+/*
+ * Instructions executed on every 60 Hz frame by default, close to the speed of the original interpreter.
+ */
+#define DEFAULT_INSTRUCTIONS_PER_FRAME 10
+
+extern Instruction *const QUIRK_INSTRUCTION_HANDLERS[NUMBER_OF_QUIRK_PROFILES][NUMBER_OF_OPCODES];
+
+// Handlers of the default profile
+#define INSTRUCTION_HANDLERS (QUIRK_INSTRUCTION_HANDLERS[QUIRKS_DEFAULT])
 
 uint16_t fetch(CpuState *cpu_state);
 
+DecodedInstruction *fetch_decoded(CpuState *cpu_state);
+
+DecodedInstruction *decode_cached(CpuState *cpu_state, uint16_t address);
+
+Opcode decode_opcode(uint16_t instruction);
+
 Instruction *decode(uint16_t instruction);
 
 void execute(CpuState *cpu_state, uint16_t instruction, Instruction function);
 
+uint32_t run_instructions(CpuState *cpu_state, uint32_t count);
+
 #endif //CHIP8_CPU_H
@@ -4,7 +4,18 @@
 #include <stdint.h>
 #include <stdio.h>
 #include "screen.h"
+#include "keyboard.h"
+#include "timers.h"
+#include "opcodes.h"
+
+#define DISASSEMBLY_SIZE 24
 
 void print_display(CpuState *cpu_state);
 
+void write_display(FILE *file, CpuState *cpu_state);
+
+void write_registers(FILE *file, CpuState *cpu_state);
+
+void disassemble_instruction(Opcode opcode, uint16_t instruction, char *buffer, size_t size);
+
 #endif //CHIP8_DEBUG_H
@@ -0,0 +1,27 @@
+#ifndef CHIP8_DECODE_CACHE_H
+#define CHIP8_DECODE_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "state.h"
+#include "utils.h"
+
+/*
+ * Per-address cache of already decoded instructions.
+ * An entry at address A depends on the bytes at A and A + 1, so any write to memory must go through
+ * invalidate_decoded_instruction (write_byte_memory and write_word_memory already do).
+ */
+
+DecodedInstruction *lookup_decoded_instruction(CpuState *cpu_state, uint16_t address);
+
+DecodedInstruction *store_decoded_instruction(
+	CpuState *cpu_state, uint16_t address, uint16_t instruction, uint8_t opcode, Instruction *function
+);
+
+void invalidate_decoded_instruction(CpuState *cpu_state, uint16_t address);
+
+void clear_decode_cache(CpuState *cpu_state);
+
+#endif //CHIP8_DECODE_CACHE_H
@@ -12,10 +12,34 @@
 #define PIXEL_SCALING 10
 #define MIXER_CHANNEL 0
 
-void render_display(CpuState *cpu_state, SDL_Renderer *renderer);
+#define COLOR_ARGB_ON 0xFFFFFFFF
+#define COLOR_ARGB_OFF 0xFF000000
+
+// Held down to step back through the rewind history, one frame per frame
+#define REWIND_SCANCODE SDL_SCANCODE_BACKSPACE
+
+#define FRAMES_PER_SECOND 60
+// Below this much time left until the deadline, stop sleeping and spin, since SDL_Delay can overshoot by a millisecond or more
+#define FRAME_SPIN_THRESHOLD_MICROS 2000
+
+typedef struct {
+	Uint64 ticks_per_frame;
+	Uint64 spin_threshold_ticks;
+	Uint64 next_deadline;
+} FramePacer;
+
+void render_display(CpuState *cpu_state, SDL_Renderer *renderer, SDL_Texture *texture, uint32_t dirty_rows);
 
 void play_beeper(CpuState *cpu_state, bool *previous_state, Mix_Chunk *beep_mix_chunk);
 
 void update_keyboard_state(CpuState *cpu_state);
 
+bool is_rewind_key_pressed();
+
+void init_frame_pacer(FramePacer *pacer);
+
+void wait_for_next_frame(FramePacer *pacer, bool idle);
+
+void wait_for_next_frame_or_input(FramePacer *pacer);
+
 #endif //CHIP8_EMULATOR_H
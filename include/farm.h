@@ -0,0 +1,82 @@
+#ifndef CHIP8_FARM_H
+#define CHIP8_FARM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+
+#include "state.h"
+#include "input_script.h"
+#include "jit.h"
+#include "aot.h"
+#include "lockstep.h"
+
+#define FARM_MAX_THREADS 256
+
+/*
+ * A farm runs many independent sessions on a pool of worker threads.
+ * Every worker starts with a contiguous range of sessions, and once it's done with its own, it steals sessions from
+ * the front of the other workers' ranges, so a few slow sessions don't leave the rest of the threads idle.
+ */
+
+typedef struct {
+	CpuState *cpu_state;
+	// Read-only events may be shared between sessions, each session keeps its own position
+	InputScript input;
+
+	// Results
+	uint64_t executed;
+	uint32_t frames;
+} FarmSession;
+
+typedef struct {
+	pthread_mutex_t lock;
+	size_t front;
+	size_t back;
+} FarmQueue;
+
+typedef struct {
+	FarmSession *sessions;
+	CpuState *cpu_states;
+	size_t size;
+
+	// Budget for each session, if instructions is 0 it runs for the given number of frames
+	uint64_t instructions;
+	uint32_t frames;
+	uint32_t instructions_per_frame;
+	bool use_jit;
+	// Translation of the ROM to run instead of the recompiler, or NULL
+	const AotProgram *aot_program;
+	// Run groups of LOCKSTEP_MAX_LANES sessions in lockstep, only used if their timers are virtual
+	bool lockstep;
+
+	// Results for the whole farm
+	uint32_t threads;
+	uint64_t executed;
+	double elapsed_seconds;
+} Farm;
+
+uint32_t count_cpu_cores();
+
+double read_monotonic_seconds();
+
+bool init_farm(Farm *farm, size_t size, const uint8_t *rom);
+
+uint32_t next_farm_batch(Farm *farm, uint64_t executed, uint32_t frames);
+
+uint32_t merge_farm_key_wait(Farm *farm, FarmSession *session, uint32_t *batch);
+
+void run_farm_session(Farm *farm, FarmSession *session, JitContext *jit, AotContext *aot);
+
+void run_farm_lockstep_group(Farm *farm, size_t group, JitContext *jit, AotContext *aot);
+
+bool run_farm(Farm *farm, uint32_t threads);
+
+double farm_instructions_per_second(const Farm *farm);
+
+void free_farm(Farm *farm);
+
+#endif //CHIP8_FARM_H
@@ -0,0 +1,41 @@
+#ifndef CHIP8_INPUT_SCRIPT_H
+#define CHIP8_INPUT_SCRIPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "state.h"
+#include "keyboard.h"
+
+/*
+ * Scripted keyboard input for headless runs.
+ * Each non-empty line that doesn't start with # is "FRAME MASK": from frame FRAME onwards,
+ * the keys set in the hexadecimal bitmask MASK are held down and every other key is released.
+ * Lines must be sorted by frame.
+ */
+
+typedef struct {
+	uint32_t frame;
+	uint16_t keys;
+} InputEvent;
+
+typedef struct {
+	InputEvent *events;
+	size_t size;
+	size_t next;
+} InputScript;
+
+void init_input_script(InputScript *script);
+
+bool load_input_script(InputScript *script, const char *path);
+
+void apply_input_script(InputScript *script, CpuState *cpu_state, uint32_t frame);
+
+uint32_t next_input_script_frame(InputScript *script);
+
+void free_input_script(InputScript *script);
+
+#endif //CHIP8_INPUT_SCRIPT_H
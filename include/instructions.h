@@ -13,37 +13,13 @@
 #include "memory.h"
 #include "keyboard.h"
 #include "timers.h"
+#include "random.h"
+#include "quirks.h"
 
 #define INSTRUCTION_SIZE 2
 #define STATUS_REGISTER ((uint8_t) 0xF)
 #define SPRITE_WIDTH 8
 
-/*
- * If set, force the shift operations SHIFTL and SHIFTR to use the extra provided.
- * Otherwise, perform the shift in place, ignoring the extra argument entirely.
- */
-#define OPTION_USE_EXTRA_REGISTER_ON_SHIFT 1
-
-/*
- * Controls how the destination address for JUMPR.
- * If set, implement BXNN: the base register is VX, and the offset is NN.
- * Otherwise, implement BNNN: the base register is always V0, and NNN is the offset.
- */
-#define OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET 0
-
-/*
- * If set, the instruction IADD sets the carry flag if the result overflows over the expected 12 bits size.
- * This includes setting the flag to 0 if it doesn't overflow.
- * If not set, the instruction will not alter the carry flag whatsoever.
- */
-#define OPTION_OVERFLOW_ON_ADD_TO_INDEX 0
-
-/*
- * If set, DUMP will set the register I to I + X + 1 after its execution.
- * Otherwise, DUMP will not alter the I.
- */
-#define OPTION_DUMP_INCREMENTS_I 0
-
 /* Graphics */
 
 void clear_screen(CpuState *cpu_state, __attribute__((unused)) uint16_t _instruction);
@@ -130,4 +106,36 @@ void wait_for_key(CpuState *cpu_state, uint16_t instruction);
 
 void point_to_char(CpuState *cpu_state, uint16_t instruction);
 
+/* Quirks */
+
+/*
+ * Handlers of the instructions that depend on quirks, taking the quirks as arguments.
+ * They're always inlined into the copies specialized for each profile, declared below.
+ */
+
+void jump_with_offset_with_quirks(CpuState *cpu_state, uint16_t instruction, bool register_argument);
+
+void save_registers_with_quirks(CpuState *cpu_state, uint16_t instruction, uint8_t index_increment);
+
+void load_registers_with_quirks(CpuState *cpu_state, uint16_t instruction, uint8_t index_increment);
+
+void add_to_index_with_quirks(CpuState *cpu_state, uint16_t instruction, bool overflow);
+
+void shift_left_with_quirks(CpuState *cpu_state, uint16_t instruction, bool use_extra_register);
+
+void shift_right_with_quirks(CpuState *cpu_state, uint16_t instruction, bool use_extra_register);
+
+void wait_for_key_with_quirks(CpuState *cpu_state, uint16_t instruction, bool wait_for_release);
+
+#define DECLARE_QUIRK_HANDLERS(profile, name, suffix, ...) \
+	void jump_with_offset##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void save_registers##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void load_registers##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void add_to_index##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void shift_left##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void shift_right##suffix(CpuState *cpu_state, uint16_t instruction); \
+	void wait_for_key##suffix(CpuState *cpu_state, uint16_t instruction);
+
+FOR_EACH_QUIRK_PROFILE(DECLARE_QUIRK_HANDLERS)
+
 #endif //CHIP8_INSTRUCTIONS_H
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "state.h"
+#include "stats.h"
+#include "profiler.h"
+
+/*
+ * The recompiler only targets x86-64, on any other architecture jit_init fails and callers should keep interpreting.
+ * It's also left out of builds with stats, which need every instruction to go through execute().
+ */
+#if (defined(__x86_64__) || defined(_M_X64)) && !CHIP8_STATS && !CHIP8_PROFILE
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+/*
+ * If set, the frontends run guest code through the recompiler when it is supported.
+ */
+#ifndef CHIP8_JIT
+#define CHIP8_JIT 0
+#endif
+
+#if defined(_WIN64)
+#define JIT_WIN64_ABI 1
+#else
+#define JIT_WIN64_ABI 0
+#endif
+
+#define JIT_CODE_SIZE (4 * 1024 * 1024)
+#define JIT_MAX_BLOCK_INSTRUCTIONS 64
+#define JIT_MAX_CHAIN_SITES 8192
+
+/*
+ * A jump at the end of a block whose target block had not been compiled yet.
+ * It exits to the dispatcher until the target is compiled, then it gets patched to jump straight into it.
+ */
+typedef struct {
+	uint32_t rel32_offset;
+	uint16_t target;
+} JitChainSite;
+
+typedef struct {
+	uint8_t *code;
+	size_t code_used;
+	size_t stubs_size;
+
+	int64_t (*enter)(CpuState *cpu_state, uint8_t *block, int64_t budget);
+	uint8_t *exit_stub;
+
+	uint8_t *blocks[MEMORY_SIZE];
+	uint8_t block_lengths[MEMORY_SIZE];
+
+	JitChainSite chain_sites[JIT_MAX_CHAIN_SITES];
+	size_t chain_sites_used;
+
+	// Blocks are only valid for the memory of this state, at this code generation
+	const CpuState *cpu_state;
+	uint32_t code_generation;
+} JitContext;
+
+bool jit_init(JitContext *jit);
+
+void jit_destroy(JitContext *jit);
+
+void jit_flush(JitContext *jit);
+
+uint32_t jit_run(JitContext *jit, CpuState *cpu_state, uint32_t count);
+
+#endif //CHIP8_JIT_H
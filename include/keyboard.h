@@ -1,11 +1,9 @@
 #ifndef CHIP8_KEYBOARD_H
 #define CHIP8_KEYBOARD_H
 
+#include <stdint.h>
 #include <stdbool.h>
 
-#include "SDL_keycode.h"
-#include "SDL_keyboard.h"
-
 #include "state.h"
 
 void set_key_pressed(CpuState *cpu_state, uint8_t key, bool status);
@@ -14,4 +12,12 @@ bool is_key_pressed(CpuState *cpu_state, uint8_t key);
 
 bool any_key_pressed(CpuState *cpu_state, uint8_t *pressed_key);
 
+uint16_t read_keyboard_mask(CpuState *cpu_state);
+
+bool poll_key_wait(CpuState *cpu_state, bool wait_for_release, uint8_t *key);
+
+bool is_waiting_for_key(CpuState *cpu_state);
+
+void write_keyboard_mask(CpuState *cpu_state, uint16_t mask);
+
 #endif //CHIP8_KEYBOARD_H
@@ -0,0 +1,48 @@
+#ifndef CHIP8_LOCKSTEP_H
+#define CHIP8_LOCKSTEP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "state.h"
+
+#define LOCKSTEP_MAX_LANES 32
+
+/*
+ * Runs up to LOCKSTEP_MAX_LANES instances of the same program side by side.
+ * The registers, PC, I, timers and cycle counters of every instance (lane) are kept in structure-of-arrays form,
+ * so when several lanes are at the same PC with the same instruction, it runs on all of them at once with AVX2.
+ * Lanes whose PCs diverge, and instructions without a vector kernel, go through the regular handlers one lane at a time.
+ * Memory, stack, display and keyboard stay in each lane's CpuState.
+ * Lanes must use virtual timers, all of them with the same cycles_per_tick, and the same quirk profile.
+ */
+
+typedef struct {
+	uint32_t lanes;
+	CpuState *cpu_states[LOCKSTEP_MAX_LANES];
+
+	// Indexed [register][lane], so a register of every lane fits in a single AVX2 vector
+	uint8_t registers[REGISTERS][LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint16_t program_counters[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint16_t index_registers[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint8_t delay_timers[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint8_t sound_timers[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint32_t cycles_until_tick[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	uint64_t cycles[LOCKSTEP_MAX_LANES];
+	uint32_t cycles_per_tick;
+	// Quirk of the lanes' profile used by the vector kernels
+	bool shift_uses_extra_register;
+
+	bool use_avx2;
+	// Lane-instructions run by the vector kernels and by the handlers
+	uint64_t vector_instructions;
+	uint64_t scalar_instructions;
+} LockstepBatch;
+
+bool init_lockstep_batch(LockstepBatch *batch, CpuState *const *cpu_states, uint32_t lanes);
+
+void run_lockstep(LockstepBatch *batch, uint32_t count);
+
+void sync_lockstep_batch(LockstepBatch *batch);
+
+#endif //CHIP8_LOCKSTEP_H
@@ -6,11 +6,14 @@
 
 #include "state.h"
 #include "utils.h"
+#include "decode_cache.h"
 
 uint8_t read_byte_memory(CpuState *cpu_state, uint16_t address);
 
 uint16_t read_word_memory(CpuState *cpu_state, uint16_t address);
 
+void mark_memory_page_dirty(CpuState *cpu_state, uint16_t address);
+
 void write_byte_memory(CpuState *cpu_state, uint16_t address, uint8_t value);
 
 void write_word_memory(CpuState *cpu_state, uint16_t address, uint16_t word);
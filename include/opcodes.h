@@ -0,0 +1,48 @@
+#ifndef CHIP8_OPCODES_H
+#define CHIP8_OPCODES_H
+
+/*
+ * Every instruction understood by the interpreter, one per handler in instructions.h.
+ */
+typedef enum {
+	OPCODE_INVALID = 0,
+
+	OPCODE_CLEAR_SCREEN, // 00E0
+	OPCODE_RETURN_SUBROUTINE, // 00EE
+	OPCODE_JUMP, // 1NNN
+	OPCODE_JUMP_SUBROUTINE, // 2NNN
+	OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE, // 3XNN
+	OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE, // 4XNN
+	OPCODE_SKIP_IF_REGISTERS_EQUAL, // 5XY0
+	OPCODE_SET_REGISTER_TO_IMMEDIATE, // 6XNN
+	OPCODE_ADD_IMMEDIATE_TO_REGISTER, // 7XNN
+	OPCODE_COPY_REGISTER, // 8XY0
+	OPCODE_BITWISE_OR, // 8XY1
+	OPCODE_BITWISE_AND, // 8XY2
+	OPCODE_BITWISE_XOR, // 8XY3
+	OPCODE_ADD_REGISTER_TO_REGISTER, // 8XY4
+	OPCODE_SUB_REGISTER_FROM_REGISTER, // 8XY5
+	OPCODE_SHIFT_RIGHT, // 8XY6
+	OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER, // 8XY7
+	OPCODE_SHIFT_LEFT, // 8XYE
+	OPCODE_SKIP_IF_REGISTERS_DIFFERENT, // 9XY0
+	OPCODE_SET_INDEX_REGISTER, // ANNN
+	OPCODE_JUMP_WITH_OFFSET, // BNNN
+	OPCODE_SET_REGISTER_TO_BITMASKED_RAND, // CXNN
+	OPCODE_DRAW, // DXYN
+	OPCODE_SKIP_PRESSED, // EX9E
+	OPCODE_SKIP_NOT_PRESSED, // EXA1
+	OPCODE_READ_DELAY, // FX07
+	OPCODE_WAIT_FOR_KEY, // FX0A
+	OPCODE_SET_DELAY, // FX15
+	OPCODE_SET_SOUND, // FX18
+	OPCODE_ADD_TO_INDEX, // FX1E
+	OPCODE_POINT_TO_CHAR, // FX29
+	OPCODE_DECIMAL_DECODE, // FX33
+	OPCODE_SAVE_REGISTERS, // FX55
+	OPCODE_LOAD_REGISTERS, // FX65
+
+	NUMBER_OF_OPCODES
+} Opcode;
+
+#endif //CHIP8_OPCODES_H
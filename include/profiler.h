@@ -0,0 +1,85 @@
+#ifndef CHIP8_PROFILER_H
+#define CHIP8_PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "state.h"
+
+/*
+ * If set, the interpreter counts the executions of every guest address and the host cycles spent running each, and
+ * the addresses FX0A spins on while waiting for a key. At exit, a report sorted by cycles and annotated with the
+ * disassembly of every address is written, along with a heatmap of the address space.
+ * Instructions and draws are also attributed to the guest subroutines on the call stack, which are written as a table
+ * of inclusive and exclusive counts per subroutine and as collapsed stacks for flame graph tools.
+ * Like the stats, every instruction then goes through the interpreter loop, so the threaded core, the recompiler and
+ * the lockstep vector kernels are turned off. Without it, none of this is compiled in.
+ */
+#ifndef CHIP8_PROFILE
+#define CHIP8_PROFILE 0
+#endif
+
+// The report goes to this path with a ".txt" suffix, the heatmap with ".pgm", and the collapsed stacks of instructions
+// and draws with ".calls.folded" and ".draws.folded"
+#define ENV_PROFILE_OUTPUT "CHIP8_PROFILE_OUTPUT"
+#define DEFAULT_PROFILE_OUTPUT "chip8_profile"
+
+// The heatmap has a cell per address, a row of the text grid or image covers 64 bytes of memory
+#define PROFILE_HEATMAP_SIDE 64
+
+// Distinct call stacks tracked, once full new stacks are attributed to their deepest tracked frame
+#define PROFILE_CALL_NODES (1 << 16)
+// Call node of the code outside any subroutine
+#define PROFILE_ROOT_NODE 0
+
+#if CHIP8_PROFILE
+
+typedef struct {
+	uint64_t executions[MEMORY_SIZE];
+	uint64_t cycles[MEMORY_SIZE];
+	uint64_t key_wait_spins[MEMORY_SIZE];
+	// Last instruction seen at each address, for the disassembly of self-modifying code
+	uint16_t instructions[MEMORY_SIZE];
+	uint8_t opcodes[MEMORY_SIZE];
+} AddressProfile;
+
+/*
+ * Tree of the call stacks seen so far, a node per distinct path from the root through the entry points of the called
+ * subroutines. Nodes are found through an open addressing table keyed by parent and entry point.
+ */
+typedef struct {
+	// 0 if the slot is free, otherwise (parent << 16 | entry point) + 1
+	uint64_t keys[PROFILE_CALL_NODES];
+	uint64_t instructions[PROFILE_CALL_NODES];
+	uint64_t draws[PROFILE_CALL_NODES];
+} CallGraphProfile;
+
+extern AddressProfile address_profile;
+
+extern CallGraphProfile call_graph_profile;
+
+uint64_t read_profile_clock();
+
+uint32_t find_child_call_node(uint32_t parent, uint16_t entry);
+
+uint32_t find_call_node(CpuState *cpu_state);
+
+void record_profile_sample(
+	CpuState *cpu_state, uint16_t address, DecodedInstruction *decoded, uint32_t call_node, uint64_t cycles
+);
+
+void write_profile_report(FILE *file_ptr);
+
+void write_profile_heatmap(FILE *file_ptr);
+
+void write_profile_image(FILE *file_ptr);
+
+void write_call_graph_report(FILE *file_ptr);
+
+void write_collapsed_stacks(FILE *file_ptr, const uint64_t *counts);
+
+void dump_address_profile();
+
+#endif
+
+#endif //CHIP8_PROFILER_H
@@ -0,0 +1,98 @@
+#ifndef CHIP8_QUIRKS_H
+#define CHIP8_QUIRKS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "opcodes.h"
+
+/*
+ * If set, force the shift operations SHIFTL and SHIFTR to use the extra provided.
+ * Otherwise, perform the shift in place, ignoring the extra argument entirely.
+ */
+#define OPTION_USE_EXTRA_REGISTER_ON_SHIFT 1
+
+/*
+ * Controls how the destination address for JUMPR.
+ * If set, implement BXNN: the base register is VX, and the offset is NN.
+ * Otherwise, implement BNNN: the base register is always V0, and NNN is the offset.
+ */
+#define OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET 0
+
+/*
+ * If set, the instruction IADD sets the carry flag if the result overflows over the expected 12 bits size.
+ * This includes setting the flag to 0 if it doesn't overflow.
+ * If not set, the instruction will not alter the carry flag whatsoever.
+ */
+#define OPTION_OVERFLOW_ON_ADD_TO_INDEX 0
+
+// How far DUMP and LOAD move the register I, see OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD
+#define INDEX_UNCHANGED 0
+#define INDEX_INCREMENT_BY_X 1
+#define INDEX_INCREMENT_BY_X_PLUS_ONE 2
+
+/*
+ * If INDEX_INCREMENT_BY_X_PLUS_ONE, DUMP and LOAD will set the register I to I + X + 1 after their execution, like the
+ * original interpreter.
+ * If INDEX_INCREMENT_BY_X, they will set it to I + X, like the CHIP-48.
+ * If INDEX_UNCHANGED, they will not alter the I.
+ */
+#define OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD INDEX_UNCHANGED
+
+/*
+ * If set, KEY waits for a key to be pressed and then released, like the original interpreter, and stores the released
+ * key.
+ * Otherwise, KEY stores the first key found pressed, which may already be held down when it starts waiting.
+ */
+#define OPTION_KEY_WAIT_FOR_RELEASE 0
+
+/*
+ * Quirk profiles, selected per CpuState when it's created.
+ * The OPTION_ macros above are the default profile, the others follow the interpreters they're named after.
+ * Every profile gets its own copy of the handlers of the instructions that depend on quirks, with the quirks folded
+ * in, and the decode cache picks them from the profile's handler table, so running an instruction never checks them.
+ *
+ * PROFILE(id, name, handler suffix, shift uses VY, BXNN, IADD overflow, DUMP/LOAD I increment, KEY waits for release)
+ * The default profile has an empty suffix, so its handlers keep the plain names from instructions.h.
+ */
+#define FOR_EACH_QUIRK_PROFILE(PROFILE) \
+	PROFILE( \
+		QUIRKS_DEFAULT, "default", , \
+		OPTION_USE_EXTRA_REGISTER_ON_SHIFT, OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET, \
+		OPTION_OVERFLOW_ON_ADD_TO_INDEX, OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD, OPTION_KEY_WAIT_FOR_RELEASE \
+	) \
+	PROFILE(QUIRKS_COSMAC_VIP, "vip", _vip, 1, 0, 0, INDEX_INCREMENT_BY_X_PLUS_ONE, 1) \
+	PROFILE(QUIRKS_CHIP48, "chip48", _chip48, 0, 1, 0, INDEX_INCREMENT_BY_X, 0) \
+	PROFILE(QUIRKS_SCHIP, "schip", _schip, 0, 1, 0, INDEX_UNCHANGED, 0)
+
+#define DECLARE_QUIRK_PROFILE(profile, ...) profile,
+
+typedef enum {
+	FOR_EACH_QUIRK_PROFILE(DECLARE_QUIRK_PROFILE)
+
+	NUMBER_OF_QUIRK_PROFILES
+} QuirkProfile;
+
+typedef struct {
+	const char *name;
+	// Appended to the names of the handlers specialized for the profile
+	const char *handler_suffix;
+	bool use_extra_register_on_shift;
+	bool register_argument_on_jump_with_offset;
+	bool overflow_on_add_to_index;
+	// One of the INDEX_ values
+	uint8_t index_increment_on_dump_and_load;
+	bool key_wait_for_release;
+} QuirkSettings;
+
+extern const QuirkSettings QUIRK_PROFILE_SETTINGS[NUMBER_OF_QUIRK_PROFILES];
+
+bool parse_quirk_profile(const char *name, QuirkProfile *profile);
+
+bool depends_on_quirks(Opcode opcode);
+
+uint32_t quirk_profile_bits(QuirkProfile profile);
+
+bool find_quirk_profile(uint32_t bits, QuirkProfile *profile);
+
+#endif //CHIP8_QUIRKS_H
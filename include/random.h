@@ -0,0 +1,15 @@
+#ifndef CHIP8_RANDOM_H
+#define CHIP8_RANDOM_H
+
+#include <stdint.h>
+
+#include "state.h"
+
+// Seed of every state after initialization, so runs are reproducible unless seeded otherwise
+#define DEFAULT_RANDOM_SEED 0x8A5CD789635D2DFFull
+
+void seed_random(CpuState *cpu_state, uint64_t seed);
+
+uint8_t next_random_byte(CpuState *cpu_state);
+
+#endif //CHIP8_RANDOM_H
@@ -0,0 +1,92 @@
+#ifndef CHIP8_REPLAY_H
+#define CHIP8_REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "state.h"
+#include "instructions.h"
+#include "jit.h"
+
+/*
+ * Replay file format, version 1. Every integer is stored little endian.
+ *
+ * Header:
+ *   magic "8MUREPLY", u32 version, u64 ROM hash, u32 quirks (see quirk_profile_bits), u64 random seed, u32 instructions per frame,
+ *   u32 frames between state hashes
+ * Records, each starting with a u8 type:
+ *   REPLAY_RECORD_KEYS: u16 keyboard mask, u32 frames it was held for
+ *   REPLAY_RECORD_HASH: u32 frame, u64 hash of the state at the end of that frame
+ *   REPLAY_RECORD_END: u32 frames recorded
+ *
+ * Every frame, the keys are applied, then the instructions of the frame are run with virtual timers ticking once per
+ * frame, the same way in the frontend and in the replay, so the run is fully determined by the file and the ROM.
+ */
+
+#define REPLAY_MAGIC "8MUREPLY"
+#define REPLAY_MAGIC_SIZE 8
+#define REPLAY_VERSION 1
+#define REPLAY_HEADER_SIZE (REPLAY_MAGIC_SIZE + 4 + 8 + 4 + 8 + 4 + 4)
+
+#define REPLAY_RECORD_END 0
+#define REPLAY_RECORD_KEYS 1
+#define REPLAY_RECORD_HASH 2
+
+#define DEFAULT_REPLAY_HASH_INTERVAL 60
+
+typedef struct {
+	FILE *file_ptr;
+	uint32_t hash_interval;
+	uint32_t frames;
+	// Current run of frames with the same keys
+	uint16_t run_keys;
+	uint32_t run_frames;
+	bool ok;
+} ReplayRecorder;
+
+typedef struct {
+	uint64_t rom_hash;
+	uint32_t quirks;
+	uint64_t seed;
+	uint32_t instructions_per_frame;
+	uint32_t hash_interval;
+
+	// Records, after the header
+	uint8_t *records;
+	size_t size;
+} Replay;
+
+typedef struct {
+	uint32_t frames;
+	uint64_t executed;
+	uint32_t hashes_checked;
+	bool diverged;
+	// First frame whose state hash didn't match
+	uint32_t diverged_frame;
+} ReplayResult;
+
+uint64_t hash_rom(const uint8_t *rom);
+
+uint64_t hash_state(const CpuState *cpu_state);
+
+bool start_replay_recording(
+	ReplayRecorder *recorder, const char *path, const uint8_t *rom, CpuState *cpu_state,
+	uint32_t instructions_per_frame, uint32_t hash_interval
+);
+
+void record_replay_frame(ReplayRecorder *recorder, uint16_t keys, const CpuState *cpu_state);
+
+bool finish_replay_recording(ReplayRecorder *recorder);
+
+bool load_replay(Replay *replay, const char *path);
+
+bool check_replay_rom(const Replay *replay, const uint8_t *rom, QuirkProfile profile);
+
+bool run_replay(const Replay *replay, CpuState *cpu_state, JitContext *jit, ReplayResult *result);
+
+void free_replay(Replay *replay);
+
+#endif //CHIP8_REPLAY_H
@@ -0,0 +1,75 @@
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "state.h"
+
+// Everything restored when rewinding, in the native layout of each field
+#define PACKED_STATE_SIZE ( \
+	MEMORY_SIZE + STACK_SIZE * 2 + 1 + 2 + 2 + REGISTERS + SCREEN_SIZE_BYTES + 1 + NUMBER_OF_KEYS + 1 + 2 \
+	+ 2 + 8 + 4 + 4 + 8 + 1 \
+)
+// Worst case of the run-length encoding of a packed state
+#define MAX_ENCODED_STATE_SIZE (2 * PACKED_STATE_SIZE + 8)
+
+#define REWIND_SECONDS 60
+#define REWIND_FRAMES (REWIND_SECONDS * 60)
+#define REWIND_BUFFER_SIZE (4 * 1024 * 1024)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+/*
+ * Rewind history: a fixed number of frames stored in a fixed-size arena, used first in first out.
+ * Every REWIND_KEYFRAME_INTERVAL frames a keyframe stores the whole packed state, and the frames in between store the
+ * XOR against the previous frame. Both are run-length encoded, and deltas are mostly zeros.
+ * When out of space, the oldest keyframe is evicted along with all the deltas that depend on it.
+ */
+
+typedef struct {
+	uint32_t offset;
+	uint32_t size;
+	bool keyframe;
+} RewindEntry;
+
+typedef struct {
+	uint8_t *arena;
+	size_t capacity;
+	size_t write_offset;
+
+	RewindEntry *entries;
+	uint32_t max_entries;
+	uint32_t oldest;
+	uint32_t count;
+	uint32_t keyframe_interval;
+	uint32_t frames_since_keyframe;
+
+	// Packed state of the newest frame
+	uint8_t newest[PACKED_STATE_SIZE];
+	uint8_t packed[PACKED_STATE_SIZE];
+	uint8_t scratch[MAX_ENCODED_STATE_SIZE];
+} RewindBuffer;
+
+void pack_state(CpuState *cpu_state, uint8_t *packed);
+
+void unpack_state(CpuState *cpu_state, const uint8_t *packed);
+
+size_t encode_state_delta(const uint8_t *state, const uint8_t *previous, uint8_t *encoded);
+
+void decode_state_delta(const uint8_t *encoded, size_t size, uint8_t *state);
+
+bool init_rewind_buffer(RewindBuffer *rewind, uint32_t frames, size_t capacity, uint32_t keyframe_interval);
+
+RewindEntry *get_rewind_entry(RewindBuffer *rewind, uint32_t age);
+
+bool push_rewind_frame(RewindBuffer *rewind, CpuState *cpu_state);
+
+bool pop_rewind_frame(RewindBuffer *rewind, CpuState *cpu_state);
+
+size_t rewind_buffer_usage(const RewindBuffer *rewind);
+
+void free_rewind_buffer(RewindBuffer *rewind);
+
+#endif //CHIP8_REWIND_H
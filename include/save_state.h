@@ -0,0 +1,66 @@
+#ifndef CHIP8_SAVE_STATE_H
+#define CHIP8_SAVE_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "state.h"
+
+/*
+ * Save state file format, version 3.
+ * A file holds one or more records of SAVE_STATE_SIZE bytes back to back, so a whole library of states can be kept in
+ * a single file and mapped at once. Every integer is stored little endian, whatever the host.
+ *
+ * Header:
+ *   magic "8MUSTATE", u32 version, u32 payload size
+ * Payload:
+ *   memory, stack (u16 each), stack size, program counter (u16), index register (u16), register bank, display,
+ *   sound playing, keyboard (one byte per key), waiting for key, keys pressed while waiting (u16),
+ *   delay timer and sound timer (i64 set_ts_millis, u8 set_value each),
+ *   cycles (u64), cycles per tick (u32), cycles until tick (u32), random generator state (u64),
+ *   quirk profile (u8)
+ *
+ * Timers are stored as TimerRegister, so a wall clock timer is only meaningful if loaded in the same clock epoch.
+ */
+
+#define SAVE_STATE_MAGIC "8MUSTATE"
+#define SAVE_STATE_MAGIC_SIZE 8
+#define SAVE_STATE_VERSION 3
+
+#define SAVE_STATE_HEADER_SIZE (SAVE_STATE_MAGIC_SIZE + 4 + 4)
+#define SAVE_STATE_TIMER_SIZE (8 + 1)
+#define SAVE_STATE_PAYLOAD_SIZE ( \
+	MEMORY_SIZE + STACK_SIZE * 2 + 1 + 2 + 2 + REGISTERS + SCREEN_SIZE_BYTES + 1 + NUMBER_OF_KEYS + 1 + 2 \
+	+ 2 * SAVE_STATE_TIMER_SIZE + 8 + 4 + 4 + 8 + 1 \
+)
+#define SAVE_STATE_SIZE (SAVE_STATE_HEADER_SIZE + SAVE_STATE_PAYLOAD_SIZE)
+
+// A save state file mapped into memory
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+} SaveStateLibrary;
+
+void encode_save_state(const CpuState *cpu_state, uint8_t *record);
+
+bool decode_save_state(CpuState *cpu_state, const uint8_t *record, size_t size);
+
+bool write_save_state(FILE *file_ptr, const CpuState *cpu_state);
+
+bool save_state_to_file(const char *path, const CpuState *cpu_state);
+
+bool open_save_state_library(SaveStateLibrary *library, const char *path);
+
+size_t count_save_states(const SaveStateLibrary *library);
+
+bool load_save_state(const SaveStateLibrary *library, size_t index, CpuState *cpu_state);
+
+void close_save_state_library(SaveStateLibrary *library);
+
+#endif //CHIP8_SAVE_STATE_H
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include "state.h"
 
@@ -11,8 +12,21 @@
 
 #endif //CHIP8_SCREEN_H
 
+void mark_screen_rows_dirty(CpuState *cpu_state, uint32_t rows);
+
+bool is_display_changed(CpuState *cpu_state);
+
+uint32_t consume_dirty_screen_rows(CpuState *cpu_state);
+
 void fill_screen(CpuState *cpu_state, bool color);
 
 uint8_t read_pixel_from_screen(CpuState *cpu_state, uint8_t x, uint8_t y);
 
-void write_pixel_to_screen(CpuState *cpu_state, uint8_t x, uint8_t y, uint8_t value);
\ No newline at end of file
+void write_pixel_to_screen(CpuState *cpu_state, uint8_t x, uint8_t y, uint8_t value);
+
+bool xor_sprite_row_to_screen(CpuState *cpu_state, uint8_t x, uint8_t y, uint8_t sprite_row);
+
+void expand_display_to_argb(
+	CpuState *cpu_state, uint32_t *pixels, size_t pitch, uint8_t first_row, uint8_t end_row,
+	uint32_t on_color, uint32_t off_color
+);
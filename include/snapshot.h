@@ -0,0 +1,52 @@
+#ifndef CHIP8_SNAPSHOT_H
+#define CHIP8_SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "state.h"
+
+/*
+ * A snapshot of a CpuState, storing only the memory pages written to since the previous snapshot of the same state.
+ * A full snapshot stores every page, and a state can be rebuilt from a full snapshot followed by the deltas after it.
+ * Everything else in the state is small, and is stored whole in every snapshot.
+ */
+typedef struct {
+	// Pages stored, in increasing order of page index
+	uint64_t pages;
+	uint8_t (*page_data)[MEMORY_PAGE_SIZE];
+
+	uint16_t stack[STACK_SIZE];
+	uint8_t stack_size;
+	uint16_t program_counter;
+	uint16_t index_register;
+	uint8_t register_bank[REGISTERS];
+	uint8_t display[SCREEN_SIZE_BYTES];
+	bool sound_playing;
+	bool keyboard[NUMBER_OF_KEYS];
+	bool waiting_for_key;
+	uint16_t key_wait_pressed;
+	TimerRegister delay_timer;
+	TimerRegister sound_timer;
+	uint64_t cycles;
+	uint32_t cycles_per_tick;
+	uint32_t cycles_until_tick;
+	uint64_t random_state;
+	uint8_t quirk_profile;
+} Snapshot;
+
+void init_snapshot(Snapshot *snapshot);
+
+bool take_snapshot(Snapshot *snapshot, CpuState *cpu_state, bool full);
+
+bool is_full_snapshot(const Snapshot *snapshot);
+
+size_t snapshot_size(const Snapshot *snapshot);
+
+void restore_snapshots(CpuState *cpu_state, const Snapshot *snapshots, size_t count);
+
+void free_snapshot(Snapshot *snapshot);
+
+#endif //CHIP8_SNAPSHOT_H
@@ -2,12 +2,16 @@
 #define CHIP8_STATE_H
 
 #define MEMORY_SIZE (4 * 1024)
+#define MEMORY_PAGE_SIZE 64
+#define MEMORY_PAGES (MEMORY_SIZE / MEMORY_PAGE_SIZE)
+#define ALL_MEMORY_PAGES_DIRTY UINT64_MAX
 #define STACK_SIZE 16
 #define REGISTERS 16
 
 #define SCREEN_WIDTH 64
 #define SCREEN_HEIGHT 32
 #define SCREEN_SIZE_BYTES ((SCREEN_WIDTH * SCREEN_HEIGHT) / 8)
+#define ALL_SCREEN_ROWS_DIRTY 0xFFFFFFFFu
 
 #define NUMBER_OF_KEYS 16
 
@@ -20,14 +24,37 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "quirks.h"
+
 typedef struct {
 	int64_t set_ts_millis;
 	uint8_t set_value;
 } TimerRegister;
 
+struct CpuState;
+
+typedef void Instruction(struct CpuState *, uint16_t);
+
 typedef struct {
+	Instruction *function;
+	uint16_t instruction;
+	uint8_t opcode;
+	// Pre-extracted operands, read by the threaded core, the superinstructions, the lockstep kernels and the JIT.
+	// The handlers take the raw instruction and extract their own, so the interpreter loop only saves the opcode decode
+	uint16_t nnn;
+	uint8_t x;
+	uint8_t y;
+	uint8_t n;
+	uint8_t nn;
+	// Sequence of instructions starting here that runs as a single fused handler, if any
+	uint8_t superinstruction;
+} DecodedInstruction;
+
+typedef struct CpuState {
 	// Memory
 	uint8_t memory[MEMORY_SIZE];
 	uint16_t stack[STACK_SIZE];
@@ -44,14 +71,47 @@ typedef struct {
 
 	// Keyboard
 	bool keyboard[NUMBER_OF_KEYS];
+	// Set while FX0A halts the CPU until a key event, along with the keys pressed since it started waiting
+	bool waiting_for_key;
+	uint16_t key_wait_pressed;
 
 	// Timers
 	TimerRegister delay_timer;
 	TimerRegister sound_timer;
+
+	// Instructions executed so far
+	uint64_t cycles;
+	// With virtual timers, they tick once every cycles_per_tick instructions instead of following the wall clock
+	uint32_t cycles_per_tick;
+	uint32_t cycles_until_tick;
+
+	// Random number generator, xorshift64*, never zero
+	uint64_t random_state;
+
+	// Memory pages written to since the last snapshot, not part of the architectural state
+	uint64_t dirty_pages;
+
+	// Display changes since the frontend last consumed them, not part of the architectural state
+	// Bit N is set if row N was written to
+	uint32_t dirty_rows;
+	bool display_changed;
+
+	// QuirkProfile the instructions run with, chosen when the state is created
+	uint8_t quirk_profile;
+
+	// Decode cache, not part of the architectural state
+	DecodedInstruction decoded_instructions[MEMORY_SIZE];
+	uint64_t decoded_valid[MEMORY_SIZE / 64];
+	// Incremented every time an already decoded instruction is invalidated, never reset
+	uint32_t code_generation;
 } CpuState;
 
+bool load_rom(const char *path, uint8_t *rom, size_t *bytes_read);
+
 void init_state(CpuState *cpu_state, const uint8_t *rom);
 
+void set_quirk_profile(CpuState *cpu_state, QuirkProfile profile);
+
 void copy_state(CpuState *dst, const CpuState *src);
 
 bool state_equals(const CpuState *left, const CpuState *right);
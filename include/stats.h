@@ -0,0 +1,63 @@
+#ifndef CHIP8_STATS_H
+#define CHIP8_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <signal.h>
+
+#include "state.h"
+#include "opcodes.h"
+
+/*
+ * If set, execute() counts the instructions run per handler and samples the time taken by each, and the display
+ * counts draws, flipped pixels and collisions. The totals are written out at exit, and whenever STATS_DUMP_SIGNAL is
+ * received where signals are available.
+ * Every instruction then goes through execute(), so the threaded core, the recompiler and the lockstep vector kernels
+ * are turned off. Without it, none of this is compiled in.
+ */
+#ifndef CHIP8_STATS
+#define CHIP8_STATS 0
+#endif
+
+// One in this many instructions is timed
+#define STATS_TIME_SAMPLE_INTERVAL 64
+// Stats are appended to this file if set, instead of written to the standard error
+#define ENV_STATS_FILE "CHIP8_STATS_FILE"
+
+extern const char *const OPCODE_HANDLER_NAMES[NUMBER_OF_OPCODES];
+
+#if CHIP8_STATS
+
+#ifdef SIGUSR1
+#define STATS_DUMP_SIGNAL SIGUSR1
+#endif
+
+typedef struct {
+	uint64_t instructions;
+	uint64_t executions[NUMBER_OF_OPCODES];
+	uint64_t sampled_nanoseconds[NUMBER_OF_OPCODES];
+	uint64_t samples[NUMBER_OF_OPCODES];
+
+	uint64_t draws;
+	uint64_t pixels_flipped;
+	uint64_t collisions;
+} ExecutionStats;
+
+extern ExecutionStats execution_stats;
+
+void execute_with_stats(CpuState *cpu_state, uint16_t instruction, Instruction function, Opcode opcode);
+
+void write_execution_stats(FILE *file_ptr);
+
+void dump_execution_stats();
+
+#define STATS_ADD(counter, value) __atomic_fetch_add(&execution_stats.counter, (value), __ATOMIC_RELAXED)
+
+#else
+
+#define STATS_ADD(counter, value) ((void) 0)
+
+#endif
+
+#endif //CHIP8_STATS_H
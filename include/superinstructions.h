@@ -0,0 +1,52 @@
+#ifndef CHIP8_SUPERINSTRUCTIONS_H
+#define CHIP8_SUPERINSTRUCTIONS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "state.h"
+
+/*
+ * If set, the decode cache recognizes common sequences of instructions, and the interpreter loop and the threaded core
+ * run each of them with a single fused handler, with the same results as running them one by one.
+ * Sequences ending in a jump back to their own start that leave the state unchanged are idle loops, since only the
+ * timers or the keys can get them out. They are fast-forwarded through as many whole iterations as the caller allows.
+ * The stats and the profiler account for every instruction on its own, so their builds never fuse.
+ */
+#ifndef CHIP8_SUPERINSTRUCTIONS
+#define CHIP8_SUPERINSTRUCTIONS 1
+#endif
+
+/*
+ * Fused sequences, picked from the hottest addresses reported by the profiler on a set of ROMs.
+ */
+typedef enum {
+	SUPERINSTRUCTION_NONE = 0,
+
+	SUPERINSTRUCTION_SET_REGISTER_PAIR, // 6XNN 6YNN, usually the coordinates of a draw
+	SUPERINSTRUCTION_SET_INDEX_AND_DRAW, // ANNN DXYN
+	SUPERINSTRUCTION_SKIP_EQUAL_OR_JUMP, // 3XNN 1NNN
+	SUPERINSTRUCTION_SKIP_DIFFERENT_OR_JUMP, // 4XNN 1NNN
+	SUPERINSTRUCTION_WAIT_FOR_DELAY, // FX07 3XNN 1NNN, polling the delay timer
+	SUPERINSTRUCTION_SKIP_PRESSED_OR_JUMP, // EX9E 1NNN
+	SUPERINSTRUCTION_SKIP_NOT_PRESSED_OR_JUMP, // EXA1 1NNN
+	SUPERINSTRUCTION_JUMP_TO_SELF, // 1NNN to its own address, how many ROMs end
+	SUPERINSTRUCTION_WAIT_FOR_KEY, // FX0A, halted until a key event
+
+	NUMBER_OF_SUPERINSTRUCTIONS
+} Superinstruction;
+
+// Instructions in the longest sequence, a write to memory invalidates every sequence it could be part of
+#define SUPERINSTRUCTION_MAX_LENGTH 3
+
+extern const uint8_t SUPERINSTRUCTION_LENGTHS[NUMBER_OF_SUPERINSTRUCTIONS];
+
+Superinstruction recognize_superinstruction(CpuState *cpu_state, uint16_t address);
+
+Superinstruction match_superinstruction(CpuState *cpu_state, uint16_t address);
+
+uint32_t execute_superinstruction(CpuState *cpu_state, DecodedInstruction *decoded, uint32_t available);
+
+bool is_idle_loop(CpuState *cpu_state);
+
+#endif //CHIP8_SUPERINSTRUCTIONS_H
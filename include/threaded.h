@@ -0,0 +1,22 @@
+#ifndef CHIP8_THREADED_H
+#define CHIP8_THREADED_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "state.h"
+
+/*
+ * If the compiler supports labels as values, dispatch with computed gotos.
+ * Otherwise, fall back to a switch inside a loop.
+ */
+#if defined(__GNUC__) && !defined(CHIP8_NO_COMPUTED_GOTO)
+#define THREADED_COMPUTED_GOTO 1
+#else
+#define THREADED_COMPUTED_GOTO 0
+#endif
+
+uint32_t run_threaded(CpuState *cpu_state, uint32_t count);
+
+#endif //CHIP8_THREADED_H
@@ -1,16 +1,33 @@
 #ifndef CHIP8_TIMERS_H
 #define CHIP8_TIMERS_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #include "state.h"
 #include "beeper.h"
 #include "time_millis.h"
 
+#define TIMER_FREQUENCY 60
+
 uint8_t read_delay_timer(CpuState *cpu_state);
 
 void write_delay_timer(CpuState *cpu_state, uint8_t delay);
 
+uint8_t read_sound_timer(CpuState *cpu_state);
+
 void write_sound_timer(CpuState *cpu_state, uint8_t delay);
 
 void update_beeper_status(CpuState *cpu_state);
 
+bool has_virtual_timers(CpuState *cpu_state);
+
+void use_virtual_timers(CpuState *cpu_state, uint32_t cycles_per_tick);
+
+void use_wall_clock_timers(CpuState *cpu_state);
+
+uint32_t cycles_until_timer_tick(CpuState *cpu_state, uint32_t count);
+
+void advance_cycles(CpuState *cpu_state, uint32_t cycles);
+
 #endif //CHIP8_TIMERS_H
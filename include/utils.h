@@ -33,13 +33,23 @@
 #define INSTRUCTION_FIELD_REGISTER_X_BITMASK ((uint16_t) 0x0F00)
 #define INSTRUCTION_FIELD_REGISTER_X_OFFSET 8
 
+#define FNV1A_OFFSET_BASIS 0xCBF29CE484222325ull
+#define FNV1A_PRIME 0x100000001B3ull
+
 
 #include <stdint.h>
+#include <stddef.h>
 
 uint16_t read_word_from_array(uint8_t *ptr, intptr_t offset_in_bytes);
 
 void write_word_to_array(uint8_t *ptr, intptr_t offset_in_bytes, uint16_t value);
 
+uint64_t read_little_endian(const uint8_t *ptr, uint8_t bytes);
+
+void write_little_endian(uint8_t *ptr, uint8_t bytes, uint64_t value);
+
+uint64_t fnv1a_hash(const uint8_t *data, size_t size);
+
 uint8_t extract_register_from_xnn(uint16_t instruction);
 
 uint8_t extract_immediate_from_xnn(uint16_t instruction);
@@ -8,6 +8,9 @@
 #include "cpu.h"
 #include "debug.h"
 #include "emulator.h"
+#include "jit.h"
+#include "rewind.h"
+#include "replay.h"
 
 #include "SDL.h"
 #include "SDL_mixer.h"
@@ -15,15 +18,25 @@
 #define MIXER_CHUNK_SIZE 1024
 #define MIXER_CHANNELS_REQUESTED 1
 #define ENV_VOLUME "CHIP8_VOLUME"
+#define ENV_INSTRUCTIONS_PER_FRAME "CHIP8_IPF"
+#define ENV_RECORD "CHIP8_RECORD"
+#define ENV_QUIRKS "CHIP8_QUIRKS"
 
 
 uint8_t rom[ROM_SIZE];
 CpuState cpu_state;
+JitContext jit;
+RewindBuffer rewind_buffer;
+ReplayRecorder recorder;
 
 void quit_on_sdl_error(bool error, const char *error_msg);
 
 void set_volume();
 
+uint32_t read_instructions_per_frame();
+
+QuirkProfile read_quirk_profile();
+
 int main(int argc, const char *argv[]) {
 	if (argc != 2) {
 		fprintf(stderr, "Invalid number of arguments\n");
@@ -63,50 +76,117 @@ int main(int argc, const char *argv[]) {
 	SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 	quit_on_sdl_error(renderer == NULL, "Failed to create renderer");
 
-	memset(rom, 0, ROM_SIZE);
-	FILE *file_ptr = fopen(rom_path, "rb");
-	if (file_ptr == NULL) {
-		fprintf(stderr, "Failed to open file %s", rom_path);
+	SDL_Texture *texture = SDL_CreateTexture(
+		renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT
+	);
+	quit_on_sdl_error(texture == NULL, "Failed to create texture");
+
+	size_t bytes_read;
+	if (!load_rom(rom_path, rom, &bytes_read)) {
 		return EXIT_FAILURE;
 	}
-	size_t bytes_read = fread(rom, 1, ROM_SIZE, file_ptr);
 	printf("Read %zu byte(s)\n", bytes_read);
-	fclose(file_ptr);
 
 	init_state(&cpu_state, rom);
+	set_quirk_profile(&cpu_state, read_quirk_profile());
 	bool current_sound_state = false;
+	bool use_jit = CHIP8_JIT && jit_init(&jit);
+	uint32_t instructions_per_frame = read_instructions_per_frame();
+
+	// Going back in time can't be replayed, so rewinding is only available when not recording
+	const char *record_path = getenv(ENV_RECORD);
+	bool use_recorder = record_path != NULL && *record_path != '\0';
+	if (use_recorder && !start_replay_recording(
+		&recorder, record_path, rom, &cpu_state, instructions_per_frame, DEFAULT_REPLAY_HASH_INTERVAL
+	)) {
+		return EXIT_FAILURE;
+	}
+
+	bool use_rewind = !use_recorder && init_rewind_buffer(
+		&rewind_buffer, REWIND_FRAMES, REWIND_BUFFER_SIZE, REWIND_KEYFRAME_INTERVAL
+	);
+	if (use_rewind) {
+		push_rewind_frame(&rewind_buffer, &cpu_state);
+	} else if (!use_recorder) {
+		fprintf(stderr, "Failed to allocate the rewind buffer\n");
+	}
+
+	// Unchanged frames aren't rendered again, unless the window needs a redraw
+	bool force_present = true;
+
+	FramePacer pacer;
+	init_frame_pacer(&pacer);
 
 	bool running = true;
 	SDL_Event e;
 
 	while (running) {
-		uint16_t instruction = fetch(&cpu_state);
-		Instruction *function = decode(instruction);
-		execute(&cpu_state, instruction, function);
-
-		// print_display();
-		render_display(&cpu_state, renderer);
-		SDL_UpdateWindowSurface(window);
-
 		while (SDL_PollEvent(&e)) {
 			switch (e.type) {
 				case SDL_QUIT: {
 					running = false;
 					break;
 				}
+				case SDL_WINDOWEVENT: {
+					// The window may have been exposed or resized, so its contents need to be redrawn
+					force_present = true;
+					break;
+				}
+			}
+		}
+
+		if (use_rewind && is_rewind_key_pressed()) {
+			// Stops at the oldest frame still in the history
+			pop_rewind_frame(&rewind_buffer, &cpu_state);
+		} else {
+			update_keyboard_state(&cpu_state);
+
+			if (use_jit) {
+				jit_run(&jit, &cpu_state, instructions_per_frame);
+			} else {
+				run_instructions(&cpu_state, instructions_per_frame);
+			}
+
+			if (use_rewind) {
+				push_rewind_frame(&rewind_buffer, &cpu_state);
 			}
 		}
 
 		update_beeper_status(&cpu_state);
-		update_keyboard_state(&cpu_state);
+		if (use_recorder) {
+			record_replay_frame(&recorder, read_keyboard_mask(&cpu_state), &cpu_state);
+		}
+
 		play_beeper(&cpu_state, &current_sound_state, mix_chunk);
 
-		SDL_Delay(2);
+		if (force_present || is_display_changed(&cpu_state)) {
+			// print_display();
+			render_display(&cpu_state, renderer, texture, consume_dirty_screen_rows(&cpu_state));
+			force_present = false;
+		}
+
+		// Halted on FX0A, there's nothing to run until a key arrives, so sleep on the event queue for it
+		if (is_waiting_for_key(&cpu_state)) {
+			wait_for_next_frame_or_input(&pacer);
+		} else {
+			wait_for_next_frame(&pacer, is_idle_loop(&cpu_state));
+		}
+	}
+
+	if (use_jit) {
+		jit_destroy(&jit);
+	}
+	if (use_rewind) {
+		free_rewind_buffer(&rewind_buffer);
+	}
+	if (use_recorder) {
+		finish_replay_recording(&recorder);
 	}
 
 	Mix_FreeChunk(mix_chunk);
 	Mix_CloseAudio();
 
+	SDL_DestroyTexture(texture);
 	SDL_DestroyRenderer(renderer);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
@@ -132,4 +212,27 @@ void set_volume() {
 		}
 
 	}
-}
\ No newline at end of file
+}
+
+uint32_t read_instructions_per_frame() {
+	char const *env = getenv(ENV_INSTRUCTIONS_PER_FRAME);
+
+	if (env != NULL) {
+		char *end_ptr = NULL;
+		long instructions = strtol(env, &end_ptr, 10);
+		if (end_ptr != env && instructions > 0) {
+			return instructions;
+		}
+	}
+	return DEFAULT_INSTRUCTIONS_PER_FRAME;
+}
+
+QuirkProfile read_quirk_profile() {
+	char const *env = getenv(ENV_QUIRKS);
+
+	QuirkProfile profile;
+	if (env != NULL && parse_quirk_profile(env, &profile)) {
+		return profile;
+	}
+	return QUIRKS_DEFAULT;
+}
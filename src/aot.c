@@ -0,0 +1,386 @@
+#include "aot.h"
+#include "debug.h"
+
+// Bytes of the ROM per line of the emitted array
+#define AOT_ROM_BYTES_PER_LINE 12
+
+/*
+ * Whether the instruction ends a basic block: either the next instruction to run is only known at runtime, or it may
+ * rewrite code, which has to be checked again before running any more of it.
+ */
+bool ends_aot_block(Opcode opcode) {
+	switch (opcode) {
+		case OPCODE_JUMP:
+		case OPCODE_JUMP_SUBROUTINE:
+		case OPCODE_RETURN_SUBROUTINE:
+		case OPCODE_JUMP_WITH_OFFSET:
+		case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+		case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+		case OPCODE_SKIP_IF_REGISTERS_EQUAL:
+		case OPCODE_SKIP_IF_REGISTERS_DIFFERENT:
+		case OPCODE_SKIP_PRESSED:
+		case OPCODE_SKIP_NOT_PRESSED:
+		case OPCODE_WAIT_FOR_KEY:
+		case OPCODE_DECIMAL_DECODE:
+		case OPCODE_SAVE_REGISTERS:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void push_aot_leader(uint32_t address, uint16_t end, bool *leaders, uint16_t *worklist, size_t *pending) {
+	if (address < ROM_ADDRESS_START || address + INSTRUCTION_SIZE > end || leaders[address]) {
+		return;
+	}
+	leaders[address] = true;
+	worklist[(*pending)++] = address;
+}
+
+/*
+ * Finds the basic blocks reachable from the entry point through jumps, calls, returns from calls and skips, within
+ * the first rom_size bytes of the ROM loaded in cpu_state.
+ * Stores the address and length of each block in ascending order of address, and returns how many there are.
+ * Both arrays must have room for MEMORY_SIZE blocks.
+ */
+size_t find_aot_blocks(CpuState *cpu_state, uint16_t rom_size, uint16_t *addresses, uint8_t *lengths) {
+	uint16_t end = ROM_ADDRESS_START + (rom_size < ROM_SIZE ? rom_size : ROM_SIZE);
+	bool leaders[MEMORY_SIZE] = {false};
+	bool reachable[MEMORY_SIZE] = {false};
+	uint16_t worklist[MEMORY_SIZE];
+	size_t pending = 0;
+
+	push_aot_leader(ROM_ADDRESS_START, end, leaders, worklist, &pending);
+	while (pending > 0) {
+		// Straight-line code until the first instruction that ends a block, or code that has already been seen
+		uint16_t address = worklist[--pending];
+		while (address + INSTRUCTION_SIZE <= end && !reachable[address]) {
+			uint16_t instruction = read_word_memory(cpu_state, address);
+			Opcode opcode = decode_opcode(instruction);
+			if (opcode == OPCODE_INVALID) {
+				break;
+			}
+			reachable[address] = true;
+
+			uint16_t next = address + INSTRUCTION_SIZE;
+			switch (opcode) {
+				case OPCODE_JUMP:
+					push_aot_leader(extract_immediate_from_nnn(instruction), end, leaders, worklist, &pending);
+					break;
+				case OPCODE_JUMP_SUBROUTINE:
+					push_aot_leader(extract_immediate_from_nnn(instruction), end, leaders, worklist, &pending);
+					push_aot_leader(next, end, leaders, worklist, &pending);
+					break;
+				case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+				case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+				case OPCODE_SKIP_IF_REGISTERS_EQUAL:
+				case OPCODE_SKIP_IF_REGISTERS_DIFFERENT:
+				case OPCODE_SKIP_PRESSED:
+				case OPCODE_SKIP_NOT_PRESSED:
+					push_aot_leader(next, end, leaders, worklist, &pending);
+					push_aot_leader(next + INSTRUCTION_SIZE, end, leaders, worklist, &pending);
+					break;
+				case OPCODE_WAIT_FOR_KEY:
+					// While halted, the CPU keeps coming back to it
+					leaders[address] = true;
+					push_aot_leader(next, end, leaders, worklist, &pending);
+					break;
+				case OPCODE_DECIMAL_DECODE:
+				case OPCODE_SAVE_REGISTERS:
+					push_aot_leader(next, end, leaders, worklist, &pending);
+					break;
+				default:
+					break;
+			}
+			if (ends_aot_block(opcode)) {
+				break;
+			}
+			address = next;
+		}
+	}
+
+	size_t count = 0;
+	for (uint32_t address = ROM_ADDRESS_START; address + INSTRUCTION_SIZE <= end; ++address) {
+		if (!leaders[address] || !reachable[address]) {
+			continue;
+		}
+
+		uint8_t length = 0;
+		for (uint32_t current = address;; current += INSTRUCTION_SIZE) {
+			++length;
+			uint32_t next = current + INSTRUCTION_SIZE;
+			if (
+				ends_aot_block(decode_opcode(read_word_memory(cpu_state, current))) ||
+				next + INSTRUCTION_SIZE > end || !reachable[next] || leaders[next]
+			) {
+				break;
+			}
+			if (length == AOT_MAX_BLOCK_INSTRUCTIONS) {
+				leaders[next] = true;
+				break;
+			}
+		}
+
+		addresses[count] = address;
+		lengths[count] = length;
+		++count;
+	}
+	return count;
+}
+
+/*
+ * Writes the C code of an instruction, which sets the PC itself if it ends its block.
+ * Instructions that depend on the quirks or need more than a line go through their handlers, the ones of the given
+ * profile.
+ */
+void write_aot_instruction(FILE *file_ptr, uint16_t address, uint16_t instruction, QuirkProfile profile) {
+	Opcode opcode = decode_opcode(instruction);
+	uint8_t x = extract_register_from_x(instruction);
+	uint8_t y = extract_second_register_from_xy(instruction);
+	uint8_t nn = extract_immediate_from_xnn(instruction);
+	uint16_t nnn = extract_immediate_from_nnn(instruction);
+	uint16_t next = address + INSTRUCTION_SIZE;
+	uint16_t skipped = next + INSTRUCTION_SIZE;
+
+	char disassembly[DISASSEMBLY_SIZE];
+	disassemble_instruction(opcode, instruction, disassembly, sizeof(disassembly));
+	fprintf(file_ptr, "\t// %03X: %s\n", address, disassembly);
+
+	switch (opcode) {
+		case OPCODE_JUMP:
+			fprintf(file_ptr, "\tcpu_state->program_counter = 0x%03X;\n", nnn);
+			break;
+
+		case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+		case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+			fprintf(
+				file_ptr, "\tcpu_state->program_counter = V[0x%X] %s 0x%02X ? 0x%03X : 0x%03X;\n",
+				x, opcode == OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE ? "==" : "!=", nn, skipped, next
+			);
+			break;
+
+		case OPCODE_SKIP_IF_REGISTERS_EQUAL:
+		case OPCODE_SKIP_IF_REGISTERS_DIFFERENT:
+			fprintf(
+				file_ptr, "\tcpu_state->program_counter = V[0x%X] %s V[0x%X] ? 0x%03X : 0x%03X;\n",
+				x, opcode == OPCODE_SKIP_IF_REGISTERS_EQUAL ? "==" : "!=", y, skipped, next
+			);
+			break;
+
+		case OPCODE_SKIP_PRESSED:
+		case OPCODE_SKIP_NOT_PRESSED:
+			fprintf(
+				file_ptr, "\tcpu_state->program_counter = %scpu_state->keyboard[V[0x%X] & 0x0F] ? 0x%03X : 0x%03X;\n",
+				opcode == OPCODE_SKIP_PRESSED ? "" : "!", x, skipped, next
+			);
+			break;
+
+		case OPCODE_SET_REGISTER_TO_IMMEDIATE:
+			fprintf(file_ptr, "\tV[0x%X] = 0x%02X;\n", x, nn);
+			break;
+
+		case OPCODE_ADD_IMMEDIATE_TO_REGISTER:
+			fprintf(file_ptr, "\tV[0x%X] += 0x%02X;\n", x, nn);
+			break;
+
+		case OPCODE_COPY_REGISTER:
+			fprintf(file_ptr, "\tV[0x%X] = V[0x%X];\n", x, y);
+			break;
+
+		case OPCODE_BITWISE_OR:
+			fprintf(file_ptr, "\tV[0x%X] |= V[0x%X];\n", x, y);
+			break;
+
+		case OPCODE_BITWISE_AND:
+			fprintf(file_ptr, "\tV[0x%X] &= V[0x%X];\n", x, y);
+			break;
+
+		case OPCODE_BITWISE_XOR:
+			fprintf(file_ptr, "\tV[0x%X] ^= V[0x%X];\n", x, y);
+			break;
+
+		// The flag is written before the result, so the result wins when VX is VF, as in the handlers
+		case OPCODE_ADD_REGISTER_TO_REGISTER:
+			fprintf(
+				file_ptr,
+				"\t{\n"
+				"\t\tuint16_t result = V[0x%X] + V[0x%X];\n"
+				"\t\tV[0xF] = result > 255;\n"
+				"\t\tV[0x%X] = result;\n"
+				"\t}\n",
+				x, y, x
+			);
+			break;
+
+		case OPCODE_SUB_REGISTER_FROM_REGISTER:
+		case OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER: {
+			uint8_t minuend = opcode == OPCODE_SUB_REGISTER_FROM_REGISTER ? x : y;
+			uint8_t subtrahend = opcode == OPCODE_SUB_REGISTER_FROM_REGISTER ? y : x;
+			fprintf(
+				file_ptr,
+				"\t{\n"
+				"\t\tuint8_t result = V[0x%X] - V[0x%X];\n"
+				"\t\tV[0xF] = V[0x%X] > V[0x%X];\n"
+				"\t\tV[0x%X] = result;\n"
+				"\t}\n",
+				minuend, subtrahend, minuend, subtrahend, x
+			);
+			break;
+		}
+
+		case OPCODE_SET_INDEX_REGISTER:
+			fprintf(file_ptr, "\tcpu_state->index_register = 0x%03X;\n", nnn);
+			break;
+
+		case OPCODE_READ_DELAY:
+			fprintf(file_ptr, "\tV[0x%X] = read_delay_timer(cpu_state);\n", x);
+			break;
+
+		default:
+			// Calls, returns and the other instructions that end a block find the PC where the interpreter leaves it
+			if (ends_aot_block(opcode)) {
+				fprintf(file_ptr, "\tcpu_state->program_counter = 0x%03X;\n", next);
+			}
+			fprintf(
+				file_ptr, "\t%s%s(cpu_state, 0x%04X);\n", OPCODE_HANDLER_NAMES[opcode],
+				depends_on_quirks(opcode) ? QUIRK_PROFILE_SETTINGS[profile].handler_suffix : "", instruction
+			);
+			break;
+	}
+}
+
+/*
+ * Translates the first rom_size bytes of the ROM loaded in cpu_state to a C translation unit defining an AotProgram
+ * named symbol, for the quirk profile of cpu_state, and returns the number of blocks.
+ */
+size_t write_aot_program(FILE *file_ptr, CpuState *cpu_state, uint16_t rom_size, const char *symbol) {
+	uint16_t addresses[MEMORY_SIZE];
+	uint8_t lengths[MEMORY_SIZE];
+	size_t count = find_aot_blocks(cpu_state, rom_size, addresses, lengths);
+	QuirkProfile profile = cpu_state->quirk_profile;
+
+	fprintf(file_ptr, "// Translated ahead of time by chip8_aot, %zu block(s)\n\n#include \"aot.h\"\n\n", count);
+	fprintf(file_ptr, "#define V (cpu_state->register_bank)\n");
+
+	for (size_t i = 0; i < count; ++i) {
+		fprintf(file_ptr, "\nvoid %s_block_%03X(CpuState *cpu_state) {\n", symbol, addresses[i]);
+
+		uint16_t address = addresses[i];
+		for (uint8_t j = 0; j < lengths[i]; ++j, address += INSTRUCTION_SIZE) {
+			write_aot_instruction(file_ptr, address, read_word_memory(cpu_state, address), profile);
+		}
+
+		uint16_t last = address - INSTRUCTION_SIZE;
+		if (!ends_aot_block(decode_opcode(read_word_memory(cpu_state, last)))) {
+			fprintf(file_ptr, "\tcpu_state->program_counter = 0x%03X;\n", address);
+		}
+		fprintf(file_ptr, "}\n");
+	}
+
+	fprintf(file_ptr, "\nconst uint8_t %s_rom[] = {", symbol);
+	for (uint16_t i = 0; i < rom_size; ++i) {
+		uint8_t byte = cpu_state->memory[ROM_ADDRESS_START + i];
+		fprintf(file_ptr, i % AOT_ROM_BYTES_PER_LINE == 0 ? "\n\t0x%02X," : " 0x%02X,", byte);
+	}
+	fprintf(file_ptr, "\n};\n");
+
+	fprintf(file_ptr, "\nconst AotBlock %s_blocks[] = {\n", symbol);
+	for (size_t i = 0; i < count; ++i) {
+		fprintf(file_ptr, "\t{0x%03X, %u, %s_block_%03X},\n", addresses[i], lengths[i], symbol, addresses[i]);
+	}
+	fprintf(file_ptr, "};\n");
+
+	fprintf(
+		file_ptr, "\nconst AotProgram %s = {%s_rom, sizeof(%s_rom), %s_blocks, %zu, %d /* %s */};\n",
+		symbol, symbol, symbol, symbol, count, profile, QUIRK_PROFILE_SETTINGS[profile].name
+	);
+	return count;
+}
+
+bool matches_aot_rom(const AotProgram *program, const uint8_t *rom, size_t rom_size) {
+	return rom_size == program->rom_size && memcmp(rom, program->rom, rom_size) == 0;
+}
+
+void aot_init(AotContext *aot, const AotProgram *program) {
+	aot->program = program;
+	memset(aot->blocks, 0, sizeof(aot->blocks));
+	memset(aot->block_lengths, 0, sizeof(aot->block_lengths));
+	aot->cpu_state = NULL;
+	aot->code_generation = 0;
+}
+
+#if AOT_SUPPORTED
+
+/*
+ * Enables the blocks whose code in memory is still the same as in the ROM.
+ * Their instructions are decoded, so any later write to them bumps the code generation and they get checked again.
+ * None are enabled for a state with other quirks than the ones the program was translated with.
+ */
+void load_aot_blocks(AotContext *aot, CpuState *cpu_state) {
+	const AotProgram *program = aot->program;
+	memset(aot->blocks, 0, sizeof(aot->blocks));
+	memset(aot->block_lengths, 0, sizeof(aot->block_lengths));
+
+	size_t block_count = cpu_state->quirk_profile == program->quirk_profile ? program->block_count : 0;
+	for (size_t i = 0; i < block_count; ++i) {
+		const AotBlock *block = &program->blocks[i];
+		if (memcmp(
+			&cpu_state->memory[block->address], &program->rom[block->address - ROM_ADDRESS_START],
+			block->length * INSTRUCTION_SIZE
+		) != 0) {
+			continue;
+		}
+
+		for (uint8_t j = 0; j < block->length; ++j) {
+			decode_cached(cpu_state, block->address + j * INSTRUCTION_SIZE);
+		}
+		aot->blocks[block->address] = block->function;
+		aot->block_lengths[block->address] = block->length;
+	}
+
+	aot->cpu_state = cpu_state;
+	aot->code_generation = cpu_state->code_generation;
+}
+
+void aot_run_batch(AotContext *aot, CpuState *cpu_state, uint32_t count) {
+	uint32_t remaining = count;
+
+	while (remaining > 0) {
+		if (aot->cpu_state != cpu_state || aot->code_generation != cpu_state->code_generation) {
+			load_aot_blocks(aot, cpu_state);
+		}
+
+		uint16_t pc = read_register_pc(cpu_state);
+		AotBlockFunction *block = pc < MEMORY_SIZE ? aot->blocks[pc] : NULL;
+		if (block == NULL || aot->block_lengths[pc] > remaining) {
+			// Not translated, rewritten, or too long for what's left, step with the interpreter
+			DecodedInstruction *decoded = fetch_decoded(cpu_state);
+			execute(cpu_state, decoded->instruction, decoded->function);
+			--remaining;
+			continue;
+		}
+
+		block(cpu_state);
+		remaining -= aot->block_lengths[pc];
+	}
+}
+
+uint32_t aot_run(AotContext *aot, CpuState *cpu_state, uint32_t count) {
+	uint32_t executed = 0;
+	while (executed < count) {
+		// Stop at every virtual timer tick
+		uint32_t batch = cycles_until_timer_tick(cpu_state, count - executed);
+		aot_run_batch(aot, cpu_state, batch);
+		advance_cycles(cpu_state, batch);
+		executed += batch;
+	}
+	return count;
+}
+
+#else
+
+uint32_t aot_run(__attribute__((unused)) AotContext *aot, CpuState *cpu_state, uint32_t count) {
+	return run_instructions(cpu_state, count);
+}
+
+#endif
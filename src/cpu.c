@@ -8,93 +8,165 @@ uint16_t fetch(CpuState *cpu_state) {
 	return read_word_memory(cpu_state, pc);
 }
 
-Instruction *decode(uint16_t instruction) {
+/*
+ * Same as fetch, but returns the decoded instruction, reusing the decode cache if the address has already been decoded.
+ */
+DecodedInstruction *fetch_decoded(CpuState *cpu_state) {
+	uint16_t pc = read_register_pc(cpu_state);
+	write_register_pc(cpu_state, pc + INSTRUCTION_SIZE);
+
+	return decode_cached(cpu_state, pc);
+}
+
+DecodedInstruction *decode_cached(CpuState *cpu_state, uint16_t address) {
+	DecodedInstruction *decoded = lookup_decoded_instruction(cpu_state, address);
+	if (decoded == NULL) {
+		uint16_t instruction = read_word_memory(cpu_state, address);
+		Opcode opcode = decode_opcode(instruction);
+		decoded = store_decoded_instruction(
+			cpu_state, address, instruction, opcode, QUIRK_INSTRUCTION_HANDLERS[cpu_state->quirk_profile][opcode]
+		);
+		decoded->superinstruction = match_superinstruction(cpu_state, address);
+	}
+	return decoded;
+}
+
+/*
+ * The handler table of every profile, only the instructions that depend on quirks differ between them.
+ */
+#define QUIRK_INSTRUCTION_HANDLER_TABLE(profile, name, suffix, ...) [profile] = { \
+	[OPCODE_INVALID] = NULL, \
+	[OPCODE_CLEAR_SCREEN] = clear_screen, \
+	[OPCODE_RETURN_SUBROUTINE] = return_subroutine, \
+	[OPCODE_JUMP] = jump, \
+	[OPCODE_JUMP_SUBROUTINE] = jump_subroutine, \
+	[OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE] = skip_if_equal_to_immediate, \
+	[OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE] = skip_if_different_from_immediate, \
+	[OPCODE_SKIP_IF_REGISTERS_EQUAL] = skip_if_registers_equal, \
+	[OPCODE_SET_REGISTER_TO_IMMEDIATE] = set_register_to_immediate, \
+	[OPCODE_ADD_IMMEDIATE_TO_REGISTER] = add_immediate_to_register, \
+	[OPCODE_COPY_REGISTER] = copy_register, \
+	[OPCODE_BITWISE_OR] = bitwise_or, \
+	[OPCODE_BITWISE_AND] = bitwise_and, \
+	[OPCODE_BITWISE_XOR] = bitwise_xor, \
+	[OPCODE_ADD_REGISTER_TO_REGISTER] = add_register_to_register, \
+	[OPCODE_SUB_REGISTER_FROM_REGISTER] = sub_register_from_register, \
+	[OPCODE_SHIFT_RIGHT] = shift_right##suffix, \
+	[OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER] = negative_sub_register_from_register, \
+	[OPCODE_SHIFT_LEFT] = shift_left##suffix, \
+	[OPCODE_SKIP_IF_REGISTERS_DIFFERENT] = skip_if_registers_different, \
+	[OPCODE_SET_INDEX_REGISTER] = set_index_register, \
+	[OPCODE_JUMP_WITH_OFFSET] = jump_with_offset##suffix, \
+	[OPCODE_SET_REGISTER_TO_BITMASKED_RAND] = set_register_to_bitmasked_rand, \
+	[OPCODE_DRAW] = draw, \
+	[OPCODE_SKIP_PRESSED] = skip_pressed, \
+	[OPCODE_SKIP_NOT_PRESSED] = skip_not_pressed, \
+	[OPCODE_READ_DELAY] = read_delay, \
+	[OPCODE_WAIT_FOR_KEY] = wait_for_key##suffix, \
+	[OPCODE_SET_DELAY] = set_delay, \
+	[OPCODE_SET_SOUND] = set_sound, \
+	[OPCODE_ADD_TO_INDEX] = add_to_index##suffix, \
+	[OPCODE_POINT_TO_CHAR] = point_to_char, \
+	[OPCODE_DECIMAL_DECODE] = decimal_decode, \
+	[OPCODE_SAVE_REGISTERS] = save_registers##suffix, \
+	[OPCODE_LOAD_REGISTERS] = load_registers##suffix, \
+},
+
+Instruction *const QUIRK_INSTRUCTION_HANDLERS[NUMBER_OF_QUIRK_PROFILES][NUMBER_OF_OPCODES] = {
+	FOR_EACH_QUIRK_PROFILE(QUIRK_INSTRUCTION_HANDLER_TABLE)
+};
+
+Opcode decode_opcode(uint16_t instruction) {
 	switch ((instruction & 0xF000) >> 12) {
 		case 0x0: {
 			switch (instruction & 0x0FFF) {
 				case 0xE0:
-					return clear_screen;
+					return OPCODE_CLEAR_SCREEN;
 				case 0xEE:
-					return return_subroutine;
+					return OPCODE_RETURN_SUBROUTINE;
 			}
 			break;
 		}
 
 		case 0x1:
-			return jump;
+			return OPCODE_JUMP;
 		case 0x2:
-			return jump_subroutine;
+			return OPCODE_JUMP_SUBROUTINE;
 		case 0x3:
-			return skip_if_equal_to_immediate;
+			return OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE;
 		case 0x4:
-			return skip_if_different_from_immediate;
+			return OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE;
 		case 0x5:
-			return skip_if_registers_equal;
+			return OPCODE_SKIP_IF_REGISTERS_EQUAL;
 		case 0x6:
-			return set_register_to_immediate;
+			return OPCODE_SET_REGISTER_TO_IMMEDIATE;
 		case 0x7:
-			return add_immediate_to_register;
+			return OPCODE_ADD_IMMEDIATE_TO_REGISTER;
 
 		case 0x8: {
 			switch (instruction & 0xF) {
 				case 0x0:
-					return copy_register;
+					return OPCODE_COPY_REGISTER;
 				case 0x1:
-					return bitwise_or;
+					return OPCODE_BITWISE_OR;
 				case 0x2:
-					return bitwise_and;
+					return OPCODE_BITWISE_AND;
 				case 0x3:
-					return bitwise_xor;
+					return OPCODE_BITWISE_XOR;
 				case 0x4:
-					return add_register_to_register;
+					return OPCODE_ADD_REGISTER_TO_REGISTER;
 				case 0x5:
-					return sub_register_from_register;
+					return OPCODE_SUB_REGISTER_FROM_REGISTER;
 				case 0x6:
-					return shift_right;
+					return OPCODE_SHIFT_RIGHT;
 				case 0x7:
-					return negative_sub_register_from_register;
+					return OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER;
 				case 0xE:
-					return shift_left;
+					return OPCODE_SHIFT_LEFT;
 			}
 			break;
 		}
 
 		case 0x9:
-			return skip_if_registers_different;
+			return OPCODE_SKIP_IF_REGISTERS_DIFFERENT;
 		case 0xA:
-			return set_index_register;
+			return OPCODE_SET_INDEX_REGISTER;
 		case 0xB:
-			return jump_with_offset;
+			return OPCODE_JUMP_WITH_OFFSET;
 		case 0xC:
-			return set_register_to_bitmasked_rand;
+			return OPCODE_SET_REGISTER_TO_BITMASKED_RAND;
 		case 0xD:
-			return draw;
+			return OPCODE_DRAW;
 
 		case 0xE: {
 			switch (instruction & 0xFF) {
-				case 0x9E: return skip_pressed;
-				case 0xA1: return skip_not_pressed;
+				case 0x9E: return OPCODE_SKIP_PRESSED;
+				case 0xA1: return OPCODE_SKIP_NOT_PRESSED;
 			}
 			break;
 		}
 
 		case 0xF: {
 			switch (instruction & 0xFF) {
-				case 0x07: return read_delay;
-				case 0x0A: return wait_for_key;
-				case 0x15: return set_delay;
-				case 0x18: return set_sound;
-				case 0x1E: return add_to_index;
-				case 0x29: return point_to_char;
-				case 0x33: return decimal_decode;
-				case 0x55: return save_registers;
-				case 0x65: return load_registers;
+				case 0x07: return OPCODE_READ_DELAY;
+				case 0x0A: return OPCODE_WAIT_FOR_KEY;
+				case 0x15: return OPCODE_SET_DELAY;
+				case 0x18: return OPCODE_SET_SOUND;
+				case 0x1E: return OPCODE_ADD_TO_INDEX;
+				case 0x29: return OPCODE_POINT_TO_CHAR;
+				case 0x33: return OPCODE_DECIMAL_DECODE;
+				case 0x55: return OPCODE_SAVE_REGISTERS;
+				case 0x65: return OPCODE_LOAD_REGISTERS;
 			}
 			break;
 		}
 	}
 
-	return NULL;
+	return OPCODE_INVALID;
+}
+
+Instruction *decode(uint16_t instruction) {
+	return INSTRUCTION_HANDLERS[decode_opcode(instruction)];
 }
 
 void execute(CpuState *cpu_state, uint16_t instruction, Instruction function) {
@@ -102,5 +174,51 @@ void execute(CpuState *cpu_state, uint16_t instruction, Instruction function) {
 		fprintf(stderr, "Could not decode instruction: %X", instruction);
 		exit(EXIT_FAILURE);
 	}
+#if CHIP8_STATS
+	execute_with_stats(cpu_state, instruction, function, decode_opcode(instruction));
+#else
 	function(cpu_state, instruction);
-}
\ No newline at end of file
+#endif
+}
+
+void run_instructions_batch(CpuState *cpu_state, uint32_t count) {
+#if CHIP8_THREADED_CORE && !CHIP8_STATS && !CHIP8_PROFILE
+	run_threaded(cpu_state, count);
+#elif CHIP8_PROFILE
+	for (uint32_t executed = 0; executed < count; ++executed) {
+		uint16_t address = read_register_pc(cpu_state);
+		// Before execution, calls and returns belong to the subroutine they leave
+		uint32_t call_node = find_call_node(cpu_state);
+		uint64_t start = read_profile_clock();
+		DecodedInstruction *decoded = fetch_decoded(cpu_state);
+		execute(cpu_state, decoded->instruction, decoded->function);
+		record_profile_sample(cpu_state, address, decoded, call_node, read_profile_clock() - start);
+	}
+#else
+	for (uint32_t executed = 0; executed < count;) {
+		DecodedInstruction *decoded = fetch_decoded(cpu_state);
+		if (
+			decoded->superinstruction != SUPERINSTRUCTION_NONE &&
+			count - executed >= SUPERINSTRUCTION_LENGTHS[decoded->superinstruction]
+		) {
+			executed += execute_superinstruction(cpu_state, decoded, count - executed);
+		} else {
+			// Deliberately the raw instruction, the Instruction signature is shared with the JIT, AOT output and tests
+			execute(cpu_state, decoded->instruction, decoded->function);
+			++executed;
+		}
+	}
+#endif
+}
+
+uint32_t run_instructions(CpuState *cpu_state, uint32_t count) {
+	uint32_t executed = 0;
+	while (executed < count) {
+		// Stop at every virtual timer tick
+		uint32_t batch = cycles_until_timer_tick(cpu_state, count - executed);
+		run_instructions_batch(cpu_state, batch);
+		advance_cycles(cpu_state, batch);
+		executed += batch;
+	}
+	return count;
+}
@@ -1,4 +1,63 @@
 #include "debug.h"
+#include "instructions.h"
+
+typedef enum {
+	OPERANDS_NONE,
+	OPERANDS_NNN,
+	OPERANDS_VX_NN,
+	OPERANDS_VX_VY,
+	OPERANDS_VX_VY_N,
+	OPERANDS_VX,
+	OPERANDS_X,
+} OperandFormat;
+
+typedef struct {
+	const char *mnemonic;
+	OperandFormat operands;
+} Mnemonic;
+
+// Same mnemonics as the documentation of the handlers in instructions.c
+const Mnemonic MNEMONICS[NUMBER_OF_OPCODES] = {
+	[OPCODE_INVALID] = {"DATA", OPERANDS_NONE},
+	[OPCODE_CLEAR_SCREEN] = {"CLEAR", OPERANDS_NONE},
+	[OPCODE_RETURN_SUBROUTINE] = {"RETURN", OPERANDS_NONE},
+	[OPCODE_JUMP] = {"GOTO", OPERANDS_NNN},
+	[OPCODE_JUMP_SUBROUTINE] = {"CALL", OPERANDS_NNN},
+	[OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE] = {"SIEQ", OPERANDS_VX_NN},
+	[OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE] = {"SINE", OPERANDS_VX_NN},
+	[OPCODE_SKIP_IF_REGISTERS_EQUAL] = {"SREQ", OPERANDS_VX_VY},
+	[OPCODE_SET_REGISTER_TO_IMMEDIATE] = {"SETR", OPERANDS_VX_NN},
+	[OPCODE_ADD_IMMEDIATE_TO_REGISTER] = {"ADDI", OPERANDS_VX_NN},
+	[OPCODE_COPY_REGISTER] = {"COPY", OPERANDS_VX_VY},
+	[OPCODE_BITWISE_OR] = {"OR", OPERANDS_VX_VY},
+	[OPCODE_BITWISE_AND] = {"AND", OPERANDS_VX_VY},
+	[OPCODE_BITWISE_XOR] = {"XOR", OPERANDS_VX_VY},
+	[OPCODE_ADD_REGISTER_TO_REGISTER] = {"ADD", OPERANDS_VX_VY},
+	[OPCODE_SUB_REGISTER_FROM_REGISTER] = {"SUB", OPERANDS_VX_VY},
+	[OPCODE_SHIFT_RIGHT] = {"SHIFTR", OPERANDS_VX_VY},
+	[OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER] = {"SUB-", OPERANDS_VX_VY},
+	[OPCODE_SHIFT_LEFT] = {"SHIFTL", OPERANDS_VX_VY},
+	[OPCODE_SKIP_IF_REGISTERS_DIFFERENT] = {"SRNE", OPERANDS_VX_VY},
+	[OPCODE_SET_INDEX_REGISTER] = {"SETI", OPERANDS_NNN},
+#if OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET
+	[OPCODE_JUMP_WITH_OFFSET] = {"JUMPR", OPERANDS_VX_NN},
+#else
+	[OPCODE_JUMP_WITH_OFFSET] = {"JUMPR", OPERANDS_NNN},
+#endif
+	[OPCODE_SET_REGISTER_TO_BITMASKED_RAND] = {"RAND", OPERANDS_VX_NN},
+	[OPCODE_DRAW] = {"DRAW", OPERANDS_VX_VY_N},
+	[OPCODE_SKIP_PRESSED] = {"SKPR", OPERANDS_VX},
+	[OPCODE_SKIP_NOT_PRESSED] = {"SKNP", OPERANDS_VX},
+	[OPCODE_READ_DELAY] = {"RDEL", OPERANDS_VX},
+	[OPCODE_WAIT_FOR_KEY] = {"KEY", OPERANDS_VX},
+	[OPCODE_SET_DELAY] = {"TDEL", OPERANDS_VX},
+	[OPCODE_SET_SOUND] = {"TSND", OPERANDS_VX},
+	[OPCODE_ADD_TO_INDEX] = {"IADD", OPERANDS_VX},
+	[OPCODE_POINT_TO_CHAR] = {"CHAR", OPERANDS_VX},
+	[OPCODE_DECIMAL_DECODE] = {"DEC", OPERANDS_VX},
+	[OPCODE_SAVE_REGISTERS] = {"DUMP", OPERANDS_X},
+	[OPCODE_LOAD_REGISTERS] = {"LOAD", OPERANDS_X},
+};
 
 void print_separator() {
 	for (int x = 0; x < SCREEN_WIDTH; ++x) {
@@ -9,16 +68,74 @@ void print_separator() {
 
 void print_display(CpuState *cpu_state) {
 	print_separator();
+	write_display(stdout, cpu_state);
+	print_separator();
+}
+
+void write_display(FILE *file, CpuState *cpu_state) {
 	for (int y = 0; y < SCREEN_HEIGHT; ++y) {
 		for (int x = 0; x < SCREEN_WIDTH; ++x) {
 			uint8_t pixel = read_pixel_from_screen(cpu_state, x, y);
 			if (pixel) {
-				printf("X");
+				fprintf(file, "X");
 			} else {
-				printf("_");
+				fprintf(file, "_");
 			}
 		}
-		printf("\n");
+		fprintf(file, "\n");
 	}
-	print_separator();
-}
\ No newline at end of file
+}
+
+void write_registers(FILE *file, CpuState *cpu_state) {
+	fprintf(file, "PC %03X\n", cpu_state->program_counter);
+	fprintf(file, "I %03X\n", cpu_state->index_register);
+	for (int r = 0; r < REGISTERS; ++r) {
+		fprintf(file, "V%X %02X\n", r, cpu_state->register_bank[r]);
+	}
+
+	fprintf(file, "STACK");
+	for (int i = 0; i < cpu_state->stack_size; ++i) {
+		fprintf(file, " %03X", cpu_state->stack[i]);
+	}
+	fprintf(file, "\n");
+
+	fprintf(file, "DELAY %02X\n", read_delay_timer(cpu_state));
+	fprintf(file, "SOUND %s\n", cpu_state->sound_playing ? "ON" : "OFF");
+	fprintf(file, "KEYS %04X\n", read_keyboard_mask(cpu_state));
+}
+/*
+ * Formats an instruction with the mnemonics used in instructions.c, e.g. "DRAW V1 V2 5".
+ */
+void disassemble_instruction(Opcode opcode, uint16_t instruction, char *buffer, size_t size) {
+	const Mnemonic *mnemonic = &MNEMONICS[opcode < NUMBER_OF_OPCODES ? opcode : OPCODE_INVALID];
+	unsigned x = (instruction >> 8) & 0xF;
+	unsigned y = (instruction >> 4) & 0xF;
+
+	switch (mnemonic->operands) {
+		case OPERANDS_NONE:
+			if (opcode == OPCODE_INVALID) {
+				snprintf(buffer, size, "%s %04X", mnemonic->mnemonic, instruction);
+			} else {
+				snprintf(buffer, size, "%s", mnemonic->mnemonic);
+			}
+			break;
+		case OPERANDS_NNN:
+			snprintf(buffer, size, "%s %03X", mnemonic->mnemonic, instruction & 0xFFF);
+			break;
+		case OPERANDS_VX_NN:
+			snprintf(buffer, size, "%s V%X %02X", mnemonic->mnemonic, x, instruction & 0xFF);
+			break;
+		case OPERANDS_VX_VY:
+			snprintf(buffer, size, "%s V%X V%X", mnemonic->mnemonic, x, y);
+			break;
+		case OPERANDS_VX_VY_N:
+			snprintf(buffer, size, "%s V%X V%X %X", mnemonic->mnemonic, x, y, instruction & 0xF);
+			break;
+		case OPERANDS_VX:
+			snprintf(buffer, size, "%s V%X", mnemonic->mnemonic, x);
+			break;
+		case OPERANDS_X:
+			snprintf(buffer, size, "%s %X", mnemonic->mnemonic, x);
+			break;
+	}
+}
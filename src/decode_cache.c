@@ -0,0 +1,81 @@
+#include "decode_cache.h"
+#include "superinstructions.h"
+
+#define VALID_BITS_PER_WORD 64
+
+bool is_decoded_slot_valid(CpuState *cpu_state, uint16_t address) {
+	return (cpu_state->decoded_valid[address / VALID_BITS_PER_WORD] >> (address % VALID_BITS_PER_WORD)) & 1;
+}
+
+void set_decoded_slot_valid(CpuState *cpu_state, uint16_t address, bool valid) {
+	uint64_t mask = (uint64_t) 1 << (address % VALID_BITS_PER_WORD);
+	if (valid) {
+		cpu_state->decoded_valid[address / VALID_BITS_PER_WORD] |= mask;
+	} else {
+		cpu_state->decoded_valid[address / VALID_BITS_PER_WORD] &= ~mask;
+	}
+}
+
+DecodedInstruction *lookup_decoded_instruction(CpuState *cpu_state, uint16_t address) {
+	address &= ADDRESS_BITMASK;
+	if (!is_decoded_slot_valid(cpu_state, address)) {
+		return NULL;
+	}
+	return &cpu_state->decoded_instructions[address];
+}
+
+DecodedInstruction *store_decoded_instruction(
+	CpuState *cpu_state, uint16_t address, uint16_t instruction, uint8_t opcode, Instruction *function
+) {
+	address &= ADDRESS_BITMASK;
+	DecodedInstruction *decoded = &cpu_state->decoded_instructions[address];
+
+	decoded->function = function;
+	decoded->instruction = instruction;
+	decoded->opcode = opcode;
+	decoded->nnn = extract_immediate_from_nnn(instruction);
+	decoded->x = extract_register_from_x(instruction);
+	decoded->y = extract_second_register_from_xy(instruction);
+	decoded->n = extract_immediate_from_xyn(instruction);
+	decoded->nn = extract_immediate_from_xnn(instruction);
+	decoded->superinstruction = SUPERINSTRUCTION_NONE;
+
+	set_decoded_slot_valid(cpu_state, address, true);
+	return decoded;
+}
+
+/*
+ * A written byte at address B is part of the instructions starting at B and at B - 1, and possibly of the
+ * superinstructions starting before them.
+ * Bumps the code generation if any of them had been decoded, so compiled code depending on them can be discarded.
+ */
+void invalidate_decoded_instruction(CpuState *cpu_state, uint16_t address) {
+	address &= ADDRESS_BITMASK;
+	bool was_valid = is_decoded_slot_valid(cpu_state, address);
+	set_decoded_slot_valid(cpu_state, address, false);
+	if (address > 0) {
+		was_valid = was_valid || is_decoded_slot_valid(cpu_state, address - 1);
+		set_decoded_slot_valid(cpu_state, address - 1, false);
+	}
+
+	// Instructions are 2 bytes long, shorter sequences may be invalidated needlessly
+	for (uint16_t offset = 2; offset < SUPERINSTRUCTION_MAX_LENGTH * 2 && offset <= address; ++offset) {
+		uint16_t start = address - offset;
+		if (
+			is_decoded_slot_valid(cpu_state, start) &&
+			cpu_state->decoded_instructions[start].superinstruction != SUPERINSTRUCTION_NONE
+		) {
+			set_decoded_slot_valid(cpu_state, start, false);
+			was_valid = true;
+		}
+	}
+
+	if (was_valid) {
+		++cpu_state->code_generation;
+	}
+}
+
+void clear_decode_cache(CpuState *cpu_state) {
+	memset(cpu_state->decoded_valid, 0, sizeof(cpu_state->decoded_valid));
+	++cpu_state->code_generation;
+}
@@ -9,22 +9,26 @@ const SDL_Keycode KEYBOARD_CODES[NUMBER_OF_KEYS] = {
 	SDL_SCANCODE_4, SDL_SCANCODE_R, SDL_SCANCODE_F, SDL_SCANCODE_V
 };
 
-void render_display(CpuState *cpu_state, SDL_Renderer *renderer) {
-	SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-	SDL_RenderClear(renderer);
-	SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-	SDL_Rect rect = {0, 0, PIXEL_SCALING, PIXEL_SCALING};
-
-	for (int x = 0; x < SCREEN_WIDTH; ++x) {
-		for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-			uint8_t pixel = read_pixel_from_screen(cpu_state, x, y);
-			if (pixel) {
-				rect.x = x * PIXEL_SCALING;
-				rect.y = y * PIXEL_SCALING;
-				SDL_RenderFillRect(renderer, &rect);
-			}
+/*
+ * Uploads the display into a SCREEN_WIDTH x SCREEN_HEIGHT streaming texture and lets the renderer scale it to the window.
+ * Only the span of rows between the first and last dirty one is uploaded, the rest of the texture is kept as is.
+ */
+void render_display(CpuState *cpu_state, SDL_Renderer *renderer, SDL_Texture *texture, uint32_t dirty_rows) {
+	if (dirty_rows != 0) {
+		uint8_t first_row = __builtin_ctz(dirty_rows);
+		uint8_t end_row = SCREEN_HEIGHT - __builtin_clz(dirty_rows);
+		SDL_Rect rect = {0, first_row, SCREEN_WIDTH, end_row - first_row};
+
+		void *pixels;
+		int pitch;
+		if (SDL_LockTexture(texture, &rect, &pixels, &pitch) < 0) {
+			return;
 		}
+		expand_display_to_argb(cpu_state, pixels, pitch, first_row, end_row, COLOR_ARGB_ON, COLOR_ARGB_OFF);
+		SDL_UnlockTexture(texture);
 	}
+
+	SDL_RenderCopy(renderer, texture, NULL, NULL);
 	SDL_RenderPresent(renderer);
 }
 
@@ -57,4 +61,73 @@ void update_keyboard_state(CpuState *cpu_state) {
 			set_key_pressed(cpu_state, key, false);
 		}
 	}
-}
\ No newline at end of file
+}
+
+bool is_rewind_key_pressed() {
+	return SDL_GetKeyboardState(NULL)[REWIND_SCANCODE];
+}
+
+void init_frame_pacer(FramePacer *pacer) {
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	pacer->ticks_per_frame = frequency / FRAMES_PER_SECOND;
+	pacer->spin_threshold_ticks = (frequency * FRAME_SPIN_THRESHOLD_MICROS) / 1000000;
+	pacer->next_deadline = SDL_GetPerformanceCounter() + pacer->ticks_per_frame;
+}
+
+/*
+ * Blocks until the start of the next frame.
+ * Most of the wait is spent sleeping, and the last stretch spinning on the performance counter to hit the deadline.
+ * If idle, the guest is only waiting for a timer or a key, so there's nothing to be late for and the spin is skipped:
+ * the whole wait is spent sleeping, even if that overshoots the deadline a little.
+ * If we're already late by more than a frame, the missed frames are dropped instead of rushed through.
+ */
+void wait_for_next_frame(FramePacer *pacer, bool idle) {
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 now = SDL_GetPerformanceCounter();
+	Uint64 spin_threshold_ticks = idle ? 0 : pacer->spin_threshold_ticks;
+
+	while (now + spin_threshold_ticks < pacer->next_deadline) {
+		Uint64 sleep_ticks = pacer->next_deadline - now - spin_threshold_ticks;
+		Uint32 sleep_millis = (Uint32) ((sleep_ticks * 1000) / frequency);
+		SDL_Delay(sleep_millis > 0 ? sleep_millis : 1);
+		now = SDL_GetPerformanceCounter();
+	}
+	while (now < pacer->next_deadline) {
+		now = SDL_GetPerformanceCounter();
+	}
+
+	pacer->next_deadline += pacer->ticks_per_frame;
+	if (pacer->next_deadline < now) {
+		pacer->next_deadline = now + pacer->ticks_per_frame;
+	}
+}
+
+/*
+ * Blocks on the event queue until the start of the next frame, or until an event the main loop handles arrives.
+ * Used while the guest is halted waiting for a key: a key event starts the next frame right away, and the frames
+ * after it are paced from then, so the key is seen without waiting for the rest of the frame.
+ * The events are left in the queue for the main loop, except for the ones it ignores, like mouse motion, which are
+ * dropped so they don't keep waking it up.
+ */
+void wait_for_next_frame_or_input(FramePacer *pacer) {
+	Uint64 frequency = SDL_GetPerformanceFrequency();
+	Uint64 now = SDL_GetPerformanceCounter();
+
+	while (now < pacer->next_deadline) {
+		Uint64 wait_ticks = pacer->next_deadline - now;
+		int wait_millis = (int) ((wait_ticks * 1000 + frequency - 1) / frequency);
+		if (SDL_WaitEventTimeout(NULL, wait_millis)) {
+			SDL_FlushEvents(SDL_MOUSEMOTION, SDL_LASTEVENT);
+			if (SDL_HasEvents(SDL_FIRSTEVENT, SDL_MOUSEMOTION - 1)) {
+				pacer->next_deadline = SDL_GetPerformanceCounter() + pacer->ticks_per_frame;
+				return;
+			}
+		}
+		now = SDL_GetPerformanceCounter();
+	}
+
+	pacer->next_deadline += pacer->ticks_per_frame;
+	if (pacer->next_deadline < now) {
+		pacer->next_deadline = now + pacer->ticks_per_frame;
+	}
+}
@@ -0,0 +1,323 @@
+#include "farm.h"
+#include "cpu.h"
+
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct {
+	Farm *farm;
+	FarmQueue *queues;
+	uint32_t id;
+	uint32_t threads;
+} FarmWorker;
+
+uint32_t count_cpu_cores() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? cores : 1;
+#endif
+}
+
+/*
+ * Allocates size sessions, all of them initialized with the same ROM and no input.
+ */
+bool init_farm(Farm *farm, size_t size, const uint8_t *rom) {
+	farm->sessions = calloc(size, sizeof(FarmSession));
+	farm->cpu_states = malloc(size * sizeof(CpuState));
+	farm->size = size;
+	if (farm->sessions == NULL || farm->cpu_states == NULL) {
+		free_farm(farm);
+		return false;
+	}
+
+	for (size_t i = 0; i < size; ++i) {
+		FarmSession *session = &farm->sessions[i];
+		session->cpu_state = &farm->cpu_states[i];
+		init_state(session->cpu_state, rom);
+		init_input_script(&session->input);
+	}
+
+	farm->instructions = 0;
+	farm->frames = 0;
+	farm->instructions_per_frame = DEFAULT_INSTRUCTIONS_PER_FRAME;
+	farm->use_jit = false;
+	farm->aot_program = NULL;
+	farm->lockstep = false;
+	farm->threads = 0;
+	farm->executed = 0;
+	farm->elapsed_seconds = 0;
+	return true;
+}
+
+/*
+ * Instructions to run on the next frame of a session, or 0 if it's done.
+ */
+uint32_t next_farm_batch(Farm *farm, uint64_t executed, uint32_t frames) {
+	uint32_t batch = farm->instructions_per_frame;
+	if (farm->instructions > 0) {
+		if (executed >= farm->instructions) {
+			return 0;
+		}
+		if (farm->instructions - executed < batch) {
+			batch = farm->instructions - executed;
+		}
+	} else if (frames >= farm->frames) {
+		return 0;
+	}
+	return batch;
+}
+
+/*
+ * Adds to batch the frames following the one starting at frames that can run along with it, and returns how many
+ * frames it covers.
+ * While the CPU is halted waiting for a key, nothing but the timers can change until the next scripted key event, so
+ * every frame until then runs as a single batch.
+ */
+uint32_t merge_farm_key_wait(Farm *farm, FarmSession *session, uint32_t *batch) {
+	uint32_t merged = 1;
+	if (!is_waiting_for_key(session->cpu_state)) {
+		return merged;
+	}
+
+	uint32_t wake_frame = next_input_script_frame(&session->input);
+	while (session->frames + merged < wake_frame) {
+		uint32_t next = next_farm_batch(farm, session->executed + *batch, session->frames + merged);
+		if (next == 0 || *batch > UINT32_MAX - next) {
+			break;
+		}
+		*batch += next;
+		++merged;
+	}
+	return merged;
+}
+
+/*
+ * Runs a session to the end of its budget, frame by frame, as a frontend would.
+ * Frames spent waiting for a key are skipped through up to the next scripted key event.
+ * aot and jit may be NULL to interpret, the ahead of time translation is used first.
+ */
+void run_farm_session(Farm *farm, FarmSession *session, JitContext *jit, AotContext *aot) {
+	CpuState *cpu_state = session->cpu_state;
+
+	for (;;) {
+		uint32_t batch = next_farm_batch(farm, session->executed, session->frames);
+		if (batch == 0) {
+			break;
+		}
+
+		apply_input_script(&session->input, cpu_state, session->frames);
+		uint32_t frames = merge_farm_key_wait(farm, session, &batch);
+		if (aot != NULL) {
+			session->executed += aot_run(aot, cpu_state, batch);
+		} else if (jit != NULL) {
+			session->executed += jit_run(jit, cpu_state, batch);
+		} else {
+			session->executed += run_instructions(cpu_state, batch);
+		}
+		update_beeper_status(cpu_state);
+		session->frames += frames;
+	}
+}
+
+/*
+ * Runs the sessions of a lockstep group to the end of their budget.
+ * If they can't run in lockstep, they run one after the other.
+ */
+void run_farm_lockstep_group(Farm *farm, size_t group, JitContext *jit, AotContext *aot) {
+	size_t first = group * LOCKSTEP_MAX_LANES;
+	uint32_t lanes = farm->size - first < LOCKSTEP_MAX_LANES ? farm->size - first : LOCKSTEP_MAX_LANES;
+	FarmSession *sessions = &farm->sessions[first];
+
+	CpuState *cpu_states[LOCKSTEP_MAX_LANES];
+	for (uint32_t lane = 0; lane < lanes; ++lane) {
+		cpu_states[lane] = sessions[lane].cpu_state;
+	}
+
+	LockstepBatch batch;
+	if (!init_lockstep_batch(&batch, cpu_states, lanes)) {
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			run_farm_session(farm, &sessions[lane], jit, aot);
+		}
+		return;
+	}
+
+	// All the sessions have the same budget, so they all run the same frames
+	for (uint32_t frame = sessions[0].frames;; ++frame) {
+		uint32_t count = next_farm_batch(farm, sessions[0].executed, frame);
+		if (count == 0) {
+			break;
+		}
+
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			apply_input_script(&sessions[lane].input, cpu_states[lane], frame);
+		}
+		run_lockstep(&batch, count);
+		sync_lockstep_batch(&batch);
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			update_beeper_status(cpu_states[lane]);
+			sessions[lane].executed += count;
+			sessions[lane].frames = frame + 1;
+		}
+	}
+}
+
+size_t count_farm_tasks(Farm *farm) {
+	if (farm->lockstep) {
+		return (farm->size + LOCKSTEP_MAX_LANES - 1) / LOCKSTEP_MAX_LANES;
+	}
+	return farm->size;
+}
+
+/*
+ * Takes a task, a session or a lockstep group, from a worker queue: the owner takes from the back, thieves from the front.
+ */
+bool take_farm_task(FarmQueue *queue, bool owner, size_t *index) {
+	bool taken = false;
+
+	pthread_mutex_lock(&queue->lock);
+	if (queue->front < queue->back) {
+		*index = owner ? --queue->back : queue->front++;
+		taken = true;
+	}
+	pthread_mutex_unlock(&queue->lock);
+
+	return taken;
+}
+
+void *run_farm_worker(void *arg) {
+	FarmWorker *worker = arg;
+
+	AotContext *aot = NULL;
+	if (worker->farm->aot_program != NULL) {
+		aot = malloc(sizeof(AotContext));
+		if (aot != NULL) {
+			aot_init(aot, worker->farm->aot_program);
+		}
+	}
+
+	JitContext *jit = NULL;
+	if (worker->farm->use_jit && aot == NULL) {
+		jit = malloc(sizeof(JitContext));
+		if (jit != NULL && !jit_init(jit)) {
+			free(jit);
+			jit = NULL;
+		}
+	}
+
+	for (;;) {
+		size_t index;
+		bool found = take_farm_task(&worker->queues[worker->id], true, &index);
+
+		// Sessions are never added back, so once every queue is empty the work is done
+		for (uint32_t offset = 1; !found && offset < worker->threads; ++offset) {
+			uint32_t victim = (worker->id + offset) % worker->threads;
+			found = take_farm_task(&worker->queues[victim], false, &index);
+		}
+		if (!found) {
+			break;
+		}
+
+		if (worker->farm->lockstep) {
+			run_farm_lockstep_group(worker->farm, index, jit, aot);
+		} else {
+			run_farm_session(worker->farm, &worker->farm->sessions[index], jit, aot);
+		}
+	}
+
+	if (jit != NULL) {
+		jit_destroy(jit);
+		free(jit);
+	}
+	free(aot);
+	return NULL;
+}
+
+double read_monotonic_seconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs every session with the given number of threads, or one per core if 0.
+ * The calling thread works as one of them.
+ */
+bool run_farm(Farm *farm, uint32_t threads) {
+	if (threads == 0) {
+		threads = count_cpu_cores();
+	}
+	if (threads > FARM_MAX_THREADS) {
+		threads = FARM_MAX_THREADS;
+	}
+	size_t tasks = count_farm_tasks(farm);
+	if (threads > tasks) {
+		threads = tasks > 0 ? tasks : 1;
+	}
+
+	FarmQueue queues[FARM_MAX_THREADS];
+	FarmWorker workers[FARM_MAX_THREADS];
+	pthread_t thread_ids[FARM_MAX_THREADS];
+
+	for (uint32_t i = 0; i < threads; ++i) {
+		pthread_mutex_init(&queues[i].lock, NULL);
+		queues[i].front = (tasks * i) / threads;
+		queues[i].back = (tasks * (i + 1)) / threads;
+
+		workers[i].farm = farm;
+		workers[i].queues = queues;
+		workers[i].id = i;
+		workers[i].threads = threads;
+	}
+
+	double start = read_monotonic_seconds();
+
+	uint32_t started = 1;
+	bool ok = true;
+	for (; started < threads; ++started) {
+		if (pthread_create(&thread_ids[started], NULL, run_farm_worker, &workers[started]) != 0) {
+			// The threads that did start will steal the sessions of the missing ones
+			ok = false;
+			break;
+		}
+	}
+	run_farm_worker(&workers[0]);
+	for (uint32_t i = 1; i < started; ++i) {
+		pthread_join(thread_ids[i], NULL);
+	}
+
+	farm->elapsed_seconds = read_monotonic_seconds() - start;
+	farm->threads = started;
+	farm->executed = 0;
+	for (size_t i = 0; i < farm->size; ++i) {
+		farm->executed += farm->sessions[i].executed;
+	}
+
+	for (uint32_t i = 0; i < threads; ++i) {
+		pthread_mutex_destroy(&queues[i].lock);
+	}
+	return ok;
+}
+
+double farm_instructions_per_second(const Farm *farm) {
+	if (farm->elapsed_seconds <= 0) {
+		return 0;
+	}
+	return farm->executed / farm->elapsed_seconds;
+}
+
+void free_farm(Farm *farm) {
+	free(farm->sessions);
+	free(farm->cpu_states);
+	farm->sessions = NULL;
+	farm->cpu_states = NULL;
+	farm->size = 0;
+}
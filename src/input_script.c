@@ -0,0 +1,91 @@
+#include "input_script.h"
+
+#define INPUT_SCRIPT_LINE_SIZE 256
+
+void init_input_script(InputScript *script) {
+	script->events = NULL;
+	script->size = 0;
+	script->next = 0;
+}
+
+bool append_input_event(InputScript *script, size_t *capacity, uint32_t frame, uint16_t keys) {
+	if (script->size == *capacity) {
+		size_t new_capacity = *capacity ? 2 * *capacity : 64;
+		InputEvent *events = realloc(script->events, new_capacity * sizeof(InputEvent));
+		if (events == NULL) {
+			return false;
+		}
+		script->events = events;
+		*capacity = new_capacity;
+	}
+
+	script->events[script->size].frame = frame;
+	script->events[script->size].keys = keys;
+	++script->size;
+	return true;
+}
+
+bool load_input_script(InputScript *script, const char *path) {
+	init_input_script(script);
+
+	FILE *file_ptr = fopen(path, "r");
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open input script %s\n", path);
+		return false;
+	}
+
+	char line[INPUT_SCRIPT_LINE_SIZE];
+	size_t capacity = 0;
+	unsigned line_number = 0;
+	bool ok = true;
+	while (ok && fgets(line, sizeof(line), file_ptr) != NULL) {
+		++line_number;
+
+		char *start = line;
+		while (*start == ' ' || *start == '\t') {
+			++start;
+		}
+		if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0') {
+			continue;
+		}
+
+		unsigned long frame, keys;
+		if (sscanf(start, "%lu %lx", &frame, &keys) != 2 || keys > 0xFFFF) {
+			fprintf(stderr, "Invalid input script line %u: %s", line_number, line);
+			ok = false;
+		} else if (script->size > 0 && frame < script->events[script->size - 1].frame) {
+			fprintf(stderr, "Input script line %u goes back in time\n", line_number);
+			ok = false;
+		} else {
+			ok = append_input_event(script, &capacity, frame, keys);
+		}
+	}
+	fclose(file_ptr);
+
+	if (!ok) {
+		free_input_script(script);
+	}
+	return ok;
+}
+
+/*
+ * Applies every event up to the given frame.
+ */
+void apply_input_script(InputScript *script, CpuState *cpu_state, uint32_t frame) {
+	while (script->next < script->size && script->events[script->next].frame <= frame) {
+		write_keyboard_mask(cpu_state, script->events[script->next].keys);
+		++script->next;
+	}
+}
+
+/*
+ * Frame of the next event not applied yet, or UINT32_MAX if there are none left.
+ */
+uint32_t next_input_script_frame(InputScript *script) {
+	return script->next < script->size ? script->events[script->next].frame : UINT32_MAX;
+}
+
+void free_input_script(InputScript *script) {
+	free(script->events);
+	init_input_script(script);
+}
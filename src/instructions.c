@@ -29,16 +29,8 @@ void draw(CpuState *cpu_state, uint16_t instruction) {
 	uint8_t vf_flag = 0;
 	for (uint8_t y_offset = 0; (y_offset < n_rows) && (y + y_offset < SCREEN_HEIGHT); ++y_offset) {
 		uint8_t sprite_row = read_byte_memory(cpu_state, index_register_value + y_offset);
-		for (uint8_t x_offset = 0; (x_offset < SPRITE_WIDTH) && (x + x_offset < SCREEN_WIDTH); ++x_offset) {
-			uint8_t sprite_pixel = (sprite_row >> (7 - x_offset)) & 1;
-			uint8_t display_pixel = read_pixel_from_screen(cpu_state, x + x_offset, y + y_offset);
-
-			if (sprite_pixel && display_pixel) {
-				vf_flag = 1;
-			}
-
-			uint8_t result_pixel = (sprite_pixel ^ display_pixel) & 1;
-			write_pixel_to_screen(cpu_state, x + x_offset, y + y_offset, result_pixel);
+		if (xor_sprite_row_to_screen(cpu_state, x, y + y_offset, sprite_row)) {
+			vf_flag = 1;
 		}
 	}
 	write_register_bank(cpu_state, STATUS_REGISTER, vf_flag);
@@ -74,21 +66,22 @@ void jump_subroutine(CpuState *cpu_state, uint16_t instruction) {
  * BNNN | BXNN
  * JUMPR NNN | JUMPR VX NN
  * Sets the PC to the result of a register + an offset.
- * If OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET, set PC to VX + NN.
+ * If register_argument, set PC to VX + NN.
  * Otherwise, set PC to V0 + NNN.
  */
-void jump_with_offset(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void jump_with_offset_with_quirks(CpuState *cpu_state, uint16_t instruction, bool register_argument) {
 	uint8_t base;
 	uint16_t offset;
 
-#if OPTION_REGISTER_ARGUMENT_ON_JUMP_WITH_OFFSET
-	uint8_t vx = extract_register_from_xnn(instruction);
-	base = read_register_bank(cpu_state, vx);
-	offset = extract_immediate_from_xnn(instruction);
-#else
-	base = read_register_bank(cpu_state, 0);
-	offset = extract_immediate_from_nnn(instruction);
-#endif
+	if (register_argument) {
+		uint8_t vx = extract_register_from_xnn(instruction);
+		base = read_register_bank(cpu_state, vx);
+		offset = extract_immediate_from_xnn(instruction);
+	} else {
+		base = read_register_bank(cpu_state, 0);
+		offset = extract_immediate_from_nnn(instruction);
+	}
 
 	uint16_t destination = base + (offset & ADDRESS_BITMASK);
 	write_register_pc(cpu_state, destination);
@@ -174,11 +167,11 @@ void skip_if_registers_different(CpuState *cpu_state, uint16_t instruction) {
  * EX9E
  * SKPR VX
  * Skip the next instruction if the key stored in VX is pressed.
- * VX should be 0x0 <= VX <= 0xF.
+ * VX should be 0x0 <= VX <= 0xF, only its lowest 4 bits are used.
  */
 void skip_pressed(CpuState *cpu_state, uint16_t instruction) {
 	uint8_t vx = extract_register_from_x(instruction);
-	uint8_t vx_val = read_register_bank(cpu_state, vx);
+	uint8_t vx_val = read_register_bank(cpu_state, vx) & 0x0F;
 
 	bool key_pressed = is_key_pressed(cpu_state, vx_val);
 	if (key_pressed) {
@@ -190,11 +183,11 @@ void skip_pressed(CpuState *cpu_state, uint16_t instruction) {
  * EXA1
  * SKNP VX
  * Skip the next instruction if the key stored in VX is not pressed.
- * VX should be 0x0 <= VX <= 0xF.
+ * VX should be 0x0 <= VX <= 0xF, only its lowest 4 bits are used.
  */
 void skip_not_pressed(CpuState *cpu_state, uint16_t instruction) {
 	uint8_t vx = extract_register_from_x(instruction);
-	uint8_t vx_val = read_register_bank(cpu_state, vx);
+	uint8_t vx_val = read_register_bank(cpu_state, vx) & 0x0F;
 
 	bool key_pressed = is_key_pressed(cpu_state, vx_val);
 	if (!key_pressed) {
@@ -248,10 +241,10 @@ void set_index_register(CpuState *cpu_state, uint16_t instruction) {
  * X is an immediate, not the register number from which to get a value from.
  * Valid values of X go from 0 (only V0 will be saved) to F (all registers will be saved).
  * The saved registers are written starting with V0 at I, up to VX at I+X.
- * If OPTION_DUMP_INCREMENTS_I, set I to one past the last written byte (I + X + 1).
- * Otherwise, do not alter I.
+ * Then move I as index_increment says, one of the INDEX_ values.
  */
-void save_registers(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void save_registers_with_quirks(CpuState *cpu_state, uint16_t instruction, uint8_t index_increment) {
 	uint8_t x = extract_register_from_x(instruction);
 	uint16_t base_address = read_index_register(cpu_state);
 	for (uint8_t i = 0; i <= x; ++i) {
@@ -260,9 +253,10 @@ void save_registers(CpuState *cpu_state, uint16_t instruction) {
 		write_byte_memory(cpu_state, address, vi);
 	}
 
-#if OPTION_DUMP_INCREMENTS_I
-	write_index_register(cpu_state, (base_address + x + 1) & ADDRESS_BITMASK);
-#endif
+	if (index_increment != INDEX_UNCHANGED) {
+		uint8_t increment = index_increment == INDEX_INCREMENT_BY_X ? x : x + 1;
+		write_index_register(cpu_state, (base_address + increment) & ADDRESS_BITMASK);
+	}
 }
 
 /*
@@ -272,8 +266,10 @@ void save_registers(CpuState *cpu_state, uint16_t instruction) {
  * X is an immediate, not the register number from which to get a value from.
  * Valid values of X go from 0 (only V0 will be loaded) to F (all registers will be loaded).
  * Values are reading starting from I, up to I + X.
+ * Then move I as index_increment says, one of the INDEX_ values.
  */
-void load_registers(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void load_registers_with_quirks(CpuState *cpu_state, uint16_t instruction, uint8_t index_increment) {
 	uint8_t x = extract_register_from_x(instruction);
 	uint16_t base_address = read_index_register(cpu_state);
 	for (uint8_t i = 0; i <= x; ++i) {
@@ -281,6 +277,11 @@ void load_registers(CpuState *cpu_state, uint16_t instruction) {
 		uint8_t value = read_byte_memory(cpu_state, address);
 		write_register_bank(cpu_state, i, value);
 	}
+
+	if (index_increment != INDEX_UNCHANGED) {
+		uint8_t increment = index_increment == INDEX_INCREMENT_BY_X ? x : x + 1;
+		write_index_register(cpu_state, (base_address + increment) & ADDRESS_BITMASK);
+	}
 }
 
 /* Arithmetic */
@@ -304,27 +305,28 @@ void add_immediate_to_register(CpuState *cpu_state, uint16_t instruction) {
  * FX1E
  * IADD VX
  * Increment the index register by the value stored in VX.
- * If OPTION_OVERFLOW_ON_ADD_TO_INDEX,
+ * If overflow,
  * set the carry flag if the result overflows over the size of the index register,
  * or reset it if it doesn't overflow.
  * Otherwise, do not alter the carry flag at all.
  */
-void add_to_index(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void add_to_index_with_quirks(CpuState *cpu_state, uint16_t instruction, bool overflow) {
 	uint8_t rx = extract_register_from_x(instruction);
 	uint8_t vx = read_register_bank(cpu_state, rx);
 	uint16_t i_val = read_index_register(cpu_state);
 
 	uint16_t result = i_val + vx;
 
-#if OPTION_OVERFLOW_ON_ADD_TO_INDEX
-	uint8_t carry_flag;
-	if ((~ADDRESS_BITMASK) & result) {
-		carry_flag = 1;
-	} else {
-		carry_flag = 0;
+	if (overflow) {
+		uint8_t carry_flag;
+		if ((~ADDRESS_BITMASK) & result) {
+			carry_flag = 1;
+		} else {
+			carry_flag = 0;
+		}
+		write_register_bank(cpu_state, STATUS_REGISTER, carry_flag);
 	}
-	write_register_bank(cpu_state, STATUS_REGISTER, carry_flag);
-#endif
 
 	write_index_register(cpu_state, result & ADDRESS_BITMASK);
 }
@@ -469,20 +471,21 @@ void bitwise_xor(CpuState *cpu_state, uint16_t instruction) {
 /*
  * 8XYE
  * SHIFTL VX VY.
- * If OPTION_USE_EXTRA_REGISTER_ON_SHIFT, set VX to VY << 1.
+ * If use_extra_register, set VX to VY << 1.
  * Otherwise, set VX to VX << 1, ignoring VY entirely.
  * In either case, set the carry flag to the value of the shifted out bit.
  */
-void shift_left(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void shift_left_with_quirks(CpuState *cpu_state, uint16_t instruction, bool use_extra_register) {
 	uint8_t vx = extract_first_register_from_xy(instruction);
 	uint8_t value;
 
-#if OPTION_USE_EXTRA_REGISTER_ON_SHIFT
-	uint8_t vy = extract_second_register_from_xy(instruction);
-	value = read_register_bank(cpu_state, vy);
-#else
-	value = read_register_bank(cpu_state, vx);
-#endif
+	if (use_extra_register) {
+		uint8_t vy = extract_second_register_from_xy(instruction);
+		value = read_register_bank(cpu_state, vy);
+	} else {
+		value = read_register_bank(cpu_state, vx);
+	}
 
 	uint8_t shifted_out_bit = (value & 0x80) >> 7;
 	write_register_bank(cpu_state, STATUS_REGISTER, shifted_out_bit);
@@ -494,20 +497,21 @@ void shift_left(CpuState *cpu_state, uint16_t instruction) {
 /*
  * 8XY6
  * SHIFTR VX VY.
- * If OPTION_USE_EXTRA_REGISTER_ON_SHIFT, set VX to VY >> 1.
+ * If use_extra_register, set VX to VY >> 1.
  * Otherwise, set VX to VX >> 1, ignoring VY entirely.
  * In either case, set the carry flag to the value of the shifted out bit.
  */
-void shift_right(CpuState *cpu_state, uint16_t instruction) {
+__attribute__((always_inline))
+inline void shift_right_with_quirks(CpuState *cpu_state, uint16_t instruction, bool use_extra_register) {
 	uint8_t vx = extract_first_register_from_xy(instruction);
 	uint8_t value;
 
-#if OPTION_USE_EXTRA_REGISTER_ON_SHIFT
-	uint8_t vy = extract_second_register_from_xy(instruction);
-	value = read_register_bank(cpu_state, vy);
-#else
-	value = read_register_bank(cpu_state,vx);
-#endif
+	if (use_extra_register) {
+		uint8_t vy = extract_second_register_from_xy(instruction);
+		value = read_register_bank(cpu_state, vy);
+	} else {
+		value = read_register_bank(cpu_state, vx);
+	}
 
 	uint8_t shifted_out_bit = value & 1;
 	write_register_bank(cpu_state, STATUS_REGISTER, shifted_out_bit);
@@ -528,7 +532,7 @@ void set_register_to_bitmasked_rand(CpuState *cpu_state, uint16_t instruction) {
 	uint8_t vx = extract_register_from_xnn(instruction);
 	uint8_t bitmask = extract_immediate_from_xnn(instruction);
 
-	uint8_t random_byte = rand() & 0xFF; // NOLINT(cert-msc50-cpp)
+	uint8_t random_byte = next_random_byte(cpu_state);
 	uint8_t result = random_byte & bitmask;
 
 	write_register_bank(cpu_state, vx, result);
@@ -576,15 +580,16 @@ void set_sound(CpuState *cpu_state, uint16_t instruction) {
 /*
  * FX0A
  * KEY VX
- * Depending on OPTION_KEY_WAIT_FOR_RELEASE, the instruction awaits until a key release (if set)
- * or a key release (if not set).
- * If a key event is happening right now, save the key that triggered the event in VX.
- * Otherwise, decrease the PC by 2.
- * This instruction will functionally repeat until a key event is triggered.
- */
-void wait_for_key(CpuState *cpu_state, uint16_t instruction) {
+ * Depending on wait_for_release, the instruction awaits until a key release (if set)
+ * or a key press (if not set).
+ * If a key event is happening right now, save the key that triggered the event in VX, and resume.
+ * Otherwise, the CPU halts waiting for a key: the PC is decreased by 2, so every following cycle runs this instruction
+ * again to poll the keyboard, and the core can park until the keys change.
+ */
+__attribute__((always_inline))
+inline void wait_for_key_with_quirks(CpuState *cpu_state, uint16_t instruction, bool wait_for_release) {
 	uint8_t key;
-	if (any_key_pressed(cpu_state, &key)) {
+	if (poll_key_wait(cpu_state, wait_for_release, &key)) {
 		uint8_t vx = extract_register_from_x(instruction);
 		write_register_bank(cpu_state, vx, key);
 	} else {
@@ -604,4 +609,36 @@ void point_to_char(CpuState *cpu_state, uint16_t instruction) {
 	uint16_t char_address = character_address(requested_char) & ADDRESS_BITMASK;
 
 	write_index_register(cpu_state, char_address);
-}
\ No newline at end of file
+}
+
+/* Quirks */
+
+/*
+ * The handlers of every profile, each one a copy of the handler above with the profile's quirks as constants.
+ */
+#define DEFINE_QUIRK_HANDLERS( \
+	profile, name, suffix, shift_vy, jump_vx, index_overflow, index_increment, key_release \
+) \
+	void jump_with_offset##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		jump_with_offset_with_quirks(cpu_state, instruction, jump_vx); \
+	} \
+	void save_registers##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		save_registers_with_quirks(cpu_state, instruction, index_increment); \
+	} \
+	void load_registers##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		load_registers_with_quirks(cpu_state, instruction, index_increment); \
+	} \
+	void add_to_index##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		add_to_index_with_quirks(cpu_state, instruction, index_overflow); \
+	} \
+	void shift_left##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		shift_left_with_quirks(cpu_state, instruction, shift_vy); \
+	} \
+	void shift_right##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		shift_right_with_quirks(cpu_state, instruction, shift_vy); \
+	} \
+	void wait_for_key##suffix(CpuState *cpu_state, uint16_t instruction) { \
+		wait_for_key_with_quirks(cpu_state, instruction, key_release); \
+	}
+
+FOR_EACH_QUIRK_PROFILE(DEFINE_QUIRK_HANDLERS)
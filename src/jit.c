@@ -0,0 +1,572 @@
+#include "jit.h"
+#include "cpu.h"
+
+#if JIT_SUPPORTED
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/*
+ * Basic block recompiler for x86-64.
+ *
+ * Straight-line runs of instructions are translated into native code working directly on the CpuState,
+ * which is kept in RBX for the whole run. R12 holds the remaining instruction budget.
+ * Blocks end on any instruction that changes the control flow, and on FX33 and FX55 since they can rewrite code.
+ * Instructions that are too complex to be worth translating call their handler in instructions.c.
+ *
+ * Every block starts by checking that the whole block fits in the remaining budget, and exits otherwise,
+ * so the dispatcher can finish the run with the interpreter and the instruction count is always exact.
+ */
+
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK_INSTRUCTIONS * 512)
+
+#define OFFSET_MEMORY ((uint32_t) offsetof(CpuState, memory))
+#define OFFSET_STACK ((uint32_t) offsetof(CpuState, stack))
+#define OFFSET_STACK_SIZE ((uint32_t) offsetof(CpuState, stack_size))
+#define OFFSET_PC ((uint32_t) offsetof(CpuState, program_counter))
+#define OFFSET_I ((uint32_t) offsetof(CpuState, index_register))
+#define OFFSET_V(r) ((uint32_t) (offsetof(CpuState, register_bank) + (r)))
+#define OFFSET_VF OFFSET_V(STATUS_REGISTER)
+#define OFFSET_KEYBOARD ((uint32_t) offsetof(CpuState, keyboard))
+
+/* Emission */
+
+void emit_u8(JitContext *jit, uint8_t v) {
+	jit->code[jit->code_used++] = v;
+}
+
+void emit_u16(JitContext *jit, uint16_t v) {
+	memcpy(jit->code + jit->code_used, &v, sizeof(v));
+	jit->code_used += sizeof(v);
+}
+
+void emit_u32(JitContext *jit, uint32_t v) {
+	memcpy(jit->code + jit->code_used, &v, sizeof(v));
+	jit->code_used += sizeof(v);
+}
+
+void emit_u64(JitContext *jit, uint64_t v) {
+	memcpy(jit->code + jit->code_used, &v, sizeof(v));
+	jit->code_used += sizeof(v);
+}
+
+void emit_bytes(JitContext *jit, const uint8_t *bytes, size_t n) {
+	memcpy(jit->code + jit->code_used, bytes, n);
+	jit->code_used += n;
+}
+
+#define EMIT(jit, ...) do { \
+	const uint8_t bytes[] = {__VA_ARGS__}; \
+	emit_bytes(jit, bytes, sizeof(bytes)); \
+} while (0)
+
+// Writes the rel32 at offset so that it points to target
+void patch_rel32(JitContext *jit, size_t rel32_offset, const uint8_t *target) {
+	int32_t rel = (int32_t) (target - (jit->code + rel32_offset + 4));
+	memcpy(jit->code + rel32_offset, &rel, sizeof(rel));
+}
+
+// Emits a rel32 pointing to target, returns its offset
+size_t emit_rel32(JitContext *jit, const uint8_t *target) {
+	size_t offset = jit->code_used;
+	emit_u32(jit, 0);
+	patch_rel32(jit, offset, target);
+	return offset;
+}
+
+void emit_jump_to_exit(JitContext *jit) {
+	EMIT(jit, 0xE9); // jmp rel32
+	emit_rel32(jit, jit->exit_stub);
+}
+
+void emit_set_pc(JitContext *jit, uint16_t pc) {
+	EMIT(jit, 0x66, 0xC7, 0x83); // mov word [rbx + disp32], imm16
+	emit_u32(jit, OFFSET_PC);
+	emit_u16(jit, pc);
+}
+
+void emit_load_al(JitContext *jit, uint32_t offset) {
+	EMIT(jit, 0x8A, 0x83); // mov al, [rbx + disp32]
+	emit_u32(jit, offset);
+}
+
+void emit_load_cl(JitContext *jit, uint32_t offset) {
+	EMIT(jit, 0x8A, 0x8B); // mov cl, [rbx + disp32]
+	emit_u32(jit, offset);
+}
+
+void emit_store_al(JitContext *jit, uint32_t offset) {
+	EMIT(jit, 0x88, 0x83); // mov [rbx + disp32], al
+	emit_u32(jit, offset);
+}
+
+void emit_store_dl(JitContext *jit, uint32_t offset) {
+	EMIT(jit, 0x88, 0x93); // mov [rbx + disp32], dl
+	emit_u32(jit, offset);
+}
+
+// Emits an 8 bit ALU operation between AL and the byte at offset, with the given r8, r/m8 opcode
+void emit_alu_al(JitContext *jit, uint8_t opcode, uint32_t offset) {
+	EMIT(jit, opcode, 0x83); // op al, [rbx + disp32]
+	emit_u32(jit, offset);
+}
+
+void emit_call_handler(JitContext *jit, uint16_t address, uint16_t instruction, Instruction *function) {
+	// Handlers expect the PC to already point to the next instruction, as fetch leaves it
+	emit_set_pc(jit, address + INSTRUCTION_SIZE);
+#if JIT_WIN64_ABI
+	EMIT(jit, 0x48, 0x89, 0xD9); // mov rcx, rbx
+	EMIT(jit, 0xBA); // mov edx, imm32
+#else
+	EMIT(jit, 0x48, 0x89, 0xDF); // mov rdi, rbx
+	EMIT(jit, 0xBE); // mov esi, imm32
+#endif
+	emit_u32(jit, instruction);
+	EMIT(jit, 0x48, 0xB8); // mov rax, imm64
+	emit_u64(jit, (uint64_t) (uintptr_t) function);
+	EMIT(jit, 0xFF, 0xD0); // call rax
+}
+
+/*
+ * Continue execution at target.
+ * If the target block already exists jump straight into it, otherwise exit and remember the jump to patch it later.
+ */
+void emit_chain(JitContext *jit, uint16_t target) {
+	emit_set_pc(jit, target);
+	EMIT(jit, 0xE9); // jmp rel32
+	size_t rel32_offset = emit_rel32(jit, jit->exit_stub);
+
+	if (target > MEMORY_SIZE - INSTRUCTION_SIZE) {
+		return;
+	}
+	if (jit->blocks[target] != NULL) {
+		patch_rel32(jit, rel32_offset, jit->blocks[target]);
+	} else if (jit->chain_sites_used < JIT_MAX_CHAIN_SITES) {
+		JitChainSite *site = &jit->chain_sites[jit->chain_sites_used++];
+		site->rel32_offset = rel32_offset;
+		site->target = target;
+	}
+}
+
+// Emits a conditional skip: jcc to the skipping path, with the condition code of the jcc rel32 opcode
+void emit_skip(JitContext *jit, uint16_t address, uint8_t jcc) {
+	EMIT(jit, 0x0F, jcc); // jcc rel32
+	size_t rel32_offset = jit->code_used;
+	emit_u32(jit, 0);
+
+	emit_chain(jit, address + INSTRUCTION_SIZE);
+	patch_rel32(jit, rel32_offset, jit->code + jit->code_used);
+	emit_chain(jit, address + 2 * INSTRUCTION_SIZE);
+}
+
+#define JCC_EQUAL 0x84
+#define JCC_NOT_EQUAL 0x85
+
+/* Stubs */
+
+void emit_stubs(JitContext *jit) {
+	jit->code_used = 0;
+
+	jit->enter = (int64_t (*)(CpuState *, uint8_t *, int64_t)) (void *) jit->code;
+	EMIT(jit, 0x53); // push rbx
+	EMIT(jit, 0x41, 0x54); // push r12
+	EMIT(jit, 0x48, 0x83, 0xEC, 0x28); // sub rsp, 40 (keeps 16 byte alignment and leaves shadow space for Win64)
+#if JIT_WIN64_ABI
+	EMIT(jit, 0x48, 0x89, 0xCB); // mov rbx, rcx
+	EMIT(jit, 0x4D, 0x89, 0xC4); // mov r12, r8
+	EMIT(jit, 0xFF, 0xE2); // jmp rdx
+#else
+	EMIT(jit, 0x48, 0x89, 0xFB); // mov rbx, rdi
+	EMIT(jit, 0x49, 0x89, 0xD4); // mov r12, rdx
+	EMIT(jit, 0xFF, 0xE6); // jmp rsi
+#endif
+
+	jit->exit_stub = jit->code + jit->code_used;
+	EMIT(jit, 0x4C, 0x89, 0xE0); // mov rax, r12
+	EMIT(jit, 0x48, 0x83, 0xC4, 0x28); // add rsp, 40
+	EMIT(jit, 0x41, 0x5C); // pop r12
+	EMIT(jit, 0x5B); // pop rbx
+	EMIT(jit, 0xC3); // ret
+
+	jit->stubs_size = jit->code_used;
+}
+
+/* Translation */
+
+/*
+ * Emits the code for a single instruction, with the quirks of the state it's compiled for folded in.
+ * Returns true if the instruction ends the block.
+ */
+bool emit_instruction(JitContext *jit, uint16_t address, DecodedInstruction *decoded) {
+	uint8_t x = decoded->x;
+	uint8_t y = decoded->y;
+	const QuirkSettings *quirks = &QUIRK_PROFILE_SETTINGS[jit->cpu_state->quirk_profile];
+
+	switch (decoded->opcode) {
+		/* Control flow */
+
+		case OPCODE_JUMP:
+			emit_chain(jit, decoded->nnn);
+			return true;
+
+		case OPCODE_JUMP_SUBROUTINE:
+			EMIT(jit, 0x0F, 0xB6, 0x83); // movzx eax, byte [rbx + stack_size]
+			emit_u32(jit, OFFSET_STACK_SIZE);
+			EMIT(jit, 0x66, 0xC7, 0x84, 0x43); // mov word [rbx + rax * 2 + stack], imm16
+			emit_u32(jit, OFFSET_STACK);
+			emit_u16(jit, (address + INSTRUCTION_SIZE) & ADDRESS_BITMASK);
+			EMIT(jit, 0xFE, 0x83); // inc byte [rbx + stack_size]
+			emit_u32(jit, OFFSET_STACK_SIZE);
+			emit_chain(jit, decoded->nnn);
+			return true;
+
+		case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+		case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+			EMIT(jit, 0x80, 0xBB); // cmp byte [rbx + disp32], imm8
+			emit_u32(jit, OFFSET_V(x));
+			emit_u8(jit, decoded->nn);
+			emit_skip(
+				jit, address,
+				decoded->opcode == OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE ? JCC_EQUAL : JCC_NOT_EQUAL
+			);
+			return true;
+
+		case OPCODE_SKIP_IF_REGISTERS_EQUAL:
+		case OPCODE_SKIP_IF_REGISTERS_DIFFERENT:
+			emit_load_al(jit, OFFSET_V(x));
+			emit_alu_al(jit, 0x3A, OFFSET_V(y)); // cmp al, [rbx + disp32]
+			emit_skip(
+				jit, address,
+				decoded->opcode == OPCODE_SKIP_IF_REGISTERS_EQUAL ? JCC_EQUAL : JCC_NOT_EQUAL
+			);
+			return true;
+
+		case OPCODE_SKIP_PRESSED:
+		case OPCODE_SKIP_NOT_PRESSED:
+			EMIT(jit, 0x0F, 0xB6, 0x83); // movzx eax, byte [rbx + disp32]
+			emit_u32(jit, OFFSET_V(x));
+			EMIT(jit, 0x83, 0xE0, 0x0F); // and eax, 0xF
+			EMIT(jit, 0x80, 0xBC, 0x03); // cmp byte [rbx + rax + keyboard], imm8
+			emit_u32(jit, OFFSET_KEYBOARD);
+			emit_u8(jit, 0);
+			emit_skip(jit, address, decoded->opcode == OPCODE_SKIP_PRESSED ? JCC_NOT_EQUAL : JCC_EQUAL);
+			return true;
+
+		case OPCODE_RETURN_SUBROUTINE:
+		case OPCODE_JUMP_WITH_OFFSET:
+		case OPCODE_WAIT_FOR_KEY:
+			// The next PC is only known at runtime
+			emit_call_handler(jit, address, decoded->instruction, decoded->function);
+			emit_jump_to_exit(jit);
+			return true;
+
+		case OPCODE_DECIMAL_DECODE:
+		case OPCODE_SAVE_REGISTERS:
+			// May rewrite code, let the dispatcher check the code generation
+			emit_call_handler(jit, address, decoded->instruction, decoded->function);
+			emit_jump_to_exit(jit);
+			return true;
+
+		/* Registers and arithmetic */
+
+		case OPCODE_SET_REGISTER_TO_IMMEDIATE:
+			EMIT(jit, 0xC6, 0x83); // mov byte [rbx + disp32], imm8
+			emit_u32(jit, OFFSET_V(x));
+			emit_u8(jit, decoded->nn);
+			return false;
+
+		case OPCODE_ADD_IMMEDIATE_TO_REGISTER:
+			EMIT(jit, 0x80, 0x83); // add byte [rbx + disp32], imm8
+			emit_u32(jit, OFFSET_V(x));
+			emit_u8(jit, decoded->nn);
+			return false;
+
+		case OPCODE_COPY_REGISTER:
+			emit_load_al(jit, OFFSET_V(y));
+			emit_store_al(jit, OFFSET_V(x));
+			return false;
+
+		case OPCODE_BITWISE_OR:
+		case OPCODE_BITWISE_AND:
+		case OPCODE_BITWISE_XOR: {
+			uint8_t alu_opcode = decoded->opcode == OPCODE_BITWISE_OR ? 0x0A
+				: decoded->opcode == OPCODE_BITWISE_AND ? 0x22 : 0x32;
+			emit_load_al(jit, OFFSET_V(x));
+			emit_alu_al(jit, alu_opcode, OFFSET_V(y)); // or/and/xor al, [rbx + disp32]
+			emit_store_al(jit, OFFSET_V(x));
+			return false;
+		}
+
+		case OPCODE_ADD_REGISTER_TO_REGISTER:
+			emit_load_al(jit, OFFSET_V(x));
+			emit_alu_al(jit, 0x02, OFFSET_V(y)); // add al, [rbx + disp32]
+			EMIT(jit, 0x0F, 0x92, 0xC2); // setc dl
+			emit_store_dl(jit, OFFSET_VF);
+			emit_store_al(jit, OFFSET_V(x));
+			return false;
+
+		case OPCODE_SUB_REGISTER_FROM_REGISTER:
+		case OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER: {
+			bool negative = decoded->opcode == OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER;
+			emit_load_al(jit, OFFSET_V(negative ? y : x));
+			emit_load_cl(jit, OFFSET_V(negative ? x : y));
+			EMIT(jit, 0x38, 0xC8); // cmp al, cl
+			EMIT(jit, 0x0F, 0x97, 0xC2); // seta dl
+			EMIT(jit, 0x28, 0xC8); // sub al, cl
+			emit_store_dl(jit, OFFSET_VF);
+			emit_store_al(jit, OFFSET_V(x));
+			return false;
+		}
+
+		case OPCODE_SHIFT_RIGHT:
+		case OPCODE_SHIFT_LEFT:
+			emit_load_al(jit, OFFSET_V(quirks->use_extra_register_on_shift ? y : x));
+			EMIT(jit, 0x88, 0xC2); // mov dl, al
+			if (decoded->opcode == OPCODE_SHIFT_RIGHT) {
+				EMIT(jit, 0x80, 0xE2, 0x01); // and dl, 1
+				EMIT(jit, 0xD0, 0xE8); // shr al, 1
+			} else {
+				EMIT(jit, 0xC0, 0xEA, 0x07); // shr dl, 7
+				EMIT(jit, 0xD0, 0xE0); // shl al, 1
+			}
+			emit_store_dl(jit, OFFSET_VF);
+			emit_store_al(jit, OFFSET_V(x));
+			return false;
+
+		case OPCODE_SET_INDEX_REGISTER:
+			EMIT(jit, 0x66, 0xC7, 0x83); // mov word [rbx + disp32], imm16
+			emit_u32(jit, OFFSET_I);
+			emit_u16(jit, decoded->nnn);
+			return false;
+
+		case OPCODE_ADD_TO_INDEX:
+			EMIT(jit, 0x0F, 0xB7, 0x83); // movzx eax, word [rbx + disp32]
+			emit_u32(jit, OFFSET_I);
+			EMIT(jit, 0x0F, 0xB6, 0x8B); // movzx ecx, byte [rbx + disp32]
+			emit_u32(jit, OFFSET_V(x));
+			EMIT(jit, 0x01, 0xC8); // add eax, ecx
+			if (quirks->overflow_on_add_to_index) {
+				EMIT(jit, 0xA9); // test eax, imm32
+				emit_u32(jit, (uint16_t) ~ADDRESS_BITMASK);
+				EMIT(jit, 0x0F, 0x95, 0xC2); // setnz dl
+				emit_store_dl(jit, OFFSET_VF);
+			}
+			EMIT(jit, 0x25); // and eax, imm32
+			emit_u32(jit, ADDRESS_BITMASK);
+			EMIT(jit, 0x66, 0x89, 0x83); // mov [rbx + disp32], ax
+			emit_u32(jit, OFFSET_I);
+			return false;
+
+		case OPCODE_POINT_TO_CHAR:
+			EMIT(jit, 0x0F, 0xB6, 0x83); // movzx eax, byte [rbx + disp32]
+			emit_u32(jit, OFFSET_V(x));
+			EMIT(jit, 0x83, 0xE0, 0x0F); // and eax, 0xF
+			EMIT(jit, 0x6B, 0xC0, CHARACTER_HEIGHT); // imul eax, eax, imm8
+			EMIT(jit, 0x05); // add eax, imm32
+			emit_u32(jit, FONT_ADDRESS_START);
+			EMIT(jit, 0x25); // and eax, imm32
+			emit_u32(jit, ADDRESS_BITMASK);
+			EMIT(jit, 0x66, 0x89, 0x83); // mov [rbx + disp32], ax
+			emit_u32(jit, OFFSET_I);
+			return false;
+
+		case OPCODE_LOAD_REGISTERS:
+			EMIT(jit, 0x0F, 0xB7, 0x83); // movzx eax, word [rbx + disp32]
+			emit_u32(jit, OFFSET_I);
+			for (uint8_t i = 0; i <= x; ++i) {
+				EMIT(jit, 0x8D, 0x48, i); // lea ecx, [rax + imm8]
+				EMIT(jit, 0x81, 0xE1); // and ecx, imm32
+				emit_u32(jit, ADDRESS_BITMASK);
+				EMIT(jit, 0x8A, 0x94, 0x0B); // mov dl, [rbx + rcx + memory]
+				emit_u32(jit, OFFSET_MEMORY);
+				emit_store_dl(jit, OFFSET_V(i));
+			}
+			if (quirks->index_increment_on_dump_and_load != INDEX_UNCHANGED) {
+				uint8_t increment = quirks->index_increment_on_dump_and_load == INDEX_INCREMENT_BY_X ? x : x + 1;
+				EMIT(jit, 0x83, 0xC0, increment); // add eax, imm8
+				EMIT(jit, 0x25); // and eax, imm32
+				emit_u32(jit, ADDRESS_BITMASK);
+				EMIT(jit, 0x66, 0x89, 0x83); // mov [rbx + disp32], ax
+				emit_u32(jit, OFFSET_I);
+			}
+			return false;
+
+		/* Everything else goes through its handler */
+
+		default:
+			emit_call_handler(jit, address, decoded->instruction, decoded->function);
+			return false;
+	}
+}
+
+uint8_t *compile_block(JitContext *jit, CpuState *cpu_state, uint16_t start) {
+	if (jit->code_used + JIT_MAX_BLOCK_BYTES > JIT_CODE_SIZE) {
+		jit_flush(jit);
+	}
+
+	DecodedInstruction *decoded = decode_cached(cpu_state, start);
+	if (decoded->opcode == OPCODE_INVALID) {
+		return NULL;
+	}
+
+	uint8_t *block = jit->code + jit->code_used;
+
+	// Budget check, the length is patched once the block is complete
+	EMIT(jit, 0x49, 0x81, 0xFC); // cmp r12, imm32
+	size_t length_offset = jit->code_used;
+	emit_u32(jit, 0);
+	EMIT(jit, 0x0F, 0x8C); // jl rel32
+	emit_rel32(jit, jit->exit_stub);
+	EMIT(jit, 0x49, 0x81, 0xEC); // sub r12, imm32
+	size_t length_offset_sub = jit->code_used;
+	emit_u32(jit, 0);
+
+	uint16_t address = start;
+	uint32_t length = 0;
+	for (;;) {
+		++length;
+		if (emit_instruction(jit, address, decoded)) {
+			break;
+		}
+
+		address += INSTRUCTION_SIZE;
+		if (length == JIT_MAX_BLOCK_INSTRUCTIONS || address > MEMORY_SIZE - INSTRUCTION_SIZE) {
+			emit_chain(jit, address);
+			break;
+		}
+		decoded = decode_cached(cpu_state, address);
+		if (decoded->opcode == OPCODE_INVALID) {
+			// Let the interpreter report it
+			emit_chain(jit, address);
+			break;
+		}
+	}
+
+	memcpy(jit->code + length_offset, &length, sizeof(length));
+	memcpy(jit->code + length_offset_sub, &length, sizeof(length));
+	jit->blocks[start] = block;
+	jit->block_lengths[start] = length;
+
+	// Link the blocks that were waiting for this one
+	for (size_t i = 0; i < jit->chain_sites_used;) {
+		JitChainSite *site = &jit->chain_sites[i];
+		if (site->target == start) {
+			patch_rel32(jit, site->rel32_offset, block);
+			*site = jit->chain_sites[--jit->chain_sites_used];
+		} else {
+			++i;
+		}
+	}
+
+	return block;
+}
+
+bool jit_init(JitContext *jit) {
+#if defined(_WIN32)
+	jit->code = VirtualAlloc(NULL, JIT_CODE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
+	if (jit->code == NULL) {
+		return false;
+	}
+#else
+	void *code = mmap(
+		NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+	);
+	if (code == MAP_FAILED) {
+		jit->code = NULL;
+		return false;
+	}
+	jit->code = code;
+#endif
+
+	emit_stubs(jit);
+	jit_flush(jit);
+	jit->cpu_state = NULL;
+	jit->code_generation = 0;
+	return true;
+}
+
+void jit_destroy(JitContext *jit) {
+	if (jit->code == NULL) {
+		return;
+	}
+#if defined(_WIN32)
+	VirtualFree(jit->code, 0, MEM_RELEASE);
+#else
+	munmap(jit->code, JIT_CODE_SIZE);
+#endif
+	jit->code = NULL;
+}
+
+void jit_flush(JitContext *jit) {
+	jit->code_used = jit->stubs_size;
+	memset(jit->blocks, 0, sizeof(jit->blocks));
+	memset(jit->block_lengths, 0, sizeof(jit->block_lengths));
+	jit->chain_sites_used = 0;
+}
+
+void jit_run_batch(JitContext *jit, CpuState *cpu_state, uint32_t count) {
+	int64_t remaining = count;
+
+	while (remaining > 0) {
+		if (jit->cpu_state != cpu_state || jit->code_generation != cpu_state->code_generation) {
+			jit_flush(jit);
+			jit->cpu_state = cpu_state;
+			jit->code_generation = cpu_state->code_generation;
+		}
+
+		uint16_t pc = read_register_pc(cpu_state);
+		uint8_t *block = NULL;
+		if (pc <= MEMORY_SIZE - INSTRUCTION_SIZE) {
+			block = jit->blocks[pc];
+			if (block == NULL) {
+				block = compile_block(jit, cpu_state, pc);
+			}
+		}
+
+		if (block == NULL || jit->block_lengths[pc] > remaining) {
+			// Not worth (or not possible) to enter native code, step with the interpreter
+			DecodedInstruction *decoded = fetch_decoded(cpu_state);
+			execute(cpu_state, decoded->instruction, decoded->function);
+			--remaining;
+			continue;
+		}
+
+		remaining = jit->enter(cpu_state, block, remaining);
+	}
+}
+
+uint32_t jit_run(JitContext *jit, CpuState *cpu_state, uint32_t count) {
+	uint32_t executed = 0;
+	while (executed < count) {
+		// Stop at every virtual timer tick
+		uint32_t batch = cycles_until_timer_tick(cpu_state, count - executed);
+		jit_run_batch(jit, cpu_state, batch);
+		advance_cycles(cpu_state, batch);
+		executed += batch;
+	}
+	return count;
+}
+
+#else
+
+bool jit_init(JitContext *jit) {
+	jit->code = NULL;
+	return false;
+}
+
+void jit_destroy(__attribute__((unused)) JitContext *jit) {
+
+}
+
+void jit_flush(__attribute__((unused)) JitContext *jit) {
+
+}
+
+uint32_t jit_run(__attribute__((unused)) JitContext *jit, CpuState *cpu_state, uint32_t count) {
+	return run_instructions(cpu_state, count);
+}
+
+#endif
@@ -17,4 +17,58 @@ bool any_key_pressed(CpuState *cpu_state, uint8_t *pressed_key) {
 	}
 
 	return false;
-}
\ No newline at end of file
+}
+
+/*
+ * The keyboard as a bitmask, bit K set if the key K is pressed.
+ */
+uint16_t read_keyboard_mask(CpuState *cpu_state) {
+	uint16_t mask = 0;
+	for (uint8_t key = 0; key < NUMBER_OF_KEYS; ++key) {
+		if (is_key_pressed(cpu_state, key)) {
+			mask |= 1 << key;
+		}
+	}
+	return mask;
+}
+
+void write_keyboard_mask(CpuState *cpu_state, uint16_t mask) {
+	for (uint8_t key = 0; key < NUMBER_OF_KEYS; ++key) {
+		set_key_pressed(cpu_state, key, (mask >> key) & 1);
+	}
+}
+
+/*
+ * Checks whether the key wait of FX0A is over, starting it if the CPU wasn't waiting yet, and stores the key in key.
+ * If wait_for_release, a key must be pressed during the wait and then released, otherwise any pressed key will do.
+ * The CPU is left halted, waiting for a key, until it returns true.
+ */
+bool poll_key_wait(CpuState *cpu_state, bool wait_for_release, uint8_t *key) {
+	if (!cpu_state->waiting_for_key) {
+		cpu_state->waiting_for_key = true;
+		cpu_state->key_wait_pressed = 0;
+	}
+
+	bool done;
+	if (wait_for_release) {
+		uint16_t pressed = read_keyboard_mask(cpu_state);
+		uint16_t released = cpu_state->key_wait_pressed & ~pressed;
+		done = released != 0;
+		if (done) {
+			*key = __builtin_ctz(released);
+		}
+		cpu_state->key_wait_pressed |= pressed;
+	} else {
+		done = any_key_pressed(cpu_state, key);
+	}
+
+	if (done) {
+		cpu_state->waiting_for_key = false;
+		cpu_state->key_wait_pressed = 0;
+	}
+	return done;
+}
+
+bool is_waiting_for_key(CpuState *cpu_state) {
+	return cpu_state->waiting_for_key;
+}
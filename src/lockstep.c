@@ -0,0 +1,434 @@
+#include "lockstep.h"
+#include "cpu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOCKSTEP_AVX2 1
+#include <immintrin.h>
+#else
+#define LOCKSTEP_AVX2 0
+#endif
+
+/*
+ * Copies the lane's registers from the batch into its CpuState.
+ */
+void gather_lockstep_lane(LockstepBatch *batch, uint32_t lane) {
+	CpuState *cpu_state = batch->cpu_states[lane];
+
+	for (uint8_t r = 0; r < REGISTERS; ++r) {
+		cpu_state->register_bank[r] = batch->registers[r][lane];
+	}
+	cpu_state->program_counter = batch->program_counters[lane];
+	cpu_state->index_register = batch->index_registers[lane];
+	cpu_state->delay_timer.set_ts_millis = 0;
+	cpu_state->delay_timer.set_value = batch->delay_timers[lane];
+	cpu_state->sound_timer.set_ts_millis = 0;
+	cpu_state->sound_timer.set_value = batch->sound_timers[lane];
+	cpu_state->cycles = batch->cycles[lane];
+	cpu_state->cycles_until_tick = batch->cycles_until_tick[lane];
+}
+
+/*
+ * Copies the lane's registers from its CpuState into the batch.
+ */
+void scatter_lockstep_lane(LockstepBatch *batch, uint32_t lane) {
+	CpuState *cpu_state = batch->cpu_states[lane];
+
+	for (uint8_t r = 0; r < REGISTERS; ++r) {
+		batch->registers[r][lane] = cpu_state->register_bank[r];
+	}
+	batch->program_counters[lane] = cpu_state->program_counter;
+	batch->index_registers[lane] = cpu_state->index_register;
+	batch->delay_timers[lane] = cpu_state->delay_timer.set_value;
+	batch->sound_timers[lane] = cpu_state->sound_timer.set_value;
+	batch->cycles[lane] = cpu_state->cycles;
+	batch->cycles_until_tick[lane] = cpu_state->cycles_until_tick;
+}
+
+/*
+ * Loads the given states into the lanes of a batch.
+ * Fails if there are too many lanes, or if they don't share the same virtual timers and quirk profile.
+ */
+bool init_lockstep_batch(LockstepBatch *batch, CpuState *const *cpu_states, uint32_t lanes) {
+	if (lanes == 0 || lanes > LOCKSTEP_MAX_LANES) {
+		return false;
+	}
+	for (uint32_t lane = 0; lane < lanes; ++lane) {
+		if (!has_virtual_timers(cpu_states[lane]) || cpu_states[lane]->cycles_per_tick != cpu_states[0]->cycles_per_tick) {
+			return false;
+		}
+		if (cpu_states[lane]->quirk_profile != cpu_states[0]->quirk_profile) {
+			return false;
+		}
+	}
+
+	memset(batch, 0, sizeof(LockstepBatch));
+	batch->lanes = lanes;
+	batch->cycles_per_tick = cpu_states[0]->cycles_per_tick;
+	batch->shift_uses_extra_register = QUIRK_PROFILE_SETTINGS[cpu_states[0]->quirk_profile].use_extra_register_on_shift;
+	for (uint32_t lane = 0; lane < lanes; ++lane) {
+		batch->cpu_states[lane] = cpu_states[lane];
+		scatter_lockstep_lane(batch, lane);
+	}
+
+#if LOCKSTEP_AVX2
+	// Stats are only counted on the scalar path
+	batch->use_avx2 = !CHIP8_STATS && !CHIP8_PROFILE && __builtin_cpu_supports("avx2");
+#else
+	batch->use_avx2 = false;
+#endif
+	return true;
+}
+
+/*
+ * Writes the registers of every lane back into their CpuState.
+ */
+void sync_lockstep_batch(LockstepBatch *batch) {
+	for (uint32_t lane = 0; lane < batch->lanes; ++lane) {
+		gather_lockstep_lane(batch, lane);
+	}
+}
+
+void run_lockstep_lane(LockstepBatch *batch, uint32_t lane) {
+	CpuState *cpu_state = batch->cpu_states[lane];
+
+	gather_lockstep_lane(batch, lane);
+	DecodedInstruction *decoded = fetch_decoded(cpu_state);
+	execute(cpu_state, decoded->instruction, decoded->function);
+	scatter_lockstep_lane(batch, lane);
+}
+
+#if LOCKSTEP_AVX2
+
+/*
+ * Turns a bitmask of lanes into a vector with 0xFF on the bytes of those lanes.
+ */
+__attribute__((target("avx2")))
+__m256i expand_lockstep_mask(uint32_t lanes) {
+	// Byte N of the lane mask is copied to bytes 8N to 8N+7, then each one keeps its own bit
+	const __m256i spread = _mm256_setr_epi64x(
+		0x0000000000000000, 0x0101010101010101, 0x0202020202020202, 0x0303030303030303
+	);
+	const __m256i bits = _mm256_set1_epi64x((int64_t) 0x8040201008040201);
+	__m256i mask = _mm256_shuffle_epi8(_mm256_set1_epi32((int) lanes), spread);
+	return _mm256_cmpeq_epi8(_mm256_and_si256(mask, bits), bits);
+}
+
+__attribute__((target("avx2")))
+__m256i read_lockstep_register(LockstepBatch *batch, uint8_t r) {
+	return _mm256_load_si256((const __m256i *) batch->registers[r]);
+}
+
+__attribute__((target("avx2")))
+void write_lockstep_bytes(uint8_t *bytes, __m256i value, __m256i mask) {
+	__m256i old = _mm256_load_si256((const __m256i *) bytes);
+	_mm256_store_si256((__m256i *) bytes, _mm256_blendv_epi8(old, value, mask));
+}
+
+/*
+ * Sets the 16-bit values of the lanes in mask.
+ */
+__attribute__((target("avx2")))
+void write_lockstep_words(uint16_t *words, uint16_t value, __m256i mask) {
+	__m256i low_mask = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask));
+	__m256i high_mask = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1));
+	__m256i values = _mm256_set1_epi16((short) value);
+	__m256i *low = (__m256i *) words;
+	__m256i *high = (__m256i *) (words + 16);
+	_mm256_store_si256(low, _mm256_blendv_epi8(_mm256_load_si256(low), values, low_mask));
+	_mm256_store_si256(high, _mm256_blendv_epi8(_mm256_load_si256(high), values, high_mask));
+}
+
+/*
+ * Moves the PC of the lanes in mask past the instruction, and past the next one too for the lanes in skip.
+ */
+__attribute__((target("avx2")))
+void advance_lockstep_program_counters(LockstepBatch *batch, __m256i mask, __m256i skip) {
+	const __m256i instruction_size = _mm256_set1_epi8(INSTRUCTION_SIZE);
+	__m256i step = _mm256_add_epi8(
+		_mm256_and_si256(mask, instruction_size),
+		_mm256_and_si256(_mm256_and_si256(mask, skip), instruction_size)
+	);
+	__m256i *low = (__m256i *) batch->program_counters;
+	__m256i *high = (__m256i *) (batch->program_counters + 16);
+	_mm256_store_si256(low, _mm256_add_epi16(_mm256_load_si256(low), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(step))));
+	_mm256_store_si256(high, _mm256_add_epi16(_mm256_load_si256(high), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(step, 1))));
+}
+
+/*
+ * Runs a decoded instruction on all the lanes in the group at once, with the same semantics as its handler.
+ * Returns false, without running anything, for the instructions that have no vector kernel.
+ */
+__attribute__((target("avx2")))
+bool run_lockstep_vector(LockstepBatch *batch, DecodedInstruction *decoded, uint32_t group) {
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i all = _mm256_set1_epi8(-1);
+	__m256i mask = expand_lockstep_mask(group);
+	__m256i vx = read_lockstep_register(batch, decoded->x);
+	__m256i vy = read_lockstep_register(batch, decoded->y);
+	__m256i skip = _mm256_setzero_si256();
+	__m256i value;
+	__m256i flag;
+
+	switch (decoded->opcode) {
+		case OPCODE_JUMP:
+			write_lockstep_words(batch->program_counters, decoded->nnn, mask);
+			return true;
+		case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+			skip = _mm256_cmpeq_epi8(vx, _mm256_set1_epi8((char) decoded->nn));
+			break;
+		case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+			skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, _mm256_set1_epi8((char) decoded->nn)), all);
+			break;
+		case OPCODE_SKIP_IF_REGISTERS_EQUAL:
+			skip = _mm256_cmpeq_epi8(vx, vy);
+			break;
+		case OPCODE_SKIP_IF_REGISTERS_DIFFERENT:
+			skip = _mm256_xor_si256(_mm256_cmpeq_epi8(vx, vy), all);
+			break;
+		case OPCODE_SET_REGISTER_TO_IMMEDIATE:
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_set1_epi8((char) decoded->nn), mask);
+			break;
+		case OPCODE_ADD_IMMEDIATE_TO_REGISTER:
+			value = _mm256_add_epi8(vx, _mm256_set1_epi8((char) decoded->nn));
+			write_lockstep_bytes(batch->registers[decoded->x], value, mask);
+			break;
+		case OPCODE_COPY_REGISTER:
+			write_lockstep_bytes(batch->registers[decoded->x], vy, mask);
+			break;
+		case OPCODE_BITWISE_OR:
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_or_si256(vx, vy), mask);
+			break;
+		case OPCODE_BITWISE_AND:
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_and_si256(vx, vy), mask);
+			break;
+		case OPCODE_BITWISE_XOR:
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_xor_si256(vx, vy), mask);
+			break;
+		case OPCODE_ADD_REGISTER_TO_REGISTER:
+			// The sum wrapped around if it ended up below VX
+			value = _mm256_add_epi8(vx, vy);
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(value, vx), value), one);
+			// Flag first, so a result in VF overwrites it like in the handler
+			write_lockstep_bytes(batch->registers[STATUS_REGISTER], flag, mask);
+			write_lockstep_bytes(batch->registers[decoded->x], value, mask);
+			break;
+		case OPCODE_SUB_REGISTER_FROM_REGISTER:
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(vx, vy), _mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vx));
+			write_lockstep_bytes(batch->registers[STATUS_REGISTER], _mm256_and_si256(flag, one), mask);
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_sub_epi8(vx, vy), mask);
+			break;
+		case OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER:
+			flag = _mm256_andnot_si256(_mm256_cmpeq_epi8(vx, vy), _mm256_cmpeq_epi8(_mm256_max_epu8(vx, vy), vy));
+			write_lockstep_bytes(batch->registers[STATUS_REGISTER], _mm256_and_si256(flag, one), mask);
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_sub_epi8(vy, vx), mask);
+			break;
+		case OPCODE_SHIFT_RIGHT:
+			value = batch->shift_uses_extra_register ? vy : vx;
+			write_lockstep_bytes(batch->registers[STATUS_REGISTER], _mm256_and_si256(value, one), mask);
+			// There are no 8-bit shifts, so shift 16-bit lanes and drop the bit coming from the neighbour byte
+			value = _mm256_and_si256(_mm256_srli_epi16(value, 1), _mm256_set1_epi8(0x7F));
+			write_lockstep_bytes(batch->registers[decoded->x], value, mask);
+			break;
+		case OPCODE_SHIFT_LEFT:
+			value = batch->shift_uses_extra_register ? vy : vx;
+			flag = _mm256_and_si256(_mm256_srli_epi16(value, 7), one);
+			write_lockstep_bytes(batch->registers[STATUS_REGISTER], flag, mask);
+			write_lockstep_bytes(batch->registers[decoded->x], _mm256_add_epi8(value, value), mask);
+			break;
+		case OPCODE_SET_INDEX_REGISTER:
+			write_lockstep_words(batch->index_registers, decoded->nnn, mask);
+			break;
+		case OPCODE_READ_DELAY:
+			value = _mm256_load_si256((const __m256i *) batch->delay_timers);
+			write_lockstep_bytes(batch->registers[decoded->x], value, mask);
+			break;
+		case OPCODE_SET_DELAY:
+			write_lockstep_bytes(batch->delay_timers, vx, mask);
+			break;
+		case OPCODE_SET_SOUND:
+			write_lockstep_bytes(batch->sound_timers, vx, mask);
+			break;
+		default:
+			return false;
+	}
+
+	advance_lockstep_program_counters(batch, mask, skip);
+	return true;
+}
+
+/*
+ * Finds the lowest PC among the active lanes, and returns every active lane at that PC.
+ */
+__attribute__((target("avx2")))
+uint32_t find_lockstep_group_avx2(LockstepBatch *batch, uint32_t active, uint16_t *pc) {
+	__m256i mask = expand_lockstep_mask(active);
+	__m256i low_mask = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(mask));
+	__m256i high_mask = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(mask, 1));
+	__m256i low = _mm256_load_si256((const __m256i *) batch->program_counters);
+	__m256i high = _mm256_load_si256((const __m256i *) (batch->program_counters + 16));
+
+	// Inactive lanes are left at the highest PC so they never win
+	const __m256i none = _mm256_set1_epi16(-1);
+	__m256i lowest = _mm256_min_epu16(_mm256_blendv_epi8(none, low, low_mask), _mm256_blendv_epi8(none, high, high_mask));
+	__m128i lowest_half = _mm_min_epu16(_mm256_castsi256_si128(lowest), _mm256_extracti128_si256(lowest, 1));
+	*pc = _mm_cvtsi128_si32(_mm_minpos_epu16(lowest_half)) & 0xFFFF;
+
+	__m256i target = _mm256_set1_epi16((short) *pc);
+	__m256i equal = _mm256_packs_epi16(_mm256_cmpeq_epi16(low, target), _mm256_cmpeq_epi16(high, target));
+	// Packing interleaves both inputs in 64-bit blocks, put the lanes back in order
+	equal = _mm256_permute4x64_epi64(equal, 0xD8);
+	return (uint32_t) _mm256_movemask_epi8(equal) & active;
+}
+
+/*
+ * Decrements the 32-bit counters of the lanes in group, returning the lanes whose counter reached 0.
+ */
+__attribute__((target("avx2")))
+uint32_t count_down_lockstep_lanes_avx2(uint32_t *counters, uint32_t group) {
+	const __m256i bits = _mm256_setr_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+	uint32_t zero_lanes = 0;
+	for (int block = 0; block < LOCKSTEP_MAX_LANES / 8; ++block) {
+		__m256i selected = _mm256_and_si256(_mm256_set1_epi32((int) (group >> (8 * block))), bits);
+		__m256i mask = _mm256_cmpeq_epi32(selected, bits);
+		__m256i *counter = (__m256i *) (counters + 8 * block);
+		__m256i value = _mm256_add_epi32(_mm256_load_si256(counter), mask);
+		_mm256_store_si256(counter, value);
+
+		__m256i zero = _mm256_and_si256(_mm256_cmpeq_epi32(value, _mm256_setzero_si256()), mask);
+		zero_lanes |= (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(zero)) << (8 * block);
+	}
+	return zero_lanes;
+}
+
+#else
+
+bool run_lockstep_vector(
+	__attribute__((unused)) LockstepBatch *batch,
+	__attribute__((unused)) DecodedInstruction *decoded,
+	__attribute__((unused)) uint32_t group
+) {
+	return false;
+}
+
+uint32_t find_lockstep_group_avx2(
+	__attribute__((unused)) LockstepBatch *batch,
+	__attribute__((unused)) uint32_t active,
+	__attribute__((unused)) uint16_t *pc
+) {
+	return 0;
+}
+
+uint32_t count_down_lockstep_lanes_avx2(__attribute__((unused)) uint32_t *counters, __attribute__((unused)) uint32_t group) {
+	return 0;
+}
+
+#endif
+
+uint32_t find_lockstep_group(LockstepBatch *batch, uint32_t active, uint16_t *pc) {
+	if (batch->use_avx2) {
+		return find_lockstep_group_avx2(batch, active, pc);
+	}
+
+	*pc = 0xFFFF;
+	for (uint32_t lanes = active; lanes != 0; lanes &= lanes - 1) {
+		uint32_t lane = __builtin_ctz(lanes);
+		if (batch->program_counters[lane] < *pc) {
+			*pc = batch->program_counters[lane];
+		}
+	}
+
+	uint32_t group = 0;
+	for (uint32_t lanes = active; lanes != 0; lanes &= lanes - 1) {
+		uint32_t lane = __builtin_ctz(lanes);
+		if (batch->program_counters[lane] == *pc) {
+			group |= 1u << lane;
+		}
+	}
+	return group;
+}
+
+uint32_t count_down_lockstep_lanes(LockstepBatch *batch, uint32_t *counters, uint32_t group) {
+	if (batch->use_avx2) {
+		return count_down_lockstep_lanes_avx2(counters, group);
+	}
+
+	uint32_t zero_lanes = 0;
+	for (uint32_t lanes = group; lanes != 0; lanes &= lanes - 1) {
+		uint32_t lane = __builtin_ctz(lanes);
+		if (--counters[lane] == 0) {
+			zero_lanes |= 1u << lane;
+		}
+	}
+	return zero_lanes;
+}
+
+/*
+ * Ticks the timers of the lanes whose countdown to the next tick ran out.
+ */
+void tick_lockstep_timers(LockstepBatch *batch, uint32_t lanes) {
+	for (; lanes != 0; lanes &= lanes - 1) {
+		uint32_t lane = __builtin_ctz(lanes);
+		batch->cycles_until_tick[lane] = batch->cycles_per_tick;
+		if (batch->delay_timers[lane] > 0) {
+			--batch->delay_timers[lane];
+		}
+		if (batch->sound_timers[lane] > 0) {
+			--batch->sound_timers[lane];
+		}
+	}
+}
+
+/*
+ * Runs count instructions on every lane.
+ * Each step picks the lanes at the lowest PC that have the same instruction there, so lanes that fell behind after
+ * diverging get to catch up, and then run together again once they reach the same PC.
+ */
+void run_lockstep(LockstepBatch *batch, uint32_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	uint32_t remaining[LOCKSTEP_MAX_LANES] __attribute__((aligned(32)));
+	for (uint32_t lane = 0; lane < LOCKSTEP_MAX_LANES; ++lane) {
+		remaining[lane] = count;
+	}
+	uint32_t active = batch->lanes == 32 ? 0xFFFFFFFF : (1u << batch->lanes) - 1;
+
+	while (active != 0) {
+		uint16_t pc;
+		uint32_t group = find_lockstep_group(batch, active, &pc);
+
+		// Lanes can only run together if they have the same instruction at the PC
+		uint32_t lead = __builtin_ctz(group);
+		const uint8_t *lead_memory = batch->cpu_states[lead]->memory;
+		if (pc >= ADDRESS_BITMASK) {
+			// The instruction doesn't fit in the memory, each lane reads it on its own
+			group = 1u << lead;
+		}
+		for (uint32_t lanes = group & (group - 1); lanes != 0; lanes &= lanes - 1) {
+			uint32_t lane = __builtin_ctz(lanes);
+			const uint8_t *memory = batch->cpu_states[lane]->memory;
+			if (memory[pc] != lead_memory[pc] || memory[pc + 1] != lead_memory[pc + 1]) {
+				group &= ~(1u << lane);
+			}
+		}
+
+		uint32_t group_size = __builtin_popcount(group);
+		DecodedInstruction *decoded = decode_cached(batch->cpu_states[lead], pc);
+		if (batch->use_avx2 && group_size > 1 && run_lockstep_vector(batch, decoded, group)) {
+			batch->vector_instructions += group_size;
+		} else {
+			for (uint32_t lanes = group; lanes != 0; lanes &= lanes - 1) {
+				run_lockstep_lane(batch, __builtin_ctz(lanes));
+			}
+			batch->scalar_instructions += group_size;
+		}
+
+		tick_lockstep_timers(batch, count_down_lockstep_lanes(batch, batch->cycles_until_tick, group));
+		active &= ~count_down_lockstep_lanes(batch, remaining, group);
+	}
+
+	for (uint32_t lane = 0; lane < batch->lanes; ++lane) {
+		batch->cycles[lane] += count;
+	}
+}
@@ -8,12 +8,22 @@ uint16_t read_word_memory(CpuState *cpu_state, uint16_t address) {
 	return read_word_from_array(cpu_state->memory, address);
 }
 
+void mark_memory_page_dirty(CpuState *cpu_state, uint16_t address) {
+	cpu_state->dirty_pages |= (uint64_t) 1 << ((address & ADDRESS_BITMASK) / MEMORY_PAGE_SIZE);
+}
+
 void write_byte_memory(CpuState *cpu_state, uint16_t address, uint8_t value) {
 	cpu_state->memory[address] = value;
+	invalidate_decoded_instruction(cpu_state, address);
+	mark_memory_page_dirty(cpu_state, address);
 }
 
 void write_word_memory(CpuState *cpu_state, uint16_t address, uint16_t word) {
 	write_word_to_array(cpu_state->memory, address, word);
+	invalidate_decoded_instruction(cpu_state, address);
+	invalidate_decoded_instruction(cpu_state, address + 1);
+	mark_memory_page_dirty(cpu_state, address);
+	mark_memory_page_dirty(cpu_state, address + 1);
 }
 
 uint16_t character_address(uint8_t c) {
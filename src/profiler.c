@@ -0,0 +1,391 @@
+#include "profiler.h"
+
+#if CHIP8_PROFILE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "debug.h"
+#include "registers.h"
+#include "memory.h"
+#include "instructions.h"
+
+// Darkest to brightest, a cell's character is picked on a log scale of its cycles
+#define HEATMAP_RAMP " .:-=+*#%@"
+
+AddressProfile address_profile;
+
+CallGraphProfile call_graph_profile;
+
+/*
+ * Host time stamp counter where available, nanoseconds otherwise.
+ */
+uint64_t read_profile_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+/*
+ * Installed before main, so every executable built with the profiler writes its results without any setup.
+ */
+__attribute__((constructor)) void init_address_profile() {
+	atexit(dump_address_profile);
+}
+
+/*
+ * Node for the call to entry from parent, added if it's the first time the call is seen.
+ */
+uint32_t find_child_call_node(uint32_t parent, uint16_t entry) {
+	uint64_t key = ((uint64_t) parent << 16 | entry) + 1;
+	uint32_t slot = (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> 32) % PROFILE_CALL_NODES;
+
+	for (uint32_t probes = 0; probes < PROFILE_CALL_NODES; ++probes, slot = (slot + 1) % PROFILE_CALL_NODES) {
+		// The root has no key, its slot is never handed out
+		if (slot == PROFILE_ROOT_NODE) {
+			continue;
+		}
+		uint64_t found = __atomic_load_n(&call_graph_profile.keys[slot], __ATOMIC_RELAXED);
+		if (found == 0) {
+			// Another session could claim the slot first, for this call or for another one
+			uint64_t expected = 0;
+			if (__atomic_compare_exchange_n(
+				&call_graph_profile.keys[slot], &expected, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+			)) {
+				return slot;
+			}
+			found = expected;
+		}
+		if (found == key) {
+			return slot;
+		}
+	}
+	return parent;
+}
+
+uint32_t read_call_node_parent(uint32_t node) {
+	return (uint32_t) ((call_graph_profile.keys[node] - 1) >> 16);
+}
+
+uint16_t read_call_node_entry(uint32_t node) {
+	return (uint16_t) ((call_graph_profile.keys[node] - 1) & ADDRESS_BITMASK);
+}
+
+/*
+ * Node of the current call stack. The stack only holds return addresses, so the entry point of every frame is taken
+ * from the 2NNN just before its return address, or the call site itself if the ROM has overwritten it since.
+ */
+uint32_t find_call_node(CpuState *cpu_state) {
+	uint32_t node = PROFILE_ROOT_NODE;
+	uint8_t depth = cpu_state->stack_size < STACK_SIZE ? cpu_state->stack_size : STACK_SIZE;
+	for (uint8_t frame = 0; frame < depth; ++frame) {
+		uint16_t call_site = (cpu_state->stack[frame] - INSTRUCTION_SIZE) & ADDRESS_BITMASK;
+		uint16_t call = read_word_memory(cpu_state, call_site);
+		uint16_t entry = (call & 0xF000) == 0x2000 ? call & ADDRESS_BITMASK : call_site;
+		node = find_child_call_node(node, entry);
+	}
+	return node;
+}
+
+/*
+ * Accounts for the instruction at address, which has just been executed in the call stack of call_node and took cycles.
+ * FX0A rewinds the PC to its own address while no key is pressed, that is counted as a spin.
+ */
+void record_profile_sample(
+	CpuState *cpu_state, uint16_t address, DecodedInstruction *decoded, uint32_t call_node, uint64_t cycles
+) {
+	__atomic_fetch_add(&call_graph_profile.instructions[call_node], 1, __ATOMIC_RELAXED);
+	if (decoded->opcode == OPCODE_DRAW) {
+		__atomic_fetch_add(&call_graph_profile.draws[call_node], 1, __ATOMIC_RELAXED);
+	}
+
+	address %= MEMORY_SIZE;
+	__atomic_fetch_add(&address_profile.executions[address], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&address_profile.cycles[address], cycles, __ATOMIC_RELAXED);
+	address_profile.instructions[address] = decoded->instruction;
+	address_profile.opcodes[address] = decoded->opcode;
+
+	if (decoded->opcode == OPCODE_WAIT_FOR_KEY && read_register_pc(cpu_state) == address) {
+		__atomic_fetch_add(&address_profile.key_wait_spins[address], 1, __ATOMIC_RELAXED);
+	}
+}
+
+int compare_profiled_addresses(const void *a, const void *b) {
+	uint64_t cycles_a = address_profile.cycles[*(const uint16_t *) a];
+	uint64_t cycles_b = address_profile.cycles[*(const uint16_t *) b];
+	return (cycles_a < cycles_b) - (cycles_a > cycles_b);
+}
+
+/*
+ * Writes a line per executed address sorted by cycles, with the number of times FX0A waited on it.
+ */
+void write_profile_report(FILE *file_ptr) {
+	uint16_t addresses[MEMORY_SIZE];
+	size_t count = 0;
+	uint64_t total_executions = 0;
+	uint64_t total_cycles = 0;
+	for (uint16_t address = 0; address < MEMORY_SIZE; ++address) {
+		if (address_profile.executions[address] > 0) {
+			addresses[count++] = address;
+			total_executions += address_profile.executions[address];
+			total_cycles += address_profile.cycles[address];
+		}
+	}
+	qsort(addresses, count, sizeof(addresses[0]), compare_profiled_addresses);
+
+	fprintf(
+		file_ptr, "%llu instruction(s) at %zu address(es), %llu cycle(s)\n",
+		(unsigned long long) total_executions, count, (unsigned long long) total_cycles
+	);
+	fprintf(
+		file_ptr, "%-7s %16s %16s %8s %12s  %s\n", "address", "executions", "cycles", "share", "key waits", "instruction"
+	);
+	for (size_t i = 0; i < count; ++i) {
+		uint16_t address = addresses[i];
+		char disassembly[DISASSEMBLY_SIZE];
+		disassemble_instruction(
+			address_profile.opcodes[address], address_profile.instructions[address], disassembly, sizeof(disassembly)
+		);
+		fprintf(
+			file_ptr, "0x%03X   %16llu %16llu %7.2f%% %12llu  %04X %s\n",
+			address, (unsigned long long) address_profile.executions[address],
+			(unsigned long long) address_profile.cycles[address],
+			total_cycles > 0 ? 100.0 * address_profile.cycles[address] / total_cycles : 0.0,
+			(unsigned long long) address_profile.key_wait_spins[address], address_profile.instructions[address],
+			disassembly
+		);
+	}
+}
+
+/*
+ * Brightness of an address in 0..1, on a log scale relative to the hottest address.
+ */
+double read_heat(uint16_t address, uint64_t max_cycles) {
+	uint64_t cycles = address_profile.cycles[address];
+	if (cycles == 0 || max_cycles == 0) {
+		return 0;
+	}
+	// Bit lengths, a cheap log2 that keeps libm out of the core
+	return (double) (64 - __builtin_clzll(cycles)) / (64 - __builtin_clzll(max_cycles));
+}
+
+uint64_t read_max_profile_cycles() {
+	uint64_t max_cycles = 0;
+	for (uint16_t address = 0; address < MEMORY_SIZE; ++address) {
+		if (address_profile.cycles[address] > max_cycles) {
+			max_cycles = address_profile.cycles[address];
+		}
+	}
+	return max_cycles;
+}
+
+/*
+ * Text grid of the address space, a row per 64 bytes, prefixed by the address of its first byte.
+ */
+void write_profile_heatmap(FILE *file_ptr) {
+	const size_t levels = strlen(HEATMAP_RAMP) - 1;
+	uint64_t max_cycles = read_max_profile_cycles();
+
+	for (uint16_t row = 0; row < PROFILE_HEATMAP_SIDE; ++row) {
+		fprintf(file_ptr, "0x%03X |", row * PROFILE_HEATMAP_SIDE);
+		for (uint16_t column = 0; column < PROFILE_HEATMAP_SIDE; ++column) {
+			double heat = read_heat(row * PROFILE_HEATMAP_SIDE + column, max_cycles);
+			// Anything executed at all is visible
+			size_t level = heat > 0 ? 1 + (size_t) (heat * (levels - 1) + 0.5) : 0;
+			fputc(HEATMAP_RAMP[level], file_ptr);
+		}
+		fputs("|\n", file_ptr);
+	}
+}
+
+/*
+ * Same heatmap as a binary PGM image, a pixel per address.
+ */
+void write_profile_image(FILE *file_ptr) {
+	uint64_t max_cycles = read_max_profile_cycles();
+
+	fprintf(file_ptr, "P5\n%d %d\n255\n", PROFILE_HEATMAP_SIDE, PROFILE_HEATMAP_SIDE);
+	for (uint16_t address = 0; address < MEMORY_SIZE; ++address) {
+		fputc((int) (read_heat(address, max_cycles) * 255 + 0.5), file_ptr);
+	}
+}
+
+/*
+ * Writes the frames of node from the root, separated by semicolons.
+ */
+void write_call_stack(FILE *file_ptr, uint32_t node) {
+	uint32_t frames[STACK_SIZE + 1];
+	uint8_t depth = 0;
+	for (; node != PROFILE_ROOT_NODE && depth < STACK_SIZE; node = read_call_node_parent(node)) {
+		frames[depth++] = node;
+	}
+
+	fputs("main", file_ptr);
+	while (depth > 0) {
+		fprintf(file_ptr, ";sub_%03X", read_call_node_entry(frames[--depth]));
+	}
+}
+
+/*
+ * Collapsed stacks, a line per call stack with its count, as consumed by flamegraph.pl and compatible tools.
+ */
+void write_collapsed_stacks(FILE *file_ptr, const uint64_t *counts) {
+	for (uint32_t node = 0; node < PROFILE_CALL_NODES; ++node) {
+		if ((node == PROFILE_ROOT_NODE || call_graph_profile.keys[node] != 0) && counts[node] > 0) {
+			write_call_stack(file_ptr, node);
+			fprintf(file_ptr, " %llu\n", (unsigned long long) counts[node]);
+		}
+	}
+}
+
+typedef struct {
+	uint64_t inclusive_instructions;
+	uint64_t exclusive_instructions;
+	uint64_t inclusive_draws;
+	uint64_t exclusive_draws;
+} RoutineProfile;
+
+// Code outside any subroutine is accounted after the subroutines, which are indexed by entry point
+#define MAIN_ROUTINE MEMORY_SIZE
+
+uint16_t read_call_node_routine(uint32_t node) {
+	return node == PROFILE_ROOT_NODE ? MAIN_ROUTINE : read_call_node_entry(node);
+}
+
+RoutineProfile *routine_profiles_to_sort;
+
+int compare_routine_profiles(const void *a, const void *b) {
+	uint64_t instructions_a = routine_profiles_to_sort[*(const uint16_t *) a].inclusive_instructions;
+	uint64_t instructions_b = routine_profiles_to_sort[*(const uint16_t *) b].inclusive_instructions;
+	return (instructions_a < instructions_b) - (instructions_a > instructions_b);
+}
+
+/*
+ * Writes a line per subroutine sorted by inclusive instructions. Exclusive counts only cover the subroutine's own code,
+ * inclusive ones also cover whatever it calls, once per call stack even if it recurses.
+ */
+void write_call_graph_report(FILE *file_ptr) {
+	RoutineProfile *routines = calloc(MAIN_ROUTINE + 1, sizeof(RoutineProfile));
+	if (routines == NULL) {
+		return;
+	}
+
+	for (uint32_t node = 0; node < PROFILE_CALL_NODES; ++node) {
+		uint64_t instructions = call_graph_profile.instructions[node];
+		uint64_t draws = call_graph_profile.draws[node];
+		if (instructions == 0 || (node != PROFILE_ROOT_NODE && call_graph_profile.keys[node] == 0)) {
+			continue;
+		}
+		routines[read_call_node_routine(node)].exclusive_instructions += instructions;
+		routines[read_call_node_routine(node)].exclusive_draws += draws;
+
+		uint16_t seen[STACK_SIZE + 1];
+		uint8_t seen_count = 0;
+		for (uint32_t frame = node;; frame = read_call_node_parent(frame)) {
+			uint16_t routine = read_call_node_routine(frame);
+			bool repeated = false;
+			for (uint8_t i = 0; i < seen_count; ++i) {
+				repeated |= seen[i] == routine;
+			}
+			if (!repeated && seen_count <= STACK_SIZE) {
+				seen[seen_count++] = routine;
+				routines[routine].inclusive_instructions += instructions;
+				routines[routine].inclusive_draws += draws;
+			}
+			if (frame == PROFILE_ROOT_NODE) {
+				break;
+			}
+		}
+	}
+
+	uint16_t order[MAIN_ROUTINE + 1];
+	size_t count = 0;
+	for (uint16_t routine = 0; routine <= MAIN_ROUTINE; ++routine) {
+		if (routines[routine].inclusive_instructions > 0) {
+			order[count++] = routine;
+		}
+	}
+	routine_profiles_to_sort = routines;
+	qsort(order, count, sizeof(order[0]), compare_routine_profiles);
+
+	fprintf(
+		file_ptr, "%-10s %16s %16s %12s %12s\n",
+		"subroutine", "incl. instr.", "excl. instr.", "incl. draws", "excl. draws"
+	);
+	for (size_t i = 0; i < count; ++i) {
+		RoutineProfile *routine = &routines[order[i]];
+		char name[16];
+		if (order[i] == MAIN_ROUTINE) {
+			snprintf(name, sizeof(name), "main");
+		} else {
+			snprintf(name, sizeof(name), "sub_%03X", order[i]);
+		}
+		fprintf(
+			file_ptr, "%-10s %16llu %16llu %12llu %12llu\n", name,
+			(unsigned long long) routine->inclusive_instructions, (unsigned long long) routine->exclusive_instructions,
+			(unsigned long long) routine->inclusive_draws, (unsigned long long) routine->exclusive_draws
+		);
+	}
+
+	free(routines);
+}
+
+/*
+ * Opens prefix followed by suffix, reporting the failure if it can't.
+ */
+FILE *open_profile_output(const char *prefix, const char *suffix, const char *mode) {
+	size_t size = strlen(prefix) + strlen(suffix) + 1;
+	char *path = malloc(size);
+	if (path == NULL) {
+		return NULL;
+	}
+	snprintf(path, size, "%s%s", prefix, suffix);
+	FILE *file_ptr = fopen(path, mode);
+	if (file_ptr == NULL) {
+		perror(path);
+	}
+	free(path);
+	return file_ptr;
+}
+
+void dump_address_profile() {
+	const char *prefix = getenv(ENV_PROFILE_OUTPUT);
+	if (prefix == NULL) {
+		prefix = DEFAULT_PROFILE_OUTPUT;
+	}
+
+	FILE *file_ptr = open_profile_output(prefix, ".txt", "w");
+	if (file_ptr != NULL) {
+		write_profile_report(file_ptr);
+		fputc('\n', file_ptr);
+		write_profile_heatmap(file_ptr);
+		fputc('\n', file_ptr);
+		write_call_graph_report(file_ptr);
+		fclose(file_ptr);
+	}
+
+	file_ptr = open_profile_output(prefix, ".pgm", "wb");
+	if (file_ptr != NULL) {
+		write_profile_image(file_ptr);
+		fclose(file_ptr);
+	}
+
+	file_ptr = open_profile_output(prefix, ".calls.folded", "w");
+	if (file_ptr != NULL) {
+		write_collapsed_stacks(file_ptr, call_graph_profile.instructions);
+		fclose(file_ptr);
+	}
+
+	file_ptr = open_profile_output(prefix, ".draws.folded", "w");
+	if (file_ptr != NULL) {
+		write_collapsed_stacks(file_ptr, call_graph_profile.draws);
+		fclose(file_ptr);
+	}
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include "quirks.h"
+
+#include <string.h>
+
+#define QUIRK_PROFILE_SETTINGS_ENTRY( \
+	profile, name, suffix, shift_vy, jump_vx, index_overflow, index_increment, key_release \
+) \
+	[profile] = {name, #suffix, shift_vy, jump_vx, index_overflow, index_increment, key_release},
+
+const QuirkSettings QUIRK_PROFILE_SETTINGS[NUMBER_OF_QUIRK_PROFILES] = {
+	FOR_EACH_QUIRK_PROFILE(QUIRK_PROFILE_SETTINGS_ENTRY)
+};
+
+/*
+ * Looks up a profile by its name, e.g. "vip".
+ */
+bool parse_quirk_profile(const char *name, QuirkProfile *profile) {
+	for (int i = 0; i < NUMBER_OF_QUIRK_PROFILES; ++i) {
+		if (strcmp(name, QUIRK_PROFILE_SETTINGS[i].name) == 0) {
+			*profile = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * True if the instruction has a handler specialized for every profile.
+ */
+bool depends_on_quirks(Opcode opcode) {
+	switch (opcode) {
+		case OPCODE_JUMP_WITH_OFFSET:
+		case OPCODE_SAVE_REGISTERS:
+		case OPCODE_LOAD_REGISTERS:
+		case OPCODE_ADD_TO_INDEX:
+		case OPCODE_SHIFT_RIGHT:
+		case OPCODE_SHIFT_LEFT:
+		case OPCODE_WAIT_FOR_KEY:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * The quirks of a profile as a bitmask, one bit per quirk, so recordings can tell if they're replayed with the same
+ * behaviour. Incrementing I by X came after the other quirks, so it has the next free bit.
+ */
+uint32_t quirk_profile_bits(QuirkProfile profile) {
+	const QuirkSettings *settings = &QUIRK_PROFILE_SETTINGS[profile];
+	return (
+		(settings->use_extra_register_on_shift ? 1u << 0 : 0)
+		| (settings->register_argument_on_jump_with_offset ? 1u << 1 : 0)
+		| (settings->overflow_on_add_to_index ? 1u << 2 : 0)
+		| (settings->index_increment_on_dump_and_load == INDEX_INCREMENT_BY_X_PLUS_ONE ? 1u << 3 : 0)
+		| (settings->key_wait_for_release ? 1u << 4 : 0)
+		| (settings->index_increment_on_dump_and_load == INDEX_INCREMENT_BY_X ? 1u << 5 : 0)
+	);
+}
+
+/*
+ * Looks up the profile with these quirk bits, e.g. the one a replay was recorded with.
+ */
+bool find_quirk_profile(uint32_t bits, QuirkProfile *profile) {
+	for (int i = 0; i < NUMBER_OF_QUIRK_PROFILES; ++i) {
+		if (quirk_profile_bits(i) == bits) {
+			*profile = i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,21 @@
+#include "random.h"
+
+#define XORSHIFT64_STAR_MULTIPLIER 0x2545F4914F6CDD1Dull
+
+/*
+ * Each state has its own xorshift64* generator, so instances don't share any hidden state and replay exactly.
+ * A zero seed would get the generator stuck at zero, so it's replaced by the default one.
+ */
+void seed_random(CpuState *cpu_state, uint64_t seed) {
+	cpu_state->random_state = seed != 0 ? seed : DEFAULT_RANDOM_SEED;
+}
+
+uint8_t next_random_byte(CpuState *cpu_state) {
+	uint64_t x = cpu_state->random_state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	cpu_state->random_state = x;
+	// The high bits of the product are the best distributed
+	return (x * XORSHIFT64_STAR_MULTIPLIER) >> 56;
+}
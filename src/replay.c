@@ -0,0 +1,250 @@
+#include "replay.h"
+#include "cpu.h"
+#include "save_state.h"
+
+uint64_t hash_rom(const uint8_t *rom) {
+	return fnv1a_hash(rom, ROM_SIZE);
+}
+
+/*
+ * Hash of the architectural state, in its endian-stable save state form so that hashes match across hosts.
+ */
+uint64_t hash_state(const CpuState *cpu_state) {
+	uint8_t record[SAVE_STATE_SIZE];
+	encode_save_state(cpu_state, record);
+	return fnv1a_hash(record + SAVE_STATE_HEADER_SIZE, SAVE_STATE_PAYLOAD_SIZE);
+}
+
+void write_replay_bytes(ReplayRecorder *recorder, const uint8_t *bytes, size_t size) {
+	if (recorder->ok && fwrite(bytes, 1, size, recorder->file_ptr) != size) {
+		recorder->ok = false;
+	}
+}
+
+void flush_replay_keys(ReplayRecorder *recorder) {
+	if (recorder->run_frames == 0) {
+		return;
+	}
+
+	uint8_t record[1 + 2 + 4];
+	record[0] = REPLAY_RECORD_KEYS;
+	write_little_endian(&record[1], 2, recorder->run_keys);
+	write_little_endian(&record[3], 4, recorder->run_frames);
+	write_replay_bytes(recorder, record, sizeof(record));
+	recorder->run_frames = 0;
+}
+
+/*
+ * Starts recording a session to path.
+ * The state must have just been initialized with the ROM. It's switched to virtual timers ticking once per frame,
+ * so that the recording can be replayed exactly.
+ */
+bool start_replay_recording(
+	ReplayRecorder *recorder, const char *path, const uint8_t *rom, CpuState *cpu_state,
+	uint32_t instructions_per_frame, uint32_t hash_interval
+) {
+	recorder->file_ptr = fopen(path, "wb");
+	if (recorder->file_ptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s\n", path);
+		return false;
+	}
+	recorder->hash_interval = hash_interval > 0 ? hash_interval : DEFAULT_REPLAY_HASH_INTERVAL;
+	recorder->frames = 0;
+	recorder->run_keys = 0;
+	recorder->run_frames = 0;
+	recorder->ok = true;
+
+	use_virtual_timers(cpu_state, instructions_per_frame);
+
+	uint8_t header[REPLAY_HEADER_SIZE];
+	uint8_t *ptr = header;
+	memcpy(ptr, REPLAY_MAGIC, REPLAY_MAGIC_SIZE);
+	ptr += REPLAY_MAGIC_SIZE;
+	write_little_endian(ptr, 4, REPLAY_VERSION);
+	write_little_endian(ptr + 4, 8, hash_rom(rom));
+	write_little_endian(ptr + 12, 4, quirk_profile_bits(cpu_state->quirk_profile));
+	write_little_endian(ptr + 16, 8, cpu_state->random_state);
+	write_little_endian(ptr + 24, 4, instructions_per_frame);
+	write_little_endian(ptr + 28, 4, recorder->hash_interval);
+	write_replay_bytes(recorder, header, sizeof(header));
+	return recorder->ok;
+}
+
+/*
+ * Records a frame, after it has run with the given keys held down.
+ */
+void record_replay_frame(ReplayRecorder *recorder, uint16_t keys, const CpuState *cpu_state) {
+	if (recorder->run_frames > 0 && keys != recorder->run_keys) {
+		flush_replay_keys(recorder);
+	}
+	recorder->run_keys = keys;
+	++recorder->run_frames;
+	++recorder->frames;
+
+	if (recorder->frames % recorder->hash_interval == 0) {
+		flush_replay_keys(recorder);
+
+		uint8_t record[1 + 4 + 8];
+		record[0] = REPLAY_RECORD_HASH;
+		write_little_endian(&record[1], 4, recorder->frames - 1);
+		write_little_endian(&record[5], 8, hash_state(cpu_state));
+		write_replay_bytes(recorder, record, sizeof(record));
+	}
+}
+
+bool finish_replay_recording(ReplayRecorder *recorder) {
+	flush_replay_keys(recorder);
+
+	uint8_t record[1 + 4];
+	record[0] = REPLAY_RECORD_END;
+	write_little_endian(&record[1], 4, recorder->frames);
+	write_replay_bytes(recorder, record, sizeof(record));
+
+	bool ok = fclose(recorder->file_ptr) == 0 && recorder->ok;
+	recorder->file_ptr = NULL;
+	if (!ok) {
+		fprintf(stderr, "Failed to write replay file\n");
+	}
+	return ok;
+}
+
+bool load_replay(Replay *replay, const char *path) {
+	replay->records = NULL;
+	replay->size = 0;
+
+	FILE *file_ptr = fopen(path, "rb");
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open replay file %s\n", path);
+		return false;
+	}
+
+	uint8_t header[REPLAY_HEADER_SIZE];
+	bool ok = fread(header, 1, sizeof(header), file_ptr) == sizeof(header)
+		&& memcmp(header, REPLAY_MAGIC, REPLAY_MAGIC_SIZE) == 0
+		&& read_little_endian(&header[REPLAY_MAGIC_SIZE], 4) == REPLAY_VERSION;
+	if (!ok) {
+		fprintf(stderr, "Invalid replay file %s\n", path);
+		fclose(file_ptr);
+		return false;
+	}
+
+	const uint8_t *ptr = &header[REPLAY_MAGIC_SIZE + 4];
+	replay->rom_hash = read_little_endian(ptr, 8);
+	replay->quirks = read_little_endian(ptr + 8, 4);
+	replay->seed = read_little_endian(ptr + 12, 8);
+	replay->instructions_per_frame = read_little_endian(ptr + 20, 4);
+	replay->hash_interval = read_little_endian(ptr + 24, 4);
+
+	// The rest of the file is records
+	size_t capacity = 0;
+	for (;;) {
+		if (replay->size == capacity) {
+			capacity = capacity ? 2 * capacity : 4096;
+			uint8_t *records = realloc(replay->records, capacity);
+			if (records == NULL) {
+				ok = false;
+				break;
+			}
+			replay->records = records;
+		}
+		size_t read = fread(&replay->records[replay->size], 1, capacity - replay->size, file_ptr);
+		replay->size += read;
+		if (read == 0) {
+			ok = !ferror(file_ptr);
+			break;
+		}
+	}
+	fclose(file_ptr);
+
+	if (!ok) {
+		fprintf(stderr, "Failed to read replay file %s\n", path);
+		free_replay(replay);
+	}
+	return ok;
+}
+
+/*
+ * Checks that the replay was recorded with this ROM and the same quirks as the profile.
+ */
+bool check_replay_rom(const Replay *replay, const uint8_t *rom, QuirkProfile profile) {
+	if (replay->rom_hash != hash_rom(rom)) {
+		fprintf(stderr, "The replay was recorded with another ROM\n");
+		return false;
+	}
+	uint32_t quirks = quirk_profile_bits(profile);
+	if (replay->quirks != quirks) {
+		fprintf(stderr, "The replay was recorded with other quirks (%#x, expected %#x)\n", replay->quirks, quirks);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Runs the whole replay as fast as possible, on a state just initialized with its ROM.
+ * jit may be NULL to interpret.
+ * Returns false if the file is malformed, a divergence from the recorded state hashes is reported in the result.
+ */
+bool run_replay(const Replay *replay, CpuState *cpu_state, JitContext *jit, ReplayResult *result) {
+	result->frames = 0;
+	result->executed = 0;
+	result->hashes_checked = 0;
+	result->diverged = false;
+	result->diverged_frame = 0;
+
+	seed_random(cpu_state, replay->seed);
+	use_virtual_timers(cpu_state, replay->instructions_per_frame);
+
+	size_t offset = 0;
+	while (offset < replay->size) {
+		const uint8_t *record = &replay->records[offset];
+		size_t remaining = replay->size - offset;
+
+		switch (record[0]) {
+			case REPLAY_RECORD_KEYS: {
+				if (remaining < 1 + 2 + 4) {
+					return false;
+				}
+				uint16_t keys = read_little_endian(&record[1], 2);
+				uint32_t frames = read_little_endian(&record[3], 4);
+				for (uint32_t i = 0; i < frames; ++i, ++result->frames) {
+					write_keyboard_mask(cpu_state, keys);
+					if (jit != NULL) {
+						result->executed += jit_run(jit, cpu_state, replay->instructions_per_frame);
+					} else {
+						result->executed += run_instructions(cpu_state, replay->instructions_per_frame);
+					}
+					update_beeper_status(cpu_state);
+				}
+				offset += 1 + 2 + 4;
+				break;
+			}
+			case REPLAY_RECORD_HASH: {
+				if (remaining < 1 + 4 + 8 || read_little_endian(&record[1], 4) + 1 != result->frames) {
+					return false;
+				}
+				if (read_little_endian(&record[5], 8) != hash_state(cpu_state) && !result->diverged) {
+					result->diverged = true;
+					result->diverged_frame = result->frames - 1;
+				}
+				++result->hashes_checked;
+				offset += 1 + 4 + 8;
+				break;
+			}
+			case REPLAY_RECORD_END: {
+				return remaining >= 1 + 4 && read_little_endian(&record[1], 4) == result->frames;
+			}
+			default: {
+				return false;
+			}
+		}
+	}
+
+	// Truncated before the end record
+	return false;
+}
+
+void free_replay(Replay *replay) {
+	free(replay->records);
+	replay->records = NULL;
+	replay->size = 0;
+}
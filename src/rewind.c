@@ -0,0 +1,309 @@
+#include "rewind.h"
+#include "timers.h"
+#include "utils.h"
+
+// Zero runs shorter than this are cheaper to store as part of the surrounding literal bytes
+#define MIN_ENCODED_ZERO_RUN 4
+
+void pack_bytes(uint8_t **ptr, const void *src, size_t size) {
+	memcpy(*ptr, src, size);
+	*ptr += size;
+}
+
+void unpack_bytes(const uint8_t **ptr, void *dst, size_t size) {
+	memcpy(dst, *ptr, size);
+	*ptr += size;
+}
+
+/*
+ * Serializes the state into PACKED_STATE_SIZE bytes.
+ * Timers are stored as their current value, so a wall clock timer restarts counting down from it when unpacked.
+ */
+void pack_state(CpuState *cpu_state, uint8_t *packed) {
+	uint8_t *ptr = packed;
+	uint8_t delay = read_delay_timer(cpu_state);
+	uint8_t sound = read_sound_timer(cpu_state);
+
+	pack_bytes(&ptr, cpu_state->memory, MEMORY_SIZE);
+	pack_bytes(&ptr, cpu_state->stack, STACK_SIZE * 2);
+	pack_bytes(&ptr, &cpu_state->stack_size, 1);
+	pack_bytes(&ptr, &cpu_state->program_counter, 2);
+	pack_bytes(&ptr, &cpu_state->index_register, 2);
+	pack_bytes(&ptr, cpu_state->register_bank, REGISTERS);
+	pack_bytes(&ptr, cpu_state->display, SCREEN_SIZE_BYTES);
+	pack_bytes(&ptr, &cpu_state->sound_playing, 1);
+	pack_bytes(&ptr, cpu_state->keyboard, NUMBER_OF_KEYS);
+	pack_bytes(&ptr, &cpu_state->waiting_for_key, 1);
+	pack_bytes(&ptr, &cpu_state->key_wait_pressed, 2);
+	pack_bytes(&ptr, &delay, 1);
+	pack_bytes(&ptr, &sound, 1);
+	pack_bytes(&ptr, &cpu_state->cycles, 8);
+	pack_bytes(&ptr, &cpu_state->cycles_per_tick, 4);
+	pack_bytes(&ptr, &cpu_state->cycles_until_tick, 4);
+	pack_bytes(&ptr, &cpu_state->random_state, 8);
+	pack_bytes(&ptr, &cpu_state->quirk_profile, 1);
+}
+
+void unpack_state(CpuState *cpu_state, const uint8_t *packed) {
+	const uint8_t *ptr = packed;
+	uint8_t delay, sound, quirk_profile;
+
+	unpack_bytes(&ptr, cpu_state->memory, MEMORY_SIZE);
+	unpack_bytes(&ptr, cpu_state->stack, STACK_SIZE * 2);
+	unpack_bytes(&ptr, &cpu_state->stack_size, 1);
+	unpack_bytes(&ptr, &cpu_state->program_counter, 2);
+	unpack_bytes(&ptr, &cpu_state->index_register, 2);
+	unpack_bytes(&ptr, cpu_state->register_bank, REGISTERS);
+	unpack_bytes(&ptr, cpu_state->display, SCREEN_SIZE_BYTES);
+	unpack_bytes(&ptr, &cpu_state->sound_playing, 1);
+	unpack_bytes(&ptr, cpu_state->keyboard, NUMBER_OF_KEYS);
+	unpack_bytes(&ptr, &cpu_state->waiting_for_key, 1);
+	unpack_bytes(&ptr, &cpu_state->key_wait_pressed, 2);
+	unpack_bytes(&ptr, &delay, 1);
+	unpack_bytes(&ptr, &sound, 1);
+	unpack_bytes(&ptr, &cpu_state->cycles, 8);
+	unpack_bytes(&ptr, &cpu_state->cycles_per_tick, 4);
+	unpack_bytes(&ptr, &cpu_state->cycles_until_tick, 4);
+	unpack_bytes(&ptr, &cpu_state->random_state, 8);
+	unpack_bytes(&ptr, &quirk_profile, 1);
+
+	// With the timer mode restored, the timers can be written back
+	write_delay_timer(cpu_state, delay);
+	write_sound_timer(cpu_state, sound);
+
+	cpu_state->dirty_pages = ALL_MEMORY_PAGES_DIRTY;
+	cpu_state->dirty_rows = ALL_SCREEN_ROWS_DIRTY;
+	cpu_state->display_changed = true;
+	// Also clears the decode cache, whose handlers depend on the profile
+	set_quirk_profile(cpu_state, quirk_profile);
+}
+
+/*
+ * Run-length encodes the XOR of two packed states, or of a single one if previous is NULL.
+ * The output is a sequence of tokens: a 16-bit count of zero bytes, a 16-bit count of literal bytes, and the literals.
+ * Returns the encoded size, at most MAX_ENCODED_STATE_SIZE.
+ */
+size_t encode_state_delta(const uint8_t *state, const uint8_t *previous, uint8_t *encoded) {
+	size_t in = 0;
+	size_t out = 0;
+
+#define DELTA_AT(i) (previous != NULL ? state[i] ^ previous[i] : state[i])
+
+	while (in < PACKED_STATE_SIZE) {
+		size_t zeros_start = in;
+		while (in < PACKED_STATE_SIZE && DELTA_AT(in) == 0) {
+			++in;
+		}
+
+		// Extend the literals until the next long enough zero run
+		size_t literals_start = in;
+		size_t literals_end = in;
+		size_t zero_run = 0;
+		for (; in < PACKED_STATE_SIZE && zero_run < MIN_ENCODED_ZERO_RUN; ++in) {
+			if (DELTA_AT(in) == 0) {
+				++zero_run;
+			} else {
+				zero_run = 0;
+				literals_end = in + 1;
+			}
+		}
+		in = literals_end;
+
+		write_little_endian(&encoded[out], 2, literals_start - zeros_start);
+		write_little_endian(&encoded[out + 2], 2, literals_end - literals_start);
+		out += 4;
+		for (size_t i = literals_start; i < literals_end; ++i) {
+			encoded[out++] = DELTA_AT(i);
+		}
+
+		if (literals_end == literals_start) {
+			// Only trailing zeros were left
+			break;
+		}
+	}
+
+#undef DELTA_AT
+
+	return out;
+}
+
+/*
+ * XORs an encoded delta into a packed state.
+ */
+void decode_state_delta(const uint8_t *encoded, size_t size, uint8_t *state) {
+	size_t in = 0;
+	size_t out = 0;
+	while (in + 4 <= size) {
+		out += read_little_endian(&encoded[in], 2);
+		uint16_t literals = read_little_endian(&encoded[in + 2], 2);
+		in += 4;
+		for (uint16_t i = 0; i < literals; ++i) {
+			state[out++] ^= encoded[in++];
+		}
+	}
+}
+
+bool init_rewind_buffer(RewindBuffer *rewind, uint32_t frames, size_t capacity, uint32_t keyframe_interval) {
+	rewind->arena = malloc(capacity);
+	rewind->entries = malloc(frames * sizeof(RewindEntry));
+	if (rewind->arena == NULL || rewind->entries == NULL) {
+		free(rewind->arena);
+		free(rewind->entries);
+		return false;
+	}
+
+	rewind->capacity = capacity;
+	rewind->write_offset = 0;
+	rewind->max_entries = frames;
+	rewind->oldest = 0;
+	rewind->count = 0;
+	rewind->keyframe_interval = keyframe_interval > 0 ? keyframe_interval : 1;
+	rewind->frames_since_keyframe = 0;
+	return true;
+}
+
+RewindEntry *get_rewind_entry(RewindBuffer *rewind, uint32_t age) {
+	return &rewind->entries[(rewind->oldest + age) % rewind->max_entries];
+}
+
+/*
+ * Drops the oldest keyframe, and every delta up to the next keyframe.
+ */
+void evict_rewind_keyframe(RewindBuffer *rewind) {
+	do {
+		rewind->oldest = (rewind->oldest + 1) % rewind->max_entries;
+		--rewind->count;
+	} while (rewind->count > 0 && !get_rewind_entry(rewind, 0)->keyframe);
+}
+
+/*
+ * Finds where size bytes fit in the arena, evicting old frames if needed.
+ */
+bool reserve_rewind_space(RewindBuffer *rewind, size_t size, size_t *offset) {
+	if (size > rewind->capacity) {
+		return false;
+	}
+
+	for (;;) {
+		if (rewind->count == 0) {
+			*offset = 0;
+			return true;
+		}
+
+		if (rewind->count < rewind->max_entries) {
+			size_t oldest_offset = get_rewind_entry(rewind, 0)->offset;
+			if (rewind->write_offset > oldest_offset) {
+				// Used space is in one piece, try after it, then at the start
+				if (rewind->capacity - rewind->write_offset >= size) {
+					*offset = rewind->write_offset;
+					return true;
+				}
+				if (size <= oldest_offset) {
+					*offset = 0;
+					return true;
+				}
+			} else if (oldest_offset - rewind->write_offset >= size) {
+				*offset = rewind->write_offset;
+				return true;
+			}
+		}
+
+		evict_rewind_keyframe(rewind);
+	}
+}
+
+/*
+ * Records the state as the newest frame.
+ */
+bool push_rewind_frame(RewindBuffer *rewind, CpuState *cpu_state) {
+	pack_state(cpu_state, rewind->packed);
+
+	bool keyframe = rewind->count == 0 || rewind->frames_since_keyframe + 1 >= rewind->keyframe_interval;
+	size_t size = encode_state_delta(rewind->packed, keyframe ? NULL : rewind->newest, rewind->scratch);
+
+	size_t offset;
+	if (!reserve_rewind_space(rewind, size, &offset)) {
+		return false;
+	}
+	if (rewind->count == 0 && !keyframe) {
+		// Everything was evicted to make room, including the frame this delta was based on
+		keyframe = true;
+		size = encode_state_delta(rewind->packed, NULL, rewind->scratch);
+		if (!reserve_rewind_space(rewind, size, &offset)) {
+			return false;
+		}
+	}
+
+	memcpy(&rewind->arena[offset], rewind->scratch, size);
+	RewindEntry *entry = get_rewind_entry(rewind, rewind->count);
+	entry->offset = offset;
+	entry->size = size;
+	entry->keyframe = keyframe;
+	++rewind->count;
+	rewind->write_offset = offset + size;
+
+	rewind->frames_since_keyframe = keyframe ? 0 : rewind->frames_since_keyframe + 1;
+	memcpy(rewind->newest, rewind->packed, PACKED_STATE_SIZE);
+	return true;
+}
+
+/*
+ * Drops the newest frame and restores the one before it into the state.
+ * Returns false if there's no older frame, leaving the state at the oldest one if there's any.
+ */
+bool pop_rewind_frame(RewindBuffer *rewind, CpuState *cpu_state) {
+	if (rewind->count == 0) {
+		return false;
+	}
+	if (rewind->count == 1) {
+		unpack_state(cpu_state, rewind->newest);
+		return false;
+	}
+
+	RewindEntry *entry = get_rewind_entry(rewind, rewind->count - 1);
+	if (!entry->keyframe) {
+		// XORing the delta again gives back the previous frame
+		decode_state_delta(&rewind->arena[entry->offset], entry->size, rewind->newest);
+	} else {
+		// Rebuild the previous frame from its own keyframe
+		uint32_t keyframe_age = rewind->count - 2;
+		while (!get_rewind_entry(rewind, keyframe_age)->keyframe) {
+			--keyframe_age;
+		}
+		memset(rewind->newest, 0, PACKED_STATE_SIZE);
+		for (uint32_t age = keyframe_age; age <= rewind->count - 2; ++age) {
+			RewindEntry *delta = get_rewind_entry(rewind, age);
+			decode_state_delta(&rewind->arena[delta->offset], delta->size, rewind->newest);
+		}
+	}
+
+	rewind->write_offset = entry->offset;
+	--rewind->count;
+
+	rewind->frames_since_keyframe = 0;
+	while (!get_rewind_entry(rewind, rewind->count - 1 - rewind->frames_since_keyframe)->keyframe) {
+		++rewind->frames_since_keyframe;
+	}
+
+	unpack_state(cpu_state, rewind->newest);
+	return true;
+}
+
+/*
+ * Bytes of the arena holding frames.
+ */
+size_t rewind_buffer_usage(const RewindBuffer *rewind) {
+	size_t usage = 0;
+	for (uint32_t age = 0; age < rewind->count; ++age) {
+		usage += rewind->entries[(rewind->oldest + age) % rewind->max_entries].size;
+	}
+	return usage;
+}
+
+void free_rewind_buffer(RewindBuffer *rewind) {
+	free(rewind->arena);
+	free(rewind->entries);
+	rewind->arena = NULL;
+	rewind->entries = NULL;
+	rewind->count = 0;
+}
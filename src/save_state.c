@@ -0,0 +1,286 @@
+#include "save_state.h"
+#include "decode_cache.h"
+#include "utils.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void encode_save_state_timer(uint8_t **ptr, const TimerRegister *timer) {
+	write_little_endian(*ptr, 8, timer->set_ts_millis);
+	(*ptr)[8] = timer->set_value;
+	*ptr += SAVE_STATE_TIMER_SIZE;
+}
+
+void decode_save_state_timer(const uint8_t **ptr, TimerRegister *timer) {
+	timer->set_ts_millis = (int64_t) read_little_endian(*ptr, 8);
+	timer->set_value = (*ptr)[8];
+	*ptr += SAVE_STATE_TIMER_SIZE;
+}
+
+/*
+ * Writes the state as a SAVE_STATE_SIZE bytes record, header included.
+ */
+void encode_save_state(const CpuState *cpu_state, uint8_t *record) {
+	uint8_t *ptr = record;
+
+	memcpy(ptr, SAVE_STATE_MAGIC, SAVE_STATE_MAGIC_SIZE);
+	write_little_endian(ptr + SAVE_STATE_MAGIC_SIZE, 4, SAVE_STATE_VERSION);
+	write_little_endian(ptr + SAVE_STATE_MAGIC_SIZE + 4, 4, SAVE_STATE_PAYLOAD_SIZE);
+	ptr += SAVE_STATE_HEADER_SIZE;
+
+	memcpy(ptr, cpu_state->memory, MEMORY_SIZE);
+	ptr += MEMORY_SIZE;
+	for (uint8_t i = 0; i < STACK_SIZE; ++i) {
+		write_little_endian(ptr, 2, cpu_state->stack[i]);
+		ptr += 2;
+	}
+	*ptr++ = cpu_state->stack_size;
+
+	write_little_endian(ptr, 2, cpu_state->program_counter);
+	write_little_endian(ptr + 2, 2, cpu_state->index_register);
+	ptr += 4;
+	memcpy(ptr, cpu_state->register_bank, REGISTERS);
+	ptr += REGISTERS;
+
+	memcpy(ptr, cpu_state->display, SCREEN_SIZE_BYTES);
+	ptr += SCREEN_SIZE_BYTES;
+	*ptr++ = cpu_state->sound_playing;
+
+	for (uint8_t key = 0; key < NUMBER_OF_KEYS; ++key) {
+		*ptr++ = cpu_state->keyboard[key];
+	}
+	*ptr++ = cpu_state->waiting_for_key;
+	write_little_endian(ptr, 2, cpu_state->key_wait_pressed);
+	ptr += 2;
+
+	encode_save_state_timer(&ptr, &cpu_state->delay_timer);
+	encode_save_state_timer(&ptr, &cpu_state->sound_timer);
+	write_little_endian(ptr, 8, cpu_state->cycles);
+	write_little_endian(ptr + 8, 4, cpu_state->cycles_per_tick);
+	write_little_endian(ptr + 12, 4, cpu_state->cycles_until_tick);
+	write_little_endian(ptr + 16, 8, cpu_state->random_state);
+	ptr[24] = cpu_state->quirk_profile;
+}
+
+/*
+ * Restores the state from a record, after checking its header.
+ * Returns false, leaving the state untouched, if the record is truncated, of another format or version, or holds a
+ * stack size, PC, I, virtual timer countdown or quirk profile out of range, or a random state stuck at zero.
+ * The state takes the quirk profile of the record, the one its code was running with.
+ */
+bool decode_save_state(CpuState *cpu_state, const uint8_t *record, size_t size) {
+	if (size < SAVE_STATE_HEADER_SIZE || memcmp(record, SAVE_STATE_MAGIC, SAVE_STATE_MAGIC_SIZE) != 0) {
+		return false;
+	}
+	if (read_little_endian(record + SAVE_STATE_MAGIC_SIZE, 4) != SAVE_STATE_VERSION) {
+		return false;
+	}
+	if (read_little_endian(record + SAVE_STATE_MAGIC_SIZE + 4, 4) != SAVE_STATE_PAYLOAD_SIZE) {
+		return false;
+	}
+	if (size < SAVE_STATE_SIZE) {
+		return false;
+	}
+	// The quirk profile is the last byte
+	if (record[SAVE_STATE_SIZE - 1] >= NUMBER_OF_QUIRK_PROFILES) {
+		return false;
+	}
+
+	const uint8_t *ptr = record + SAVE_STATE_HEADER_SIZE;
+
+	// Any of these would let the next instruction index past the stack or the memory
+	const uint8_t *stack_size_ptr = ptr + MEMORY_SIZE + STACK_SIZE * 2;
+	if (
+		*stack_size_ptr > STACK_SIZE
+		|| read_little_endian(stack_size_ptr + 1, 2) > ADDRESS_BITMASK
+		|| read_little_endian(stack_size_ptr + 3, 2) > ADDRESS_BITMASK
+	) {
+		return false;
+	}
+
+	// The cycles per tick, cycles until the next tick and random state come right before the quirk profile
+	const uint8_t *timing_ptr = record + SAVE_STATE_SIZE - 1 - 8 - 4 - 4;
+	uint32_t cycles_per_tick = read_little_endian(timing_ptr, 4);
+	uint32_t cycles_until_tick = read_little_endian(timing_ptr + 4, 4);
+	if (cycles_per_tick != 0 && (cycles_until_tick == 0 || cycles_until_tick > cycles_per_tick)) {
+		return false;
+	}
+	// xorshift never leaves zero
+	if (read_little_endian(timing_ptr + 8, 8) == 0) {
+		return false;
+	}
+
+	memcpy(cpu_state->memory, ptr, MEMORY_SIZE);
+	ptr += MEMORY_SIZE;
+	for (uint8_t i = 0; i < STACK_SIZE; ++i) {
+		cpu_state->stack[i] = read_little_endian(ptr, 2);
+		ptr += 2;
+	}
+	cpu_state->stack_size = *ptr++;
+
+	cpu_state->program_counter = read_little_endian(ptr, 2);
+	cpu_state->index_register = read_little_endian(ptr + 2, 2);
+	ptr += 4;
+	memcpy(cpu_state->register_bank, ptr, REGISTERS);
+	ptr += REGISTERS;
+
+	memcpy(cpu_state->display, ptr, SCREEN_SIZE_BYTES);
+	ptr += SCREEN_SIZE_BYTES;
+	cpu_state->sound_playing = *ptr++ != 0;
+
+	for (uint8_t key = 0; key < NUMBER_OF_KEYS; ++key) {
+		cpu_state->keyboard[key] = *ptr++ != 0;
+	}
+	cpu_state->waiting_for_key = *ptr++ != 0;
+	cpu_state->key_wait_pressed = read_little_endian(ptr, 2);
+	ptr += 2;
+
+	decode_save_state_timer(&ptr, &cpu_state->delay_timer);
+	decode_save_state_timer(&ptr, &cpu_state->sound_timer);
+	cpu_state->cycles = read_little_endian(ptr, 8);
+	cpu_state->cycles_per_tick = read_little_endian(ptr + 8, 4);
+	cpu_state->cycles_until_tick = read_little_endian(ptr + 12, 4);
+	cpu_state->random_state = read_little_endian(ptr + 16, 8);
+	cpu_state->quirk_profile = ptr[24];
+
+	cpu_state->dirty_pages = ALL_MEMORY_PAGES_DIRTY;
+	cpu_state->dirty_rows = ALL_SCREEN_ROWS_DIRTY;
+	cpu_state->display_changed = true;
+	clear_decode_cache(cpu_state);
+	return true;
+}
+
+/*
+ * Appends the state as a record to an open binary file.
+ */
+bool write_save_state(FILE *file_ptr, const CpuState *cpu_state) {
+	uint8_t record[SAVE_STATE_SIZE];
+	encode_save_state(cpu_state, record);
+	return fwrite(record, 1, SAVE_STATE_SIZE, file_ptr) == SAVE_STATE_SIZE;
+}
+
+bool save_state_to_file(const char *path, const CpuState *cpu_state) {
+	FILE *file_ptr = fopen(path, "wb");
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open save state file %s\n", path);
+		return false;
+	}
+
+	bool ok = write_save_state(file_ptr, cpu_state);
+	ok = fclose(file_ptr) == 0 && ok;
+	if (!ok) {
+		fprintf(stderr, "Failed to write save state file %s\n", path);
+	}
+	return ok;
+}
+
+/*
+ * Maps a file of save states read only, so that states are decoded straight from the page cache without reading the
+ * whole file first.
+ */
+bool open_save_state_library(SaveStateLibrary *library, const char *path) {
+	library->data = NULL;
+	library->size = 0;
+
+#ifdef _WIN32
+	library->file = NULL;
+	library->mapping = NULL;
+
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		fprintf(stderr, "Failed to open save state file %s\n", path);
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		return false;
+	}
+	library->file = file;
+	if (file_size.QuadPart == 0) {
+		// Empty files can't be mapped
+		return true;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	const void *data = mapping != NULL ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (data == NULL) {
+		fprintf(stderr, "Failed to map save state file %s\n", path);
+		if (mapping != NULL) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		library->file = NULL;
+		return false;
+	}
+	library->mapping = mapping;
+	library->data = data;
+	library->size = file_size.QuadPart;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open save state file %s\n", path);
+		return false;
+	}
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) != 0) {
+		close(fd);
+		return false;
+	}
+	if (file_stat.st_size == 0) {
+		// Empty files can't be mapped
+		close(fd);
+		return true;
+	}
+
+	void *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping stays valid after closing the descriptor
+	close(fd);
+	if (data == MAP_FAILED) {
+		fprintf(stderr, "Failed to map save state file %s\n", path);
+		return false;
+	}
+	library->data = data;
+	library->size = file_stat.st_size;
+#endif
+	return true;
+}
+
+size_t count_save_states(const SaveStateLibrary *library) {
+	return library->size / SAVE_STATE_SIZE;
+}
+
+bool load_save_state(const SaveStateLibrary *library, size_t index, CpuState *cpu_state) {
+	if (index >= count_save_states(library)) {
+		return false;
+	}
+	return decode_save_state(cpu_state, library->data + index * SAVE_STATE_SIZE, SAVE_STATE_SIZE);
+}
+
+void close_save_state_library(SaveStateLibrary *library) {
+#ifdef _WIN32
+	if (library->data != NULL) {
+		UnmapViewOfFile(library->data);
+	}
+	if (library->mapping != NULL) {
+		CloseHandle(library->mapping);
+	}
+	if (library->file != NULL) {
+		CloseHandle(library->file);
+	}
+	library->file = NULL;
+	library->mapping = NULL;
+#else
+	if (library->data != NULL) {
+		munmap((void *) library->data, library->size);
+	}
+#endif
+	library->data = NULL;
+	library->size = 0;
+}
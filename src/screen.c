@@ -1,9 +1,64 @@
 #include "screen.h"
 #include "state.h"
+#include "stats.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#define SCREEN_ROW_BYTES (SCREEN_WIDTH / 8)
+
+// Bit-reversed bytes, to turn MSB-first sprite rows into the LSB-first order of the display
+#define BIT_REVERSE_2(n) (n), (n) + 2 * 64, (n) + 1 * 64, (n) + 3 * 64
+#define BIT_REVERSE_4(n) BIT_REVERSE_2(n), BIT_REVERSE_2((n) + 2 * 16), BIT_REVERSE_2((n) + 1 * 16), BIT_REVERSE_2((n) + 3 * 16)
+#define BIT_REVERSE_6(n) BIT_REVERSE_4(n), BIT_REVERSE_4((n) + 2 * 4), BIT_REVERSE_4((n) + 1 * 4), BIT_REVERSE_4((n) + 3 * 4)
+
+const uint8_t BIT_REVERSE_TABLE[256] = {
+	BIT_REVERSE_6(0), BIT_REVERSE_6(2), BIT_REVERSE_6(1), BIT_REVERSE_6(3)
+};
+
+/*
+ * A display row as a 64-bit word, with bit N holding the pixel at column N.
+ */
+uint64_t read_screen_row(CpuState *cpu_state, uint8_t y) {
+	uint64_t row;
+	memcpy(&row, &cpu_state->display[y * SCREEN_ROW_BYTES], sizeof(row));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	row = __builtin_bswap64(row);
+#endif
+	return row;
+}
+
+void write_screen_row(CpuState *cpu_state, uint8_t y, uint64_t row) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	row = __builtin_bswap64(row);
+#endif
+	memcpy(&cpu_state->display[y * SCREEN_ROW_BYTES], &row, sizeof(row));
+}
+
+void mark_screen_rows_dirty(CpuState *cpu_state, uint32_t rows) {
+	cpu_state->dirty_rows |= rows;
+	cpu_state->display_changed = true;
+}
+
+bool is_display_changed(CpuState *cpu_state) {
+	return cpu_state->display_changed;
+}
+
+/*
+ * Returns the rows written to since the last call, and resets the tracking.
+ */
+uint32_t consume_dirty_screen_rows(CpuState *cpu_state) {
+	uint32_t rows = cpu_state->dirty_rows;
+	cpu_state->dirty_rows = 0;
+	cpu_state->display_changed = false;
+	return rows;
+}
 
 void fill_screen(CpuState *cpu_state, bool color) {
 	uint8_t value = color ? 0xFF : 0;
 	memset(cpu_state->display, value, SCREEN_SIZE_BYTES);
+	mark_screen_rows_dirty(cpu_state, ALL_SCREEN_ROWS_DIRTY);
 }
 
 uint8_t read_pixel_from_screen(CpuState *cpu_state, uint8_t x, uint8_t y) {
@@ -26,4 +81,68 @@ void write_pixel_to_screen(CpuState *cpu_state, uint8_t x, uint8_t y, uint8_t va
 	uint8_t mask = ~(1 << pixel_offset_in_byte);
 	pixel_byte = (pixel_byte & mask) | (value << pixel_offset_in_byte);
 	cpu_state->display[pixel_byte_address] = pixel_byte;
-}
\ No newline at end of file
+	mark_screen_rows_dirty(cpu_state, 1u << y);
+}
+
+/*
+ * XORs an 8 pixel sprite row (MSB leftmost) into the display row y, starting at column x.
+ * Pixels past the right edge are clipped.
+ * Returns whether any lit pixel was turned off.
+ */
+bool xor_sprite_row_to_screen(CpuState *cpu_state, uint8_t x, uint8_t y, uint8_t sprite_row) {
+	// Shifting out of the 64-bit word clips the sprite at the right edge
+	uint64_t sprite_word = (uint64_t) BIT_REVERSE_TABLE[sprite_row] << x;
+	if (sprite_word == 0) {
+		return false;
+	}
+	STATS_ADD(pixels_flipped, __builtin_popcountll(sprite_word));
+
+	uint64_t row = read_screen_row(cpu_state, y);
+	write_screen_row(cpu_state, y, row ^ sprite_word);
+	mark_screen_rows_dirty(cpu_state, 1u << y);
+	return (row & sprite_word) != 0;
+}
+
+/*
+ * Converts the display rows [first_row, end_row) into 32-bit pixels, one row of SCREEN_WIDTH pixels every pitch bytes.
+ * With SSE2, every display byte is broadcast to 8 lanes and compared against the single-bit masks, giving an
+ * all-ones lane for each lit pixel, which then selects between both colors.
+ */
+void expand_display_to_argb(
+	CpuState *cpu_state, uint32_t *pixels, size_t pitch, uint8_t first_row, uint8_t end_row,
+	uint32_t on_color, uint32_t off_color
+) {
+	const uint8_t *display = &cpu_state->display[first_row * SCREEN_ROW_BYTES];
+
+#if defined(__SSE2__)
+	const __m128i low_bits = _mm_set_epi32(0x08, 0x04, 0x02, 0x01);
+	const __m128i high_bits = _mm_set_epi32(0x80, 0x40, 0x20, 0x10);
+	const __m128i on = _mm_set1_epi32((int) on_color);
+	const __m128i off = _mm_set1_epi32((int) off_color);
+#endif
+
+	for (int y = 0; y < end_row - first_row; ++y) {
+		uint32_t *row = (uint32_t *) ((uint8_t *) pixels + y * pitch);
+
+		for (int column = 0; column < SCREEN_WIDTH / 8; ++column) {
+			uint8_t pixel_byte = *display++;
+			uint32_t *out = row + column * 8;
+
+#if defined(__SSE2__)
+			__m128i value = _mm_set1_epi32(pixel_byte);
+			__m128i low_mask = _mm_cmpeq_epi32(_mm_and_si128(value, low_bits), low_bits);
+			__m128i high_mask = _mm_cmpeq_epi32(_mm_and_si128(value, high_bits), high_bits);
+			_mm_storeu_si128(
+				(__m128i *) out, _mm_or_si128(_mm_and_si128(low_mask, on), _mm_andnot_si128(low_mask, off))
+			);
+			_mm_storeu_si128(
+				(__m128i *) (out + 4), _mm_or_si128(_mm_and_si128(high_mask, on), _mm_andnot_si128(high_mask, off))
+			);
+#else
+			for (int bit = 0; bit < 8; ++bit) {
+				out[bit] = (pixel_byte >> bit) & 0x1 ? on_color : off_color;
+			}
+#endif
+		}
+	}
+}
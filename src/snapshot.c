@@ -0,0 +1,116 @@
+#include "snapshot.h"
+
+void init_snapshot(Snapshot *snapshot) {
+	snapshot->pages = 0;
+	snapshot->page_data = NULL;
+}
+
+/*
+ * Stores the state, with the memory pages written to since the last snapshot, or every page if full.
+ * The state's dirty pages are reset, so the next snapshot is a delta from this one.
+ * Any previous contents of the snapshot must have been freed.
+ */
+bool take_snapshot(Snapshot *snapshot, CpuState *cpu_state, bool full) {
+	uint64_t pages = full ? ALL_MEMORY_PAGES_DIRTY : cpu_state->dirty_pages;
+
+	snapshot->pages = pages;
+	snapshot->page_data = NULL;
+	if (pages != 0) {
+		snapshot->page_data = malloc(__builtin_popcountll(pages) * MEMORY_PAGE_SIZE);
+		if (snapshot->page_data == NULL) {
+			snapshot->pages = 0;
+			return false;
+		}
+	}
+
+	size_t stored = 0;
+	for (uint64_t remaining = pages; remaining != 0; remaining &= remaining - 1) {
+		uint32_t page = __builtin_ctzll(remaining);
+		memcpy(snapshot->page_data[stored++], &cpu_state->memory[page * MEMORY_PAGE_SIZE], MEMORY_PAGE_SIZE);
+	}
+	cpu_state->dirty_pages = 0;
+
+	memcpy(snapshot->stack, cpu_state->stack, STACK_SIZE * 2);
+	snapshot->stack_size = cpu_state->stack_size;
+	snapshot->program_counter = cpu_state->program_counter;
+	snapshot->index_register = cpu_state->index_register;
+	memcpy(snapshot->register_bank, cpu_state->register_bank, REGISTERS);
+	memcpy(snapshot->display, cpu_state->display, SCREEN_SIZE_BYTES);
+	snapshot->sound_playing = cpu_state->sound_playing;
+	memcpy(snapshot->keyboard, cpu_state->keyboard, NUMBER_OF_KEYS);
+	snapshot->waiting_for_key = cpu_state->waiting_for_key;
+	snapshot->key_wait_pressed = cpu_state->key_wait_pressed;
+	snapshot->delay_timer = cpu_state->delay_timer;
+	snapshot->sound_timer = cpu_state->sound_timer;
+	snapshot->cycles = cpu_state->cycles;
+	snapshot->cycles_per_tick = cpu_state->cycles_per_tick;
+	snapshot->cycles_until_tick = cpu_state->cycles_until_tick;
+	snapshot->random_state = cpu_state->random_state;
+	snapshot->quirk_profile = cpu_state->quirk_profile;
+	return true;
+}
+
+bool is_full_snapshot(const Snapshot *snapshot) {
+	return snapshot->pages == ALL_MEMORY_PAGES_DIRTY;
+}
+
+/*
+ * Bytes used by the snapshot, including its page data.
+ */
+size_t snapshot_size(const Snapshot *snapshot) {
+	return sizeof(Snapshot) + __builtin_popcountll(snapshot->pages) * MEMORY_PAGE_SIZE;
+}
+
+/*
+ * Rebuilds a state from a full snapshot followed by count - 1 deltas, each taken right after the previous one.
+ * The state is left as it was when the last snapshot was taken, so it can go on with the next delta from there.
+ */
+void restore_snapshots(CpuState *cpu_state, const Snapshot *snapshots, size_t count) {
+	if (count == 0) {
+		return;
+	}
+
+	// Only the latest copy of each page is needed, so go backwards and skip the pages already restored
+	uint64_t restored = 0;
+	for (size_t i = count; i-- > 0 && restored != ALL_MEMORY_PAGES_DIRTY;) {
+		const Snapshot *snapshot = &snapshots[i];
+		size_t stored = 0;
+		for (uint64_t remaining = snapshot->pages; remaining != 0; remaining &= remaining - 1) {
+			uint32_t page = __builtin_ctzll(remaining);
+			uint64_t page_bit = (uint64_t) 1 << page;
+			if (!(restored & page_bit)) {
+				memcpy(&cpu_state->memory[page * MEMORY_PAGE_SIZE], snapshot->page_data[stored], MEMORY_PAGE_SIZE);
+				restored |= page_bit;
+			}
+			++stored;
+		}
+	}
+	cpu_state->dirty_pages = 0;
+
+	// Also clears the decode cache, which may hold handlers of another profile or code from before the pages restored
+	const Snapshot *last = &snapshots[count - 1];
+	set_quirk_profile(cpu_state, last->quirk_profile);
+	memcpy(cpu_state->stack, last->stack, STACK_SIZE * 2);
+	cpu_state->stack_size = last->stack_size;
+	cpu_state->program_counter = last->program_counter;
+	cpu_state->index_register = last->index_register;
+	memcpy(cpu_state->register_bank, last->register_bank, REGISTERS);
+	memcpy(cpu_state->display, last->display, SCREEN_SIZE_BYTES);
+	cpu_state->sound_playing = last->sound_playing;
+	memcpy(cpu_state->keyboard, last->keyboard, NUMBER_OF_KEYS);
+	cpu_state->waiting_for_key = last->waiting_for_key;
+	cpu_state->key_wait_pressed = last->key_wait_pressed;
+	cpu_state->delay_timer = last->delay_timer;
+	cpu_state->sound_timer = last->sound_timer;
+	cpu_state->cycles = last->cycles;
+	cpu_state->cycles_per_tick = last->cycles_per_tick;
+	cpu_state->cycles_until_tick = last->cycles_until_tick;
+	cpu_state->random_state = last->random_state;
+	cpu_state->dirty_rows = ALL_SCREEN_ROWS_DIRTY;
+	cpu_state->display_changed = true;
+}
+
+void free_snapshot(Snapshot *snapshot) {
+	free(snapshot->page_data);
+	init_snapshot(snapshot);
+}
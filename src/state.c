@@ -1,4 +1,6 @@
 #include "state.h"
+#include "decode_cache.h"
+#include "random.h"
 
 // Place from 0x050 to 0x09F
 const uint8_t FONT[CHARACTER_HEIGHT * NUMBER_OF_CHARACTERS] = {
@@ -42,8 +44,24 @@ bool timer_equals(const TimerRegister *left, const TimerRegister *right) {
 	return left->set_ts_millis == right->set_ts_millis && left->set_value == right->set_value;
 }
 
+/*
+ * Reads up to ROM_SIZE bytes from the file at path into rom, zeroing the rest.
+ */
+bool load_rom(const char *path, uint8_t *rom, size_t *bytes_read) {
+	memset(rom, 0, ROM_SIZE);
+	FILE *file_ptr = fopen(path, "rb");
+	if (file_ptr == NULL) {
+		fprintf(stderr, "Failed to open file %s", path);
+		return false;
+	}
+	*bytes_read = fread(rom, 1, ROM_SIZE, file_ptr);
+	fclose(file_ptr);
+	return true;
+}
+
 void init_state(CpuState *cpu_state, const uint8_t *rom) {
 	initialize_memory(cpu_state->memory, rom);
+	cpu_state->dirty_pages = ALL_MEMORY_PAGES_DIRTY;
 	memset(cpu_state->stack, 0, STACK_SIZE * 2);
 	cpu_state->stack_size = 0;
 
@@ -53,15 +71,38 @@ void init_state(CpuState *cpu_state, const uint8_t *rom) {
 
 	memset(cpu_state->display, 0, SCREEN_SIZE_BYTES);
 	cpu_state->sound_playing = false;
+	cpu_state->dirty_rows = ALL_SCREEN_ROWS_DIRTY;
+	cpu_state->display_changed = true;
 
 	memset(cpu_state->keyboard, 0, NUMBER_OF_KEYS);
+	cpu_state->waiting_for_key = false;
+	cpu_state->key_wait_pressed = 0;
 
 	initialize_timer(&cpu_state->delay_timer);
 	initialize_timer(&cpu_state->sound_timer);
+	cpu_state->cycles = 0;
+	cpu_state->cycles_per_tick = 0;
+	cpu_state->cycles_until_tick = 0;
+
+	seed_random(cpu_state, DEFAULT_RANDOM_SEED);
+
+	cpu_state->quirk_profile = QUIRKS_DEFAULT;
+	// Keeps counting up from the previous ROM, so compiled code of that one isn't mistaken for this one's
+	clear_decode_cache(cpu_state);
+}
+
+/*
+ * Selects the quirks of a state, right after initializing it.
+ * Instructions already decoded are dropped, so they get the handlers of the new profile.
+ */
+void set_quirk_profile(CpuState *cpu_state, QuirkProfile profile) {
+	cpu_state->quirk_profile = profile;
+	clear_decode_cache(cpu_state);
 }
 
 void copy_state(CpuState *dst, const CpuState *src) {
 	memcpy(dst->memory, src->memory, MEMORY_SIZE);
+	dst->dirty_pages = ALL_MEMORY_PAGES_DIRTY;
 	memcpy(dst->stack, src->stack, STACK_SIZE * 2);
 	dst->stack_size = src->stack_size;
 
@@ -71,13 +112,30 @@ void copy_state(CpuState *dst, const CpuState *src) {
 
 	memcpy(dst->display, src->display, SCREEN_SIZE_BYTES);
 	dst->sound_playing = src->sound_playing;
+	dst->dirty_rows = ALL_SCREEN_ROWS_DIRTY;
+	dst->display_changed = true;
 
 	memcpy(dst->keyboard, src->keyboard, NUMBER_OF_KEYS);
+	dst->waiting_for_key = src->waiting_for_key;
+	dst->key_wait_pressed = src->key_wait_pressed;
 
 	copy_timer(&dst->delay_timer, &src->delay_timer);
 	copy_timer(&dst->sound_timer, &src->sound_timer);
+	dst->cycles = src->cycles;
+	dst->cycles_per_tick = src->cycles_per_tick;
+	dst->cycles_until_tick = src->cycles_until_tick;
+
+	dst->random_state = src->random_state;
+
+	dst->quirk_profile = src->quirk_profile;
+	clear_decode_cache(dst);
 }
 
+/*
+ * Compares everything that decides how the state runs from here.
+ * The cycle count isn't compared, it only tracks how many instructions ran, which differs between the cores that count
+ * them and the loops that just execute them.
+ */
 bool state_equals(const CpuState *left, const CpuState *right) {
 	return (
 		memcmp(left->memory, right->memory, MEMORY_SIZE) == 0
@@ -98,8 +156,20 @@ bool state_equals(const CpuState *left, const CpuState *right) {
 		&&
 		memcmp(left->keyboard, right->keyboard, NUMBER_OF_KEYS) == 0
 		&&
+		left->waiting_for_key == right->waiting_for_key
+		&&
+		left->key_wait_pressed == right->key_wait_pressed
+		&&
 		timer_equals(&left->delay_timer, &right->delay_timer)
 		&&
 		timer_equals(&left->sound_timer, &right->sound_timer)
+		&&
+		left->cycles_per_tick == right->cycles_per_tick
+		&&
+		left->cycles_until_tick == right->cycles_until_tick
+		&&
+		left->random_state == right->random_state
+		&&
+		left->quirk_profile == right->quirk_profile
 	);
 }
\ No newline at end of file
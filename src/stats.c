@@ -0,0 +1,141 @@
+#include "stats.h"
+
+// Same names as the handlers in instructions.h
+const char *const OPCODE_HANDLER_NAMES[NUMBER_OF_OPCODES] = {
+	[OPCODE_INVALID] = "invalid",
+	[OPCODE_CLEAR_SCREEN] = "clear_screen",
+	[OPCODE_RETURN_SUBROUTINE] = "return_subroutine",
+	[OPCODE_JUMP] = "jump",
+	[OPCODE_JUMP_SUBROUTINE] = "jump_subroutine",
+	[OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE] = "skip_if_equal_to_immediate",
+	[OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE] = "skip_if_different_from_immediate",
+	[OPCODE_SKIP_IF_REGISTERS_EQUAL] = "skip_if_registers_equal",
+	[OPCODE_SET_REGISTER_TO_IMMEDIATE] = "set_register_to_immediate",
+	[OPCODE_ADD_IMMEDIATE_TO_REGISTER] = "add_immediate_to_register",
+	[OPCODE_COPY_REGISTER] = "copy_register",
+	[OPCODE_BITWISE_OR] = "bitwise_or",
+	[OPCODE_BITWISE_AND] = "bitwise_and",
+	[OPCODE_BITWISE_XOR] = "bitwise_xor",
+	[OPCODE_ADD_REGISTER_TO_REGISTER] = "add_register_to_register",
+	[OPCODE_SUB_REGISTER_FROM_REGISTER] = "sub_register_from_register",
+	[OPCODE_SHIFT_RIGHT] = "shift_right",
+	[OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER] = "negative_sub_register_from_register",
+	[OPCODE_SHIFT_LEFT] = "shift_left",
+	[OPCODE_SKIP_IF_REGISTERS_DIFFERENT] = "skip_if_registers_different",
+	[OPCODE_SET_INDEX_REGISTER] = "set_index_register",
+	[OPCODE_JUMP_WITH_OFFSET] = "jump_with_offset",
+	[OPCODE_SET_REGISTER_TO_BITMASKED_RAND] = "set_register_to_bitmasked_rand",
+	[OPCODE_DRAW] = "draw",
+	[OPCODE_SKIP_PRESSED] = "skip_pressed",
+	[OPCODE_SKIP_NOT_PRESSED] = "skip_not_pressed",
+	[OPCODE_READ_DELAY] = "read_delay",
+	[OPCODE_WAIT_FOR_KEY] = "wait_for_key",
+	[OPCODE_SET_DELAY] = "set_delay",
+	[OPCODE_SET_SOUND] = "set_sound",
+	[OPCODE_ADD_TO_INDEX] = "add_to_index",
+	[OPCODE_POINT_TO_CHAR] = "point_to_char",
+	[OPCODE_DECIMAL_DECODE] = "decimal_decode",
+	[OPCODE_SAVE_REGISTERS] = "save_registers",
+	[OPCODE_LOAD_REGISTERS] = "load_registers",
+};
+
+#if CHIP8_STATS
+
+#include <stdlib.h>
+#include <time.h>
+
+ExecutionStats execution_stats;
+
+// Set by the signal handler, the dump itself happens on the next instruction, outside of the handler
+volatile sig_atomic_t execution_stats_dump_requested = 0;
+
+uint64_t read_stats_nanoseconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void request_execution_stats_dump(__attribute__((unused)) int signal_number) {
+	execution_stats_dump_requested = 1;
+}
+
+/*
+ * Installed before main, so every executable built with stats reports them without any setup.
+ */
+__attribute__((constructor)) void init_execution_stats() {
+	atexit(dump_execution_stats);
+#ifdef STATS_DUMP_SIGNAL
+	signal(STATS_DUMP_SIGNAL, request_execution_stats_dump);
+#endif
+}
+
+void execute_with_stats(CpuState *cpu_state, uint16_t instruction, Instruction function, Opcode opcode) {
+	uint64_t count = STATS_ADD(instructions, 1);
+	STATS_ADD(executions[opcode], 1);
+
+	if (count % STATS_TIME_SAMPLE_INTERVAL == 0) {
+		uint64_t start = read_stats_nanoseconds();
+		function(cpu_state, instruction);
+		STATS_ADD(sampled_nanoseconds[opcode], read_stats_nanoseconds() - start);
+		STATS_ADD(samples[opcode], 1);
+	} else {
+		function(cpu_state, instruction);
+	}
+
+	if (opcode == OPCODE_DRAW) {
+		STATS_ADD(draws, 1);
+		STATS_ADD(collisions, cpu_state->register_bank[0xF]);
+	}
+
+	if (execution_stats_dump_requested) {
+		execution_stats_dump_requested = 0;
+		dump_execution_stats();
+	}
+}
+
+/*
+ * Writes the totals, and a line per handler sorted by executions.
+ */
+void write_execution_stats(FILE *file_ptr) {
+	uint64_t instructions = execution_stats.instructions;
+	fprintf(
+		file_ptr, "%llu instruction(s), %llu draw(s), %llu pixel(s) flipped, %llu collision(s)\n",
+		(unsigned long long) instructions, (unsigned long long) execution_stats.draws,
+		(unsigned long long) execution_stats.pixels_flipped, (unsigned long long) execution_stats.collisions
+	);
+	fprintf(file_ptr, "%-36s %16s %8s %12s\n", "handler", "executions", "share", "sampled ns");
+
+	bool printed[NUMBER_OF_OPCODES] = {false};
+	for (;;) {
+		int next = -1;
+		for (int opcode = 0; opcode < NUMBER_OF_OPCODES; ++opcode) {
+			uint64_t executions = execution_stats.executions[opcode];
+			if (!printed[opcode] && executions > 0 && (next < 0 || executions > execution_stats.executions[next])) {
+				next = opcode;
+			}
+		}
+		if (next < 0) {
+			break;
+		}
+		printed[next] = true;
+
+		uint64_t executions = execution_stats.executions[next];
+		uint64_t samples = execution_stats.samples[next];
+		fprintf(
+			file_ptr, "%-36s %16llu %7.2f%% %12.1f\n",
+			OPCODE_HANDLER_NAMES[next], (unsigned long long) executions, 100.0 * executions / instructions,
+			samples > 0 ? (double) execution_stats.sampled_nanoseconds[next] / samples : 0.0
+		);
+	}
+}
+
+void dump_execution_stats() {
+	const char *path = getenv(ENV_STATS_FILE);
+	FILE *file_ptr = path != NULL ? fopen(path, "a") : NULL;
+	write_execution_stats(file_ptr != NULL ? file_ptr : stderr);
+	if (file_ptr != NULL) {
+		fclose(file_ptr);
+	}
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include "superinstructions.h"
+#include "cpu.h"
+
+const uint8_t SUPERINSTRUCTION_LENGTHS[NUMBER_OF_SUPERINSTRUCTIONS] = {
+	[SUPERINSTRUCTION_NONE] = 1,
+	[SUPERINSTRUCTION_SET_REGISTER_PAIR] = 2,
+	[SUPERINSTRUCTION_SET_INDEX_AND_DRAW] = 2,
+	[SUPERINSTRUCTION_SKIP_EQUAL_OR_JUMP] = 2,
+	[SUPERINSTRUCTION_SKIP_DIFFERENT_OR_JUMP] = 2,
+	[SUPERINSTRUCTION_WAIT_FOR_DELAY] = 3,
+	[SUPERINSTRUCTION_SKIP_PRESSED_OR_JUMP] = 2,
+	[SUPERINSTRUCTION_SKIP_NOT_PRESSED_OR_JUMP] = 2,
+	[SUPERINSTRUCTION_JUMP_TO_SELF] = 1,
+	[SUPERINSTRUCTION_WAIT_FOR_KEY] = 1,
+};
+
+/*
+ * Sequence starting at address, if any, whether or not fusing is enabled.
+ */
+Superinstruction recognize_superinstruction(CpuState *cpu_state, uint16_t address) {
+	address &= ADDRESS_BITMASK;
+	// Sequences never wrap around the end of the memory
+	if (address + SUPERINSTRUCTION_MAX_LENGTH * INSTRUCTION_SIZE > MEMORY_SIZE) {
+		return SUPERINSTRUCTION_NONE;
+	}
+	uint16_t first = read_word_memory(cpu_state, address);
+	uint16_t second = read_word_memory(cpu_state, address + INSTRUCTION_SIZE);
+	uint16_t third = read_word_memory(cpu_state, address + 2 * INSTRUCTION_SIZE);
+
+	switch (decode_opcode(first)) {
+		case OPCODE_SET_REGISTER_TO_IMMEDIATE:
+			if (decode_opcode(second) == OPCODE_SET_REGISTER_TO_IMMEDIATE) {
+				return SUPERINSTRUCTION_SET_REGISTER_PAIR;
+			}
+			break;
+		case OPCODE_SET_INDEX_REGISTER:
+			if (decode_opcode(second) == OPCODE_DRAW) {
+				return SUPERINSTRUCTION_SET_INDEX_AND_DRAW;
+			}
+			break;
+		case OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE:
+			if (decode_opcode(second) == OPCODE_JUMP) {
+				return SUPERINSTRUCTION_SKIP_EQUAL_OR_JUMP;
+			}
+			break;
+		case OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE:
+			if (decode_opcode(second) == OPCODE_JUMP) {
+				return SUPERINSTRUCTION_SKIP_DIFFERENT_OR_JUMP;
+			}
+			break;
+		case OPCODE_SKIP_PRESSED:
+			if (decode_opcode(second) == OPCODE_JUMP) {
+				return SUPERINSTRUCTION_SKIP_PRESSED_OR_JUMP;
+			}
+			break;
+		case OPCODE_SKIP_NOT_PRESSED:
+			if (decode_opcode(second) == OPCODE_JUMP) {
+				return SUPERINSTRUCTION_SKIP_NOT_PRESSED_OR_JUMP;
+			}
+			break;
+		case OPCODE_JUMP:
+			if (extract_immediate_from_nnn(first) == address) {
+				return SUPERINSTRUCTION_JUMP_TO_SELF;
+			}
+			break;
+		case OPCODE_WAIT_FOR_KEY:
+			return SUPERINSTRUCTION_WAIT_FOR_KEY;
+		case OPCODE_READ_DELAY:
+			if (
+				decode_opcode(second) == OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE &&
+				extract_register_from_x(second) == extract_register_from_x(first) &&
+				decode_opcode(third) == OPCODE_JUMP
+			) {
+				return SUPERINSTRUCTION_WAIT_FOR_DELAY;
+			}
+			break;
+		default:
+			break;
+	}
+	return SUPERINSTRUCTION_NONE;
+}
+
+/*
+ * Sequence to fuse at address, if any. Only the memory is looked at, so the result stays valid for as long as the
+ * decode cache entry does.
+ */
+Superinstruction match_superinstruction(
+	__attribute__((unused)) CpuState *cpu_state, __attribute__((unused)) uint16_t address
+) {
+#if CHIP8_SUPERINSTRUCTIONS && !CHIP8_STATS && !CHIP8_PROFILE
+	return recognize_superinstruction(cpu_state, address);
+#else
+	return SUPERINSTRUCTION_NONE;
+#endif
+}
+
+/*
+ * Jumps to target, at the end of an iteration of the sequence that started at start and ran executed instructions.
+ * Returns the instructions executed, which is more than one iteration if the jump goes back to the start: the next
+ * iteration would then see the same state and do the same, so every whole iteration that fits in available is skipped.
+ */
+uint32_t jump_from_sequence(CpuState *cpu_state, uint16_t start, uint16_t target, uint32_t executed, uint32_t available) {
+	cpu_state->program_counter = target;
+	if (target != start) {
+		return executed;
+	}
+	return (available / executed) * executed;
+}
+
+/*
+ * Runs the sequence starting with decoded, which has already been fetched, and returns the instructions executed.
+ * A taken skip jumps over the rest of the sequence, so fewer than its length may run, and idle loops run for as long
+ * as available allows.
+ * The caller must allow for at least the whole length, and must not let virtual timers tick or keys change within
+ * available instructions.
+ */
+uint32_t execute_superinstruction(CpuState *cpu_state, DecodedInstruction *decoded, uint32_t available) {
+	uint8_t *registers = cpu_state->register_bank;
+	uint16_t next_address = cpu_state->program_counter & ADDRESS_BITMASK;
+	uint16_t start = next_address - INSTRUCTION_SIZE;
+	uint16_t next = read_word_memory(cpu_state, next_address);
+
+	switch (decoded->superinstruction) {
+		case SUPERINSTRUCTION_SET_REGISTER_PAIR:
+			registers[decoded->x] = decoded->nn;
+			registers[extract_register_from_x(next)] = extract_immediate_from_xnn(next);
+			cpu_state->program_counter += INSTRUCTION_SIZE;
+			return 2;
+
+		case SUPERINSTRUCTION_SET_INDEX_AND_DRAW:
+			cpu_state->index_register = decoded->nnn;
+			cpu_state->program_counter += INSTRUCTION_SIZE;
+			draw(cpu_state, next);
+			return 2;
+
+		case SUPERINSTRUCTION_SKIP_EQUAL_OR_JUMP:
+			if (registers[decoded->x] == decoded->nn) {
+				cpu_state->program_counter += INSTRUCTION_SIZE;
+				return 1;
+			}
+			return jump_from_sequence(cpu_state, start, extract_immediate_from_nnn(next), 2, available);
+
+		case SUPERINSTRUCTION_SKIP_DIFFERENT_OR_JUMP:
+			if (registers[decoded->x] != decoded->nn) {
+				cpu_state->program_counter += INSTRUCTION_SIZE;
+				return 1;
+			}
+			return jump_from_sequence(cpu_state, start, extract_immediate_from_nnn(next), 2, available);
+
+		case SUPERINSTRUCTION_SKIP_PRESSED_OR_JUMP:
+			if (cpu_state->keyboard[registers[decoded->x] & 0x0F]) {
+				cpu_state->program_counter += INSTRUCTION_SIZE;
+				return 1;
+			}
+			return jump_from_sequence(cpu_state, start, extract_immediate_from_nnn(next), 2, available);
+
+		case SUPERINSTRUCTION_SKIP_NOT_PRESSED_OR_JUMP:
+			if (!cpu_state->keyboard[registers[decoded->x] & 0x0F]) {
+				cpu_state->program_counter += INSTRUCTION_SIZE;
+				return 1;
+			}
+			return jump_from_sequence(cpu_state, start, extract_immediate_from_nnn(next), 2, available);
+
+		case SUPERINSTRUCTION_JUMP_TO_SELF:
+			return jump_from_sequence(cpu_state, start, decoded->nnn, 1, available);
+
+		case SUPERINSTRUCTION_WAIT_FOR_KEY:
+			// Parks for as long as allowed while halted, polling again would find the same keys
+			decoded->function(cpu_state, decoded->instruction);
+			return is_waiting_for_key(cpu_state) ? available : 1;
+
+		case SUPERINSTRUCTION_WAIT_FOR_DELAY: {
+			registers[decoded->x] = read_delay_timer(cpu_state);
+			if (registers[decoded->x] == extract_immediate_from_xnn(next)) {
+				cpu_state->program_counter += 2 * INSTRUCTION_SIZE;
+				return 2;
+			}
+			uint16_t jump = read_word_memory(cpu_state, next_address + INSTRUCTION_SIZE);
+			return jump_from_sequence(cpu_state, start, extract_immediate_from_nnn(jump), 3, available);
+		}
+
+		default:
+			execute(cpu_state, decoded->instruction, decoded->function);
+			return 1;
+	}
+}
+
+/*
+ * True if the PC is at the start of an idle loop, one that can only be left once a timer or the keys change, so a
+ * frontend can sleep until then instead of running it.
+ */
+bool is_idle_loop(CpuState *cpu_state) {
+	uint16_t address = cpu_state->program_counter & ADDRESS_BITMASK;
+	Superinstruction superinstruction = recognize_superinstruction(cpu_state, address);
+
+	switch (superinstruction) {
+		case SUPERINSTRUCTION_JUMP_TO_SELF:
+			return true;
+		case SUPERINSTRUCTION_WAIT_FOR_KEY:
+			return is_waiting_for_key(cpu_state);
+		case SUPERINSTRUCTION_SKIP_EQUAL_OR_JUMP:
+		case SUPERINSTRUCTION_SKIP_DIFFERENT_OR_JUMP:
+		case SUPERINSTRUCTION_SKIP_PRESSED_OR_JUMP:
+		case SUPERINSTRUCTION_SKIP_NOT_PRESSED_OR_JUMP:
+		case SUPERINSTRUCTION_WAIT_FOR_DELAY: {
+			// The jump closing the sequence
+			uint8_t length = SUPERINSTRUCTION_LENGTHS[superinstruction];
+			uint16_t jump = read_word_memory(cpu_state, address + (length - 1) * INSTRUCTION_SIZE);
+			return extract_immediate_from_nnn(jump) == address;
+		}
+		default:
+			return false;
+	}
+}
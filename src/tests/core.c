@@ -8,6 +8,11 @@
 #include "screen.h"
 #include "stack.h"
 #include "timers.h"
+#include "decode_cache.h"
+#include "snapshot.h"
+#include "rewind.h"
+#include "save_state.h"
+#include "debug.h"
 
 #include "mock_time_millis.h"
 
@@ -181,6 +186,61 @@ void test_screen_write_pixel_to_screen() {
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
 }
 
+void test_screen_xor_sprite_row_to_screen() {
+	// Straddles the first two bytes of row 2
+	TEST_ASSERT_FALSE(xor_sprite_row_to_screen(&cpu_state, 4, 2, 0b11000001));
+	TEST_ASSERT_EQUAL_HEX8(0b00110000, cpu_state.display[2 * 8]);
+	TEST_ASSERT_EQUAL_HEX8(0b00001000, cpu_state.display[2 * 8 + 1]);
+
+	TEST_ASSERT_TRUE(xor_sprite_row_to_screen(&cpu_state, 5, 2, 0b10000000));
+	TEST_ASSERT_EQUAL_HEX8(0b00010000, cpu_state.display[2 * 8]);
+
+	// Clipped at the right edge, without wrapping into the next row
+	TEST_ASSERT_FALSE(xor_sprite_row_to_screen(&cpu_state, SCREEN_WIDTH - 2, 3, 0xFF));
+	TEST_ASSERT_EQUAL_HEX8(0b11000000, cpu_state.display[3 * 8 + 7]);
+	TEST_ASSERT_EQUAL_HEX8(0, cpu_state.display[4 * 8]);
+}
+
+void test_screen_dirty_rows() {
+	consume_dirty_screen_rows(&cpu_state);
+	TEST_ASSERT_FALSE(is_display_changed(&cpu_state));
+
+	// Blank sprite rows don't change anything
+	xor_sprite_row_to_screen(&cpu_state, 0, 3, 0);
+	TEST_ASSERT_FALSE(is_display_changed(&cpu_state));
+
+	xor_sprite_row_to_screen(&cpu_state, 0, 3, 0xFF);
+	write_pixel_to_screen(&cpu_state, 0, 31, COLOR_WHITE);
+	TEST_ASSERT_TRUE(is_display_changed(&cpu_state));
+	TEST_ASSERT_EQUAL_HEX32((1u << 3) | (1u << 31), consume_dirty_screen_rows(&cpu_state));
+	TEST_ASSERT_FALSE(is_display_changed(&cpu_state));
+	TEST_ASSERT_EQUAL_HEX32(0, consume_dirty_screen_rows(&cpu_state));
+
+	fill_screen(&cpu_state, COLOR_BLACK);
+	TEST_ASSERT_EQUAL_HEX32(ALL_SCREEN_ROWS_DIRTY, consume_dirty_screen_rows(&cpu_state));
+}
+
+void test_screen_expand_display_to_argb() {
+	// Rows are padded to check the pitch is respected
+	const size_t row_pixels = SCREEN_WIDTH + 3;
+	uint32_t pixels[SCREEN_HEIGHT * (SCREEN_WIDTH + 3)];
+	memset(pixels, 0, sizeof(pixels));
+
+	for (int i = 0; i < SCREEN_SIZE_BYTES; ++i) {
+		cpu_state.display[i] = (uint8_t) (i * 37 + 11);
+	}
+
+	expand_display_to_argb(&cpu_state, pixels, row_pixels * sizeof(uint32_t), 0, SCREEN_HEIGHT, 0xFFFFFFFF, 0xFF000000);
+
+	for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+		for (int x = 0; x < SCREEN_WIDTH; ++x) {
+			uint32_t expected = read_pixel_from_screen(&cpu_state, x, y) ? 0xFFFFFFFF : 0xFF000000;
+			TEST_ASSERT_EQUAL_HEX32(expected, pixels[y * row_pixels + x]);
+		}
+		TEST_ASSERT_EQUAL_HEX32(0, pixels[y * row_pixels + SCREEN_WIDTH]);
+	}
+}
+
 void test_stack() {
 	CpuState expected_cpu_state;
 	init_state(&expected_cpu_state, NULL);
@@ -305,6 +365,278 @@ void test_timer_refresh_timer() {
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
 }
 
+void dummy_instruction(__attribute__((unused)) CpuState *_cpu_state, __attribute__((unused)) uint16_t _instruction) {
+
+}
+
+void test_timer_virtual_timers() {
+	mock_set_time_millis(1000);
+	write_delay_timer(&cpu_state, 10);
+	mock_set_time_millis(1050);
+
+	// Switching keeps the current value, 3 ticks have elapsed
+	use_virtual_timers(&cpu_state, 4);
+	TEST_ASSERT_TRUE(has_virtual_timers(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT8(7, read_delay_timer(&cpu_state));
+
+	// The wall clock no longer matters
+	mock_set_time_millis(5000);
+	TEST_ASSERT_EQUAL_UINT8(7, read_delay_timer(&cpu_state));
+
+	TEST_ASSERT_EQUAL_UINT32(4, cycles_until_timer_tick(&cpu_state, 100));
+	TEST_ASSERT_EQUAL_UINT32(2, cycles_until_timer_tick(&cpu_state, 2));
+	advance_cycles(&cpu_state, 3);
+	TEST_ASSERT_EQUAL_UINT8(7, read_delay_timer(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT32(1, cycles_until_timer_tick(&cpu_state, 100));
+	advance_cycles(&cpu_state, 1);
+	TEST_ASSERT_EQUAL_UINT8(6, read_delay_timer(&cpu_state));
+	advance_cycles(&cpu_state, 4 * 10);
+	TEST_ASSERT_EQUAL_UINT8(0, read_delay_timer(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT64(44, cpu_state.cycles);
+
+	write_sound_timer(&cpu_state, 2);
+	update_beeper_status(&cpu_state);
+	TEST_ASSERT_TRUE(cpu_state.sound_playing);
+	advance_cycles(&cpu_state, 8);
+	update_beeper_status(&cpu_state);
+	TEST_ASSERT_FALSE(cpu_state.sound_playing);
+
+	write_delay_timer(&cpu_state, 30);
+	use_wall_clock_timers(&cpu_state);
+	TEST_ASSERT_FALSE(has_virtual_timers(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT8(30, read_delay_timer(&cpu_state));
+	mock_set_time_millis(5500);
+	TEST_ASSERT_EQUAL_UINT8(0, read_delay_timer(&cpu_state));
+}
+
+void test_decode_cache_store_and_lookup() {
+	TEST_ASSERT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START));
+
+	store_decoded_instruction(&cpu_state, ROM_ADDRESS_START, 0xD12F, 1, dummy_instruction);
+	DecodedInstruction *decoded = lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START);
+
+	TEST_ASSERT_NOT_NULL(decoded);
+	TEST_ASSERT(decoded->function == dummy_instruction);
+	TEST_ASSERT_EQUAL_UINT16(0xD12F, decoded->instruction);
+	TEST_ASSERT_EQUAL_UINT16(0x12F, decoded->nnn);
+	TEST_ASSERT_EQUAL_UINT8(0x1, decoded->x);
+	TEST_ASSERT_EQUAL_UINT8(0x2, decoded->y);
+	TEST_ASSERT_EQUAL_UINT8(0xF, decoded->n);
+	TEST_ASSERT_EQUAL_UINT8(0x2F, decoded->nn);
+}
+
+void test_decode_cache_invalidated_by_memory_writes() {
+	for (uint16_t address = ROM_ADDRESS_START; address < ROM_ADDRESS_START + 8; address += 2) {
+		store_decoded_instruction(&cpu_state, address, 0x6000, 1, dummy_instruction);
+	}
+
+	// Second byte of the first instruction
+	write_byte_memory(&cpu_state, ROM_ADDRESS_START + 1, 0x12);
+	TEST_ASSERT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START));
+	TEST_ASSERT_NOT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START + 2));
+
+	// A word straddling the third and fourth instructions
+	write_word_memory(&cpu_state, ROM_ADDRESS_START + 5, 0x1234);
+	TEST_ASSERT_NOT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START + 2));
+	TEST_ASSERT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START + 4));
+	TEST_ASSERT_NULL(lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START + 6));
+}
+
+void test_decode_cache_cleared_on_copy() {
+	CpuState other_cpu_state;
+	init_state(&other_cpu_state, NULL);
+	store_decoded_instruction(&other_cpu_state, ROM_ADDRESS_START, 0x6000, 1, dummy_instruction);
+
+	copy_state(&other_cpu_state, &cpu_state);
+	TEST_ASSERT_NULL(lookup_decoded_instruction(&other_cpu_state, ROM_ADDRESS_START));
+}
+
+void test_snapshot_delta_pages() {
+	Snapshot snapshots[3];
+	CpuState expected_cpu_states[3];
+
+	TEST_ASSERT_TRUE(take_snapshot(&snapshots[0], &cpu_state, true));
+	TEST_ASSERT_TRUE(is_full_snapshot(&snapshots[0]));
+	copy_state(&expected_cpu_states[0], &cpu_state);
+
+	// Straddles two pages
+	write_word_memory(&cpu_state, 0x300 + MEMORY_PAGE_SIZE - 1, 0x1234);
+	write_register_bank(&cpu_state, 3, 0x33);
+	TEST_ASSERT_TRUE(take_snapshot(&snapshots[1], &cpu_state, false));
+	TEST_ASSERT_EQUAL_UINT64((uint64_t) 3 << (0x300 / MEMORY_PAGE_SIZE), snapshots[1].pages);
+	copy_state(&expected_cpu_states[1], &cpu_state);
+
+	write_byte_memory(&cpu_state, 0x300, 0x56);
+	write_byte_memory(&cpu_state, 0xFFF, 0x78);
+	write_register_pc(&cpu_state, 0x400);
+	set_quirk_profile(&cpu_state, QUIRKS_COSMAC_VIP);
+	TEST_ASSERT_TRUE(take_snapshot(&snapshots[2], &cpu_state, false));
+	TEST_ASSERT_EQUAL_UINT64(
+		((uint64_t) 1 << (0x300 / MEMORY_PAGE_SIZE)) | ((uint64_t) 1 << (MEMORY_PAGES - 1)), snapshots[2].pages
+	);
+	copy_state(&expected_cpu_states[2], &cpu_state);
+	TEST_ASSERT_EQUAL_UINT64(0, cpu_state.dirty_pages);
+
+	for (size_t count = 1; count <= 3; ++count) {
+		CpuState restored_cpu_state;
+		init_state(&restored_cpu_state, NULL);
+		write_byte_memory(&restored_cpu_state, 0x300, 0xAA);
+
+		restore_snapshots(&restored_cpu_state, snapshots, count);
+		TEST_ASSERT(state_equals(&expected_cpu_states[count - 1], &restored_cpu_state));
+	}
+
+	for (int i = 0; i < 3; ++i) {
+		free_snapshot(&snapshots[i]);
+	}
+}
+
+#define REWIND_TEST_FRAMES 200
+
+RewindBuffer rewind_buffer;
+uint8_t rewind_history[REWIND_TEST_FRAMES][PACKED_STATE_SIZE];
+
+void test_rewind_push_and_pop() {
+	use_virtual_timers(&cpu_state, 4);
+	// Small enough that the oldest keyframes get evicted
+	TEST_ASSERT_TRUE(init_rewind_buffer(&rewind_buffer, 100, 4 * 1024, 8));
+
+	for (int frame = 0; frame < REWIND_TEST_FRAMES; ++frame) {
+		write_byte_memory(&cpu_state, 0x300 + (frame * 37) % 0x800, frame);
+		write_register_bank(&cpu_state, frame % REGISTERS, frame * 3);
+		write_register_pc(&cpu_state, ROM_ADDRESS_START + 2 * frame);
+		xor_sprite_row_to_screen(&cpu_state, frame % SCREEN_WIDTH, frame % SCREEN_HEIGHT, 0xA5);
+		if (frame % 10 == 0) {
+			write_delay_timer(&cpu_state, frame);
+		}
+		if (frame % 50 == 0) {
+			set_quirk_profile(&cpu_state, (frame / 50) % NUMBER_OF_QUIRK_PROFILES);
+		}
+		advance_cycles(&cpu_state, 3);
+
+		pack_state(&cpu_state, rewind_history[frame]);
+		TEST_ASSERT_TRUE(push_rewind_frame(&rewind_buffer, &cpu_state));
+	}
+	TEST_ASSERT_TRUE(rewind_buffer.count > 1);
+	TEST_ASSERT_TRUE(rewind_buffer.count < REWIND_TEST_FRAMES);
+	TEST_ASSERT_TRUE(rewind_buffer_usage(&rewind_buffer) <= rewind_buffer.capacity);
+	TEST_ASSERT_TRUE(get_rewind_entry(&rewind_buffer, 0)->keyframe);
+
+	uint8_t packed[PACKED_STATE_SIZE];
+	int frame = REWIND_TEST_FRAMES - 1;
+	while (pop_rewind_frame(&rewind_buffer, &cpu_state)) {
+		--frame;
+		pack_state(&cpu_state, packed);
+		TEST_ASSERT_EQUAL_UINT8_ARRAY(rewind_history[frame], packed, PACKED_STATE_SIZE);
+	}
+	TEST_ASSERT_EQUAL_UINT32(1, rewind_buffer.count);
+	// Popping the last frame leaves the state at it
+	TEST_ASSERT_TRUE(frame > 0);
+	pack_state(&cpu_state, packed);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(rewind_history[frame], packed, PACKED_STATE_SIZE);
+
+	free_rewind_buffer(&rewind_buffer);
+}
+
+#define SAVE_STATE_TEST_PATH "test_save_states.bin"
+
+void test_save_state_library() {
+	CpuState expected_cpu_states[2];
+
+	write_byte_memory(&cpu_state, 0x300, 0xAB);
+	write_register_pc(&cpu_state, 0x0ABC);
+	write_register_bank(&cpu_state, 0xF, 0x56);
+	stack_push(&cpu_state, 0x0321);
+	set_key_pressed(&cpu_state, 0xA, true);
+	xor_sprite_row_to_screen(&cpu_state, 3, 5, 0xF0);
+	mock_set_time_millis(1000);
+	write_delay_timer(&cpu_state, 42);
+	copy_state(&expected_cpu_states[0], &cpu_state);
+
+	uint8_t record[SAVE_STATE_SIZE];
+	encode_save_state(&cpu_state, record);
+	// Little endian, whatever the host
+	size_t program_counter_offset = SAVE_STATE_HEADER_SIZE + MEMORY_SIZE + STACK_SIZE * 2 + 1;
+	TEST_ASSERT_EQUAL_UINT8(0xBC, record[program_counter_offset]);
+	TEST_ASSERT_EQUAL_UINT8(0x0A, record[program_counter_offset + 1]);
+
+	use_virtual_timers(&cpu_state, 7);
+	advance_cycles(&cpu_state, 100);
+	copy_state(&expected_cpu_states[1], &cpu_state);
+
+	FILE *file_ptr = fopen(SAVE_STATE_TEST_PATH, "wb");
+	TEST_ASSERT_NOT_NULL(file_ptr);
+	TEST_ASSERT_TRUE(write_save_state(file_ptr, &expected_cpu_states[0]));
+	TEST_ASSERT_TRUE(write_save_state(file_ptr, &expected_cpu_states[1]));
+	fclose(file_ptr);
+
+	SaveStateLibrary library;
+	TEST_ASSERT_TRUE(open_save_state_library(&library, SAVE_STATE_TEST_PATH));
+	TEST_ASSERT_EQUAL_size_t(2, count_save_states(&library));
+	for (size_t i = 0; i < 2; ++i) {
+		CpuState loaded_cpu_state;
+		init_state(&loaded_cpu_state, NULL);
+		TEST_ASSERT_TRUE(load_save_state(&library, i, &loaded_cpu_state));
+		TEST_ASSERT(state_equals(&expected_cpu_states[i], &loaded_cpu_state));
+		TEST_ASSERT_EQUAL_UINT64(expected_cpu_states[i].cycles, loaded_cpu_state.cycles);
+		TEST_ASSERT_EQUAL_UINT32(expected_cpu_states[i].cycles_until_tick, loaded_cpu_state.cycles_until_tick);
+	}
+	TEST_ASSERT_FALSE(load_save_state(&library, 2, &cpu_state));
+	close_save_state_library(&library);
+	remove(SAVE_STATE_TEST_PATH);
+
+	// Records with a stack size or PC out of range are rejected
+	record[program_counter_offset - 1] = STACK_SIZE + 1;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	record[program_counter_offset - 1] = 1;
+	record[program_counter_offset + 1] = 0x10;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	record[program_counter_offset + 1] = 0x0A;
+	record[program_counter_offset + 3] = 0x10;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	record[program_counter_offset + 3] = 0x00;
+	TEST_ASSERT_TRUE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+
+	// And so are records with the virtual timers past their next tick, or a random state stuck at zero
+	uint8_t valid_record[SAVE_STATE_SIZE];
+	encode_save_state(&expected_cpu_states[1], valid_record);
+	size_t cycles_per_tick_offset = SAVE_STATE_SIZE - 1 - 8 - 4 - 4;
+	TEST_ASSERT_EQUAL_UINT8(7, valid_record[cycles_per_tick_offset]);
+	memcpy(record, valid_record, SAVE_STATE_SIZE);
+	record[cycles_per_tick_offset + 4] = 0;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	record[cycles_per_tick_offset + 4] = 8;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	memcpy(record, valid_record, SAVE_STATE_SIZE);
+	memset(&record[cycles_per_tick_offset + 8], 0, 8);
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+	memcpy(record, valid_record, SAVE_STATE_SIZE);
+	TEST_ASSERT_TRUE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+
+	// Records of another version are rejected
+	record[SAVE_STATE_MAGIC_SIZE] = SAVE_STATE_VERSION + 1;
+	TEST_ASSERT_FALSE(decode_save_state(&cpu_state, record, SAVE_STATE_SIZE));
+}
+
+void test_disassemble_instruction() {
+	char buffer[DISASSEMBLY_SIZE];
+
+	disassemble_instruction(OPCODE_DRAW, 0xD125, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("DRAW V1 V2 5", buffer);
+
+	disassemble_instruction(OPCODE_JUMP_SUBROUTINE, 0x2ABC, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("CALL ABC", buffer);
+
+	disassemble_instruction(OPCODE_ADD_IMMEDIATE_TO_REGISTER, 0x7A0F, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("ADDI VA 0F", buffer);
+
+	disassemble_instruction(OPCODE_WAIT_FOR_KEY, 0xF30A, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("KEY V3", buffer);
+
+	disassemble_instruction(OPCODE_INVALID, 0x5121, buffer, sizeof(buffer));
+	TEST_ASSERT_EQUAL_STRING("DATA 5121", buffer);
+}
+
 int main() {
 	UNITY_BEGIN();
 
@@ -325,6 +657,9 @@ int main() {
 	RUN_TEST(test_screen_fill_screen);
 	RUN_TEST(test_screen_read_pixel_from_screen);
 	RUN_TEST(test_screen_write_pixel_to_screen);
+	RUN_TEST(test_screen_xor_sprite_row_to_screen);
+	RUN_TEST(test_screen_dirty_rows);
+	RUN_TEST(test_screen_expand_display_to_argb);
 
 	RUN_TEST(test_stack);
 
@@ -333,5 +668,19 @@ int main() {
 	RUN_TEST(test_timer_write_sound_timer);
 	RUN_TEST(test_timer_refresh_timer);
 
+	RUN_TEST(test_timer_virtual_timers);
+
+	RUN_TEST(test_decode_cache_store_and_lookup);
+	RUN_TEST(test_decode_cache_invalidated_by_memory_writes);
+	RUN_TEST(test_decode_cache_cleared_on_copy);
+
+	RUN_TEST(test_snapshot_delta_pages);
+
+	RUN_TEST(test_rewind_push_and_pop);
+
+	RUN_TEST(test_save_state_library);
+
+	RUN_TEST(test_disassemble_instruction);
+
 	return UNITY_END();
 }
\ No newline at end of file
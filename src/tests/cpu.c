@@ -0,0 +1,908 @@
+#include "unity.h"
+
+#include "state.h"
+#include "cpu.h"
+#include "threaded.h"
+#include "jit.h"
+#include "aot.h"
+#include "farm.h"
+#include "lockstep.h"
+#include "replay.h"
+#include "profiler.h"
+#include "mock_time_millis.h"
+
+#define DIFFERENTIAL_ITERATIONS 2000
+
+CpuState cpu_state;
+JitContext jit;
+CpuState lane_states[LOCKSTEP_MAX_LANES];
+CpuState expected_lane_states[LOCKSTEP_MAX_LANES];
+
+// One of each instruction, operands are filled in randomly
+const uint16_t INSTRUCTION_TEMPLATES[] = {
+	0x00E0, 0x00EE, 0x1000, 0x2000, 0x3000, 0x4000, 0x5000, 0x6000, 0x7000,
+	0x8000, 0x8001, 0x8002, 0x8003, 0x8004, 0x8005, 0x8006, 0x8007, 0x800E,
+	0x9000, 0xA000, 0xB000, 0xC000, 0xD000, 0xE09E, 0xE0A1,
+	0xF007, 0xF00A, 0xF015, 0xF018, 0xF01E, 0xF029, 0xF033, 0xF055, 0xF065
+};
+
+// Masks of the operand bits of each template
+const uint16_t INSTRUCTION_OPERAND_MASKS[] = {
+	0x0000, 0x0000, 0x0FFF, 0x0FFF, 0x0FFF, 0x0FFF, 0x0FF0, 0x0FFF, 0x0FFF,
+	0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0, 0x0FF0,
+	0x0FF0, 0x0FFF, 0x0FFF, 0x0FFF, 0x0FFF, 0x0F00, 0x0F00,
+	0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00, 0x0F00
+};
+
+#define NUMBER_OF_TEMPLATES (sizeof(INSTRUCTION_TEMPLATES) / sizeof(INSTRUCTION_TEMPLATES[0]))
+
+uint32_t test_random_state;
+
+uint32_t test_random() {
+	test_random_state ^= test_random_state << 13;
+	test_random_state ^= test_random_state >> 17;
+	test_random_state ^= test_random_state << 5;
+	return test_random_state;
+}
+
+void setUp() {
+	init_state(&cpu_state, NULL);
+	mock_set_time_millis(1000);
+	test_random_state = 2463534242u;
+}
+
+void tearDown() {
+
+}
+
+// Helpers
+
+void randomize_state(CpuState *state) {
+	for (int i = ROM_ADDRESS_START; i < MEMORY_SIZE; ++i) {
+		state->memory[i] = test_random();
+	}
+	for (int i = 0; i < REGISTERS; ++i) {
+		state->register_bank[i] = test_random();
+	}
+	for (int i = 0; i < SCREEN_SIZE_BYTES; ++i) {
+		state->display[i] = test_random();
+	}
+	for (int i = 0; i < STACK_SIZE; ++i) {
+		state->stack[i] = test_random() & ADDRESS_BITMASK;
+	}
+	// Keep one free slot, and at least one used one, so CALL and RETURN are always valid
+	state->stack_size = 1 + test_random() % (STACK_SIZE - 1);
+	state->index_register = ROM_ADDRESS_START + test_random() % (MEMORY_SIZE - ROM_ADDRESS_START - 0x20);
+	state->program_counter = ROM_ADDRESS_START + 2 * (test_random() % 0x100);
+	for (int i = 0; i < NUMBER_OF_KEYS; ++i) {
+		state->keyboard[i] = test_random() % 8 == 0;
+	}
+	state->delay_timer.set_ts_millis = 900;
+	state->delay_timer.set_value = test_random();
+	state->sound_timer.set_ts_millis = 900;
+	state->sound_timer.set_value = test_random();
+	state->quirk_profile = test_random() % NUMBER_OF_QUIRK_PROFILES;
+	clear_decode_cache(state);
+}
+
+uint16_t random_instruction() {
+	uint32_t template = test_random() % NUMBER_OF_TEMPLATES;
+	return INSTRUCTION_TEMPLATES[template] | (test_random() & INSTRUCTION_OPERAND_MASKS[template]);
+}
+
+void run_reference(CpuState *state, uint32_t count) {
+	for (uint32_t i = 0; i < count; ++i) {
+		uint16_t instruction = fetch(state);
+		execute(state, instruction, QUIRK_INSTRUCTION_HANDLERS[state->quirk_profile][decode_opcode(instruction)]);
+	}
+}
+
+// Runs the same state with the reference loop and with the given core, and checks that they match
+void assert_core_matches_reference(uint32_t (*core)(CpuState *, uint32_t), CpuState *state, uint32_t count) {
+	CpuState expected_cpu_state;
+	copy_state(&expected_cpu_state, state);
+
+	srand(count);
+	run_reference(&expected_cpu_state, count);
+	srand(count);
+	TEST_ASSERT_EQUAL_UINT32(count, core(state, count));
+
+	TEST_ASSERT(state_equals(&expected_cpu_state, state));
+}
+
+// Tests
+
+void test_decode_opcode() {
+	TEST_ASSERT_EQUAL_INT(OPCODE_CLEAR_SCREEN, decode_opcode(0x00E0));
+	TEST_ASSERT_EQUAL_INT(OPCODE_SHIFT_LEFT, decode_opcode(0x812E));
+	TEST_ASSERT_EQUAL_INT(OPCODE_LOAD_REGISTERS, decode_opcode(0xF365));
+	TEST_ASSERT_EQUAL_INT(OPCODE_INVALID, decode_opcode(0x0123));
+	TEST_ASSERT_EQUAL_INT(OPCODE_INVALID, decode_opcode(0x8008));
+
+	TEST_ASSERT(decode(0xD125) == draw);
+	TEST_ASSERT_NULL(decode(0xF0FF));
+}
+
+void test_fetch_decoded_uses_cache() {
+	write_word_memory(&cpu_state, ROM_ADDRESS_START, 0x6A12);
+
+	DecodedInstruction *decoded = fetch_decoded(&cpu_state);
+	TEST_ASSERT_EQUAL_UINT16(ROM_ADDRESS_START + INSTRUCTION_SIZE, cpu_state.program_counter);
+	TEST_ASSERT(decoded->function == set_register_to_immediate);
+	TEST_ASSERT_EQUAL_UINT8(OPCODE_SET_REGISTER_TO_IMMEDIATE, decoded->opcode);
+	TEST_ASSERT(decoded == lookup_decoded_instruction(&cpu_state, ROM_ADDRESS_START));
+
+	// Rewriting the instruction must be picked up on the next fetch
+	write_word_memory(&cpu_state, ROM_ADDRESS_START, 0xA123);
+	cpu_state.program_counter = ROM_ADDRESS_START;
+	decoded = fetch_decoded(&cpu_state);
+	TEST_ASSERT(decoded->function == set_index_register);
+	TEST_ASSERT_EQUAL_UINT16(0x123, decoded->nnn);
+}
+
+void test_threaded_single_instructions() {
+	for (int i = 0; i < DIFFERENTIAL_ITERATIONS; ++i) {
+		randomize_state(&cpu_state);
+		write_word_memory(&cpu_state, cpu_state.program_counter, random_instruction());
+
+		assert_core_matches_reference(run_threaded, &cpu_state, 1);
+	}
+}
+
+// Generates a random instruction that is safe to run as part of a program filling all the memory
+uint16_t random_program_instruction() {
+	for (;;) {
+		uint16_t instruction = random_instruction();
+		switch (instruction & 0xF000) {
+			case 0x0000:
+				// Avoid returning with an empty stack
+				if (instruction == 0x00EE) {
+					continue;
+				}
+				break;
+			case 0x1000:
+				// Jump to valid instructions only
+				return 0x1000 | (ROM_ADDRESS_START + (instruction & 0x0DFE));
+			case 0x2000:
+			case 0xB000:
+				// Avoid calling with a full stack, and computed jumps to anywhere
+				continue;
+			case 0xA000:
+				// Keep I away from the program
+				return 0xA000 | (instruction & 0x01EF);
+			case 0xF000:
+				// Keep I away from the program, so DUMP and DEC never write to it
+				if ((instruction & 0xFF) == 0x1E) {
+					continue;
+				}
+				break;
+		}
+		return instruction;
+	}
+}
+
+void randomize_program(CpuState *state) {
+	randomize_state(state);
+	// Where DUMP and LOAD move I, it can walk into the program, so only let it read from there
+	bool index_moves = QUIRK_PROFILE_SETTINGS[state->quirk_profile].index_increment_on_dump_and_load != INDEX_UNCHANGED;
+	for (int address = ROM_ADDRESS_START; address < MEMORY_SIZE - 2 * INSTRUCTION_SIZE; address += 2) {
+		uint16_t instruction = random_program_instruction();
+		while (index_moves && ((instruction & 0xF0FF) == 0xF055 || (instruction & 0xF0FF) == 0xF033)) {
+			instruction = random_program_instruction();
+		}
+		write_word_memory(state, address, instruction);
+	}
+	// Skips on the last instructions could leave the memory
+	write_word_memory(state, MEMORY_SIZE - 2 * INSTRUCTION_SIZE, 0x1000 | ROM_ADDRESS_START);
+	write_word_memory(state, MEMORY_SIZE - INSTRUCTION_SIZE, 0x1000 | ROM_ADDRESS_START);
+	state->stack_size = 0;
+	state->index_register = 0x100;
+}
+
+void test_threaded_random_programs() {
+	for (int i = 0; i < DIFFERENTIAL_ITERATIONS / 20; ++i) {
+		randomize_program(&cpu_state);
+		assert_core_matches_reference(run_threaded, &cpu_state, 200);
+	}
+}
+
+uint32_t run_jit(CpuState *state, uint32_t count) {
+	return jit_run(&jit, state, count);
+}
+
+void test_jit_random_programs() {
+	for (int i = 0; i < DIFFERENTIAL_ITERATIONS / 20; ++i) {
+		randomize_program(&cpu_state);
+		// Run twice, so the second run goes through already compiled and chained blocks
+		assert_core_matches_reference(run_jit, &cpu_state, 500);
+		assert_core_matches_reference(run_jit, &cpu_state, 500);
+	}
+}
+
+void test_jit_self_modifying_code() {
+	const uint8_t program[] = {
+		0x22, 0x10, // CALL 0x210
+		0x60, 0x12, // SETR V0 0x12
+		0x61, 0x18, // SETR V1 0x18
+		0xA2, 0x10, // SETI 0x210
+		0xF1, 0x55, // DUMP 1, rewrites the subroutine into GOTO 0x218
+		0x22, 0x10, // CALL 0x210
+		0x12, 0x0C, // GOTO 0x20C
+		0x00, 0x00,
+		0x75, 0x01, // ADDI V5 1
+		0x00, 0xEE, // RETURN
+		0x00, 0x00,
+		0x00, 0x00,
+		0x76, 0x10, // ADDI V6 0x10
+		0x12, 0x0C, // GOTO 0x20C
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+
+	assert_core_matches_reference(run_jit, &cpu_state, 30);
+	TEST_ASSERT_EQUAL_UINT8(1, cpu_state.register_bank[5]);
+	TEST_ASSERT_EQUAL_UINT8(0x10, cpu_state.register_bank[6]);
+}
+
+void test_jit_external_code_write() {
+	const uint8_t program[] = {
+		0x70, 0x01, // ADDI V0 1
+		0x12, 0x00, // GOTO 0x200
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+
+	TEST_ASSERT_EQUAL_UINT32(100, jit_run(&jit, &cpu_state, 100));
+	TEST_ASSERT_EQUAL_UINT8(50, cpu_state.register_bank[0]);
+
+	write_word_memory(&cpu_state, ROM_ADDRESS_START, 0x7102); // ADDI V1 2
+	TEST_ASSERT_EQUAL_UINT32(100, jit_run(&jit, &cpu_state, 100));
+	TEST_ASSERT_EQUAL_UINT8(50, cpu_state.register_bank[0]);
+	TEST_ASSERT_EQUAL_UINT8(100, cpu_state.register_bank[1]);
+}
+
+void test_jit_reinitialized_state() {
+	const uint8_t first_program[] = {
+		0x70, 0x01, // ADDI V0 1
+		0x12, 0x00, // GOTO 0x200
+	};
+	const uint8_t second_program[] = {
+		0x71, 0x01, // ADDI V1 1
+		0x12, 0x00, // GOTO 0x200
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, first_program, sizeof(first_program));
+	init_state(&cpu_state, rom);
+	TEST_ASSERT_EQUAL_UINT32(100, jit_run(&jit, &cpu_state, 100));
+	TEST_ASSERT_EQUAL_UINT8(50, cpu_state.register_bank[0]);
+
+	// Same state and context, the blocks of the first ROM must not run anymore
+	memcpy(rom, second_program, sizeof(second_program));
+	init_state(&cpu_state, rom);
+	TEST_ASSERT_EQUAL_UINT32(100, jit_run(&jit, &cpu_state, 100));
+	TEST_ASSERT_EQUAL_UINT8(0, cpu_state.register_bank[0]);
+	TEST_ASSERT_EQUAL_UINT8(50, cpu_state.register_bank[1]);
+}
+
+uint32_t run_interpreter(CpuState *state, uint32_t count) {
+	return run_instructions(state, count);
+}
+
+void test_superinstructions_match_reference() {
+	const uint8_t program[] = {
+		0x60, 0x08, // 200: SETR V0 8
+		0x61, 0x04, // 202: SETR V1 4
+		0xA2, 0x20, // 204: SETI 0x220
+		0xD0, 0x11, // 206: DRAW V0 V1 1
+		0xF2, 0x07, // 208: RDEL V2
+		0x32, 0x00, // 20A: SIEQ V2 0
+		0x12, 0x08, // 20C: GOTO 0x208
+		0x70, 0x01, // 20E: ADDI V0 1
+		0x40, 0x0C, // 210: SINE V0 12
+		0x12, 0x1A, // 212: GOTO 0x21A
+		0x30, 0x0A, // 214: SIEQ V0 10
+		0x12, 0x04, // 216: GOTO 0x204
+		0xA2, 0x16, // 218: SETI 0x216
+		0x60, 0x60, // 21A: SETR V0 0x60
+		0x61, 0x22, // 21C: SETR V1 0x22
+		0xF1, 0x55, // 21E: DUMP 1, rewrites the GOTO at 0x216 into SETR V0 0x22, so 0x214 can no longer be fused
+		0x12, 0x14, // 220: GOTO 0x214
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	// With the delay timer stopped at 0 the whole program runs, otherwise it polls the timer forever
+	const uint8_t delays[] = {0, 2};
+	for (size_t i = 0; i < sizeof(delays); ++i) {
+		// Every count, so some runs end in the middle of a sequence
+		for (uint32_t count = 1; count < 64; ++count) {
+			init_state(&cpu_state, rom);
+			write_delay_timer(&cpu_state, delays[i]);
+			assert_core_matches_reference(run_interpreter, &cpu_state, count);
+
+			init_state(&cpu_state, rom);
+			write_delay_timer(&cpu_state, delays[i]);
+			assert_core_matches_reference(run_threaded, &cpu_state, count);
+		}
+	}
+}
+
+void test_idle_loops_match_reference() {
+	const uint8_t program[] = {
+		0xF2, 0x07, // 200: RDEL V2
+		0x32, 0x00, // 202: SIEQ V2 0
+		0x12, 0x00, // 204: GOTO 0x200
+		0xE1, 0x9E, // 206: SKPR V1
+		0x12, 0x06, // 208: GOTO 0x206
+		0x43, 0x00, // 20A: SINE V3 0
+		0x12, 0x0A, // 20C: GOTO 0x20A
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	// Stuck polling the timer, then polling the key, then comparing V3 forever, and a count that ends on the loop start
+	const uint32_t loop_start_counts[] = {39, 38, 39};
+	for (int variant = 0; variant < 3; ++variant) {
+		for (uint32_t count = 1; count < 40; ++count) {
+			init_state(&cpu_state, rom);
+			write_delay_timer(&cpu_state, variant == 0 ? 5 : 0);
+			cpu_state.register_bank[1] = 0xA;
+			set_key_pressed(&cpu_state, 0xA, variant == 2);
+			assert_core_matches_reference(run_interpreter, &cpu_state, count);
+
+			init_state(&cpu_state, rom);
+			write_delay_timer(&cpu_state, variant == 0 ? 5 : 0);
+			cpu_state.register_bank[1] = 0xA;
+			set_key_pressed(&cpu_state, 0xA, variant == 2);
+			assert_core_matches_reference(run_threaded, &cpu_state, count);
+			if (count == loop_start_counts[variant]) {
+				TEST_ASSERT_TRUE(is_idle_loop(&cpu_state));
+			}
+		}
+	}
+}
+
+void test_key_wait_matches_reference() {
+	const uint8_t program[] = {
+		0x60, 0x01, // 200: SETR V0 1
+		0xF5, 0x0A, // 202: KEY V5
+		0x75, 0x01, // 204: ADDI V5 1
+		0x12, 0x06, // 206: GOTO 0x206
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	for (uint32_t count = 1; count < 40; ++count) {
+		init_state(&cpu_state, rom);
+		assert_core_matches_reference(run_interpreter, &cpu_state, count);
+
+		init_state(&cpu_state, rom);
+		assert_core_matches_reference(run_threaded, &cpu_state, count);
+		if (count > 1) {
+			TEST_ASSERT_TRUE(is_waiting_for_key(&cpu_state));
+			TEST_ASSERT_TRUE(is_idle_loop(&cpu_state));
+		}
+
+		// The halted CPU resumes on the next instruction after the key press
+		set_key_pressed(&cpu_state, 0xB, true);
+		assert_core_matches_reference(run_threaded, &cpu_state, 3);
+		TEST_ASSERT_FALSE(is_waiting_for_key(&cpu_state));
+		TEST_ASSERT_EQUAL_UINT8(0xC, cpu_state.register_bank[5]);
+	}
+}
+
+void test_idle_loops_virtual_timers() {
+	const uint8_t program[] = {
+		0x60, 0x05, // 200: SETR V0 5
+		0xF0, 0x15, // 202: TDEL V0
+		0xF1, 0x07, // 204: RDEL V1
+		0x31, 0x00, // 206: SIEQ V1 0
+		0x12, 0x04, // 208: GOTO 0x204
+		0x70, 0x01, // 20A: ADDI V0 1
+		0x12, 0x0C, // 20C: GOTO 0x20C
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	// One instruction at a time, so nothing is ever fast-forwarded
+	CpuState expected_cpu_state;
+	init_state(&expected_cpu_state, rom);
+	use_virtual_timers(&expected_cpu_state, 7);
+	for (int i = 0; i < 1000; ++i) {
+		run_instructions(&expected_cpu_state, 1);
+	}
+
+	init_state(&cpu_state, rom);
+	use_virtual_timers(&cpu_state, 7);
+	TEST_ASSERT_EQUAL_UINT32(1000, run_instructions(&cpu_state, 1000));
+	TEST_ASSERT_EQUAL_UINT16(0x20C, cpu_state.program_counter);
+	TEST_ASSERT_EQUAL_UINT8(6, cpu_state.register_bank[0]);
+	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+	TEST_ASSERT_EQUAL_UINT64(expected_cpu_state.cycles, cpu_state.cycles);
+}
+
+void test_run_instructions() {
+	// Count V0 down from 3, then spin forever
+	const uint8_t program[] = {
+		0x60, 0x03, // SETR V0 3
+		0x70, 0xFF, // ADDI V0 -1
+		0x30, 0x00, // SIEQ V0 0
+		0x12, 0x02, // GOTO 0x202
+		0x12, 0x08, // GOTO 0x208
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+
+	TEST_ASSERT_EQUAL_UINT32(11, run_instructions(&cpu_state, 11));
+	TEST_ASSERT_EQUAL_UINT8(0, cpu_state.register_bank[0]);
+	TEST_ASSERT_EQUAL_UINT16(0x208, cpu_state.program_counter);
+}
+
+void assert_virtual_timers_tick_between_instructions(bool use_jit) {
+	const uint8_t program[] = {
+		0x60, 0x09, // SETR V0 9
+		0xF0, 0x15, // SETD V0
+		0xF1, 0x07, // GETD V1
+		0x12, 0x04, // GOTO 0x204
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+	use_virtual_timers(&cpu_state, 4);
+
+	// Ticks after the 4th and 8th instructions, so the last GETD reads 7 even if the loop runs as a single block
+	uint32_t executed = use_jit ? jit_run(&jit, &cpu_state, 11) : run_instructions(&cpu_state, 11);
+	TEST_ASSERT_EQUAL_UINT32(11, executed);
+	TEST_ASSERT_EQUAL_UINT8(7, cpu_state.register_bank[1]);
+	TEST_ASSERT_EQUAL_UINT8(7, read_delay_timer(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT16(0x206, cpu_state.program_counter);
+	TEST_ASSERT_EQUAL_UINT64(11, cpu_state.cycles);
+}
+
+void test_run_instructions_virtual_timers() {
+	assert_virtual_timers_tick_between_instructions(false);
+}
+
+void test_jit_virtual_timers() {
+	assert_virtual_timers_tick_between_instructions(true);
+}
+
+// With mixed quirks, the first lockstep group has every profile and can't run in lockstep, the rest are all SCHIP
+QuirkProfile farm_session_quirks(size_t session, bool mixed_quirks) {
+	if (!mixed_quirks) {
+		return QUIRKS_DEFAULT;
+	}
+	return session < LOCKSTEP_MAX_LANES ? session % NUMBER_OF_QUIRK_PROFILES : QUIRKS_SCHIP;
+}
+
+void assert_farm_matches_single_runs(bool lockstep, bool mixed_quirks) {
+	// Count V0 down from a different value on every session, and count the loops in V1
+	// The shift depends on the quirks, the VIP shifts V0 into V3 while the SCHIP keeps shifting V3 in place
+	const uint8_t program[] = {
+		0x60, 0x00, // SETR V0 <session>
+		0x63, 0x80, // SETR V3 0x80
+		0x70, 0xFF, // ADDI V0 -1
+		0x71, 0x01, // ADDI V1 1
+		0x83, 0x06, // SHIFTR V3 V0
+		0x30, 0x00, // SIEQ V0 0
+		0x12, 0x04, // GOTO 0x204
+		0xF2, 0x07, // GETD V2
+		0x12, 0x0E, // GOTO 0x20E
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	Farm farm;
+	TEST_ASSERT_TRUE(init_farm(&farm, 37, rom));
+	farm.frames = 20;
+	farm.instructions_per_frame = 7;
+	farm.lockstep = lockstep;
+	for (size_t i = 0; i < farm.size; ++i) {
+		farm.sessions[i].cpu_state->memory[ROM_ADDRESS_START + 1] = i;
+		set_quirk_profile(farm.sessions[i].cpu_state, farm_session_quirks(i, mixed_quirks));
+		use_virtual_timers(farm.sessions[i].cpu_state, 7);
+		write_delay_timer(farm.sessions[i].cpu_state, 100);
+	}
+	TEST_ASSERT_TRUE(run_farm(&farm, 4));
+	TEST_ASSERT_EQUAL_UINT64(37 * 20 * 7, farm.executed);
+
+	for (size_t i = 0; i < farm.size; ++i) {
+		rom[1] = i;
+		init_state(&cpu_state, rom);
+		set_quirk_profile(&cpu_state, farm_session_quirks(i, mixed_quirks));
+		use_virtual_timers(&cpu_state, 7);
+		write_delay_timer(&cpu_state, 100);
+		for (int frame = 0; frame < 20; ++frame) {
+			run_instructions(&cpu_state, 7);
+		}
+
+		TEST_ASSERT_EQUAL_UINT32(20, farm.sessions[i].frames);
+		TEST_ASSERT_TRUE(state_equals(&cpu_state, farm.sessions[i].cpu_state));
+	}
+
+	free_farm(&farm);
+}
+
+void test_find_aot_blocks() {
+	const uint8_t program[] = {
+		0x60, 0x03, // 200: SETR V0 3
+		0x22, 0x10, // 202: CALL 0x210
+		0x30, 0x00, // 204: SIEQ V0 0
+		0x12, 0x02, // 206: GOTO 0x202
+		0xF1, 0x0A, // 208: KEY V1
+		0x12, 0x0A, // 20A: GOTO 0x20A
+		0x00, 0x00, // 20C: never reached
+		0x00, 0x00, // 20E: never reached
+		0x70, 0xFF, // 210: ADDI V0 -1
+		0x00, 0xEE, // 212: RET
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+
+	uint16_t addresses[MEMORY_SIZE];
+	uint8_t lengths[MEMORY_SIZE];
+	const uint16_t expected_addresses[] = {0x200, 0x202, 0x204, 0x206, 0x208, 0x20A, 0x210};
+	const uint8_t expected_lengths[] = {1, 1, 1, 1, 1, 1, 2};
+	TEST_ASSERT_EQUAL_size_t(7, find_aot_blocks(&cpu_state, sizeof(program), addresses, lengths));
+	TEST_ASSERT_EQUAL_UINT16_ARRAY(expected_addresses, addresses, 7);
+	TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_lengths, lengths, 7);
+}
+
+// What chip8_aot writes for AOT_TEST_PROGRAM
+void test_aot_block_200(CpuState *cpu_state) {
+	cpu_state->register_bank[0x0] = 0x05;
+	cpu_state->program_counter = 0x202;
+}
+
+void test_aot_block_202(CpuState *cpu_state) {
+	cpu_state->register_bank[0x0] += 0x01;
+	cpu_state->program_counter = 0x202;
+}
+
+const uint8_t AOT_TEST_PROGRAM[] = {
+	0x60, 0x05, // 200: SETR V0 5
+	0x70, 0x01, // 202: ADDI V0 1
+	0x12, 0x02, // 204: GOTO 0x202
+};
+
+const AotBlock AOT_TEST_BLOCKS[] = {{0x200, 1, test_aot_block_200}, {0x202, 2, test_aot_block_202}};
+
+const AotProgram AOT_TEST_TRANSLATION = {
+	.rom = AOT_TEST_PROGRAM, .rom_size = sizeof(AOT_TEST_PROGRAM), .blocks = AOT_TEST_BLOCKS, .block_count = 2,
+	.quirk_profile = QUIRKS_DEFAULT
+};
+
+void test_aot_falls_back_on_rewritten_code() {
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, AOT_TEST_PROGRAM, sizeof(AOT_TEST_PROGRAM));
+	TEST_ASSERT_TRUE(matches_aot_rom(&AOT_TEST_TRANSLATION, rom, sizeof(AOT_TEST_PROGRAM)));
+
+	AotContext *aot = malloc(sizeof(AotContext));
+	TEST_ASSERT_NOT_NULL(aot);
+	aot_init(aot, &AOT_TEST_TRANSLATION);
+
+	CpuState expected_cpu_state;
+	init_state(&cpu_state, rom);
+	init_state(&expected_cpu_state, rom);
+	use_virtual_timers(&cpu_state, 7);
+	use_virtual_timers(&expected_cpu_state, 7);
+	TEST_ASSERT_EQUAL_UINT32(51, aot_run(aot, &cpu_state, 51));
+	run_instructions(&expected_cpu_state, 51);
+	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+
+	// ADDI V0 2 from now on, which only the interpreter knows about
+	write_byte_memory(&cpu_state, 0x203, 0x02);
+	write_byte_memory(&expected_cpu_state, 0x203, 0x02);
+	aot_run(aot, &cpu_state, 50);
+	run_instructions(&expected_cpu_state, 50);
+	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+
+	free(aot);
+}
+
+void test_aot_reinitialized_state() {
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, AOT_TEST_PROGRAM, sizeof(AOT_TEST_PROGRAM));
+
+	AotContext *aot = malloc(sizeof(AotContext));
+	TEST_ASSERT_NOT_NULL(aot);
+	aot_init(aot, &AOT_TEST_TRANSLATION);
+	init_state(&cpu_state, rom);
+	aot_run(aot, &cpu_state, 51);
+
+	// Same state and context with ADDI V0 3 instead, the translated blocks must not run on it
+	rom[0x003] = 0x03;
+	CpuState expected_cpu_state;
+	init_state(&cpu_state, rom);
+	init_state(&expected_cpu_state, rom);
+	TEST_ASSERT_EQUAL_UINT32(51, aot_run(aot, &cpu_state, 51));
+	run_instructions(&expected_cpu_state, 51);
+	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+
+	free(aot);
+}
+
+void test_write_aot_program() {
+	const uint8_t program[] = {
+		0x60, 0x05, // 200: SETR V0 5
+		0x70, 0x01, // 202: ADDI V0 1
+		0x12, 0x02, // 204: GOTO 0x202
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+
+	char output[2048] = {0};
+	FILE *file_ptr = fmemopen(output, sizeof(output) - 1, "w");
+	TEST_ASSERT_NOT_NULL(file_ptr);
+	TEST_ASSERT_EQUAL_size_t(2, write_aot_program(file_ptr, &cpu_state, sizeof(program), "test_aot"));
+	fclose(file_ptr);
+
+	TEST_ASSERT_NOT_NULL(strstr(output, "void test_aot_block_202(CpuState *cpu_state) {"));
+	TEST_ASSERT_NOT_NULL(strstr(output, "\tV[0x0] += 0x01;\n"));
+	TEST_ASSERT_NOT_NULL(strstr(output, "{0x202, 2, test_aot_block_202},"));
+	TEST_ASSERT_NOT_NULL(strstr(output, "const AotProgram test_aot = {"));
+}
+
+#if CHIP8_PROFILE
+
+// Checks the counts on the line of a subroutine in the call graph report
+void assert_routine_profile(
+	const char *report, const char *routine, uint64_t inclusive_instructions, uint64_t exclusive_instructions,
+	uint64_t inclusive_draws, uint64_t exclusive_draws
+) {
+	const char *line = strstr(report, routine);
+	TEST_ASSERT_NOT_NULL(line);
+	unsigned long long counts[4];
+	TEST_ASSERT_EQUAL_INT(
+		4, sscanf(line + strlen(routine), "%llu %llu %llu %llu", &counts[0], &counts[1], &counts[2], &counts[3])
+	);
+	TEST_ASSERT_EQUAL_UINT64(inclusive_instructions, counts[0]);
+	TEST_ASSERT_EQUAL_UINT64(exclusive_instructions, counts[1]);
+	TEST_ASSERT_EQUAL_UINT64(inclusive_draws, counts[2]);
+	TEST_ASSERT_EQUAL_UINT64(exclusive_draws, counts[3]);
+}
+
+void test_profile_call_graph() {
+	// main calls 0x208 twice, which draws and calls 0x20E, which draws too
+	const uint8_t program[] = {
+		0x22, 0x08, // 200: CALL 0x208
+		0x22, 0x08, // 202: CALL 0x208
+		0x00, 0xE0, // 204: CLEAR
+		0x12, 0x06, // 206: GOTO 0x206
+		0xD0, 0x01, // 208: DRAW V0 V0 1
+		0x22, 0x0E, // 20A: CALL 0x20E
+		0x00, 0xEE, // 20C: RETURN
+		0xD0, 0x01, // 20E: DRAW V0 V0 1
+		0x00, 0xEE, // 210: RETURN
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+	init_state(&cpu_state, rom);
+	memset(&call_graph_profile, 0, sizeof(call_graph_profile));
+
+	run_instructions(&cpu_state, 13);
+	TEST_ASSERT_EQUAL_UINT16(0x206, read_register_pc(&cpu_state));
+
+	uint32_t outer_node = find_child_call_node(PROFILE_ROOT_NODE, 0x208);
+	uint32_t inner_node = find_child_call_node(outer_node, 0x20E);
+	TEST_ASSERT_NOT_EQUAL(PROFILE_ROOT_NODE, outer_node);
+	TEST_ASSERT_NOT_EQUAL(outer_node, inner_node);
+	TEST_ASSERT_EQUAL_UINT64(3, call_graph_profile.instructions[PROFILE_ROOT_NODE]);
+	TEST_ASSERT_EQUAL_UINT64(0, call_graph_profile.draws[PROFILE_ROOT_NODE]);
+	TEST_ASSERT_EQUAL_UINT64(6, call_graph_profile.instructions[outer_node]);
+	TEST_ASSERT_EQUAL_UINT64(2, call_graph_profile.draws[outer_node]);
+	TEST_ASSERT_EQUAL_UINT64(4, call_graph_profile.instructions[inner_node]);
+	TEST_ASSERT_EQUAL_UINT64(2, call_graph_profile.draws[inner_node]);
+
+	char output[1024] = {0};
+	FILE *file_ptr = fmemopen(output, sizeof(output) - 1, "w");
+	TEST_ASSERT_NOT_NULL(file_ptr);
+	write_call_graph_report(file_ptr);
+	fclose(file_ptr);
+	assert_routine_profile(output, "main", 13, 3, 4, 0);
+	assert_routine_profile(output, "sub_208", 10, 6, 4, 2);
+	assert_routine_profile(output, "sub_20E", 4, 4, 2, 2);
+
+	memset(output, 0, sizeof(output));
+	file_ptr = fmemopen(output, sizeof(output) - 1, "w");
+	TEST_ASSERT_NOT_NULL(file_ptr);
+	write_collapsed_stacks(file_ptr, call_graph_profile.draws);
+	fclose(file_ptr);
+	TEST_ASSERT_NOT_NULL(strstr(output, "main;sub_208 2\n"));
+	TEST_ASSERT_NOT_NULL(strstr(output, "main;sub_208;sub_20E 2\n"));
+	TEST_ASSERT_NULL(strstr(output, "main 0\n"));
+
+	// Inside the inner subroutine with the outer call overwritten, the outer frame falls back to its call site
+	write_register_pc(&cpu_state, 0x200);
+	run_instructions(&cpu_state, 3);
+	TEST_ASSERT_EQUAL_UINT16(0x20E, read_register_pc(&cpu_state));
+	TEST_ASSERT_EQUAL_UINT32(inner_node, find_call_node(&cpu_state));
+	write_word_memory(&cpu_state, 0x200, 0x00E0);
+	TEST_ASSERT_EQUAL_UINT32(
+		find_child_call_node(find_child_call_node(PROFILE_ROOT_NODE, 0x200), 0x20E), find_call_node(&cpu_state)
+	);
+
+	// A call whose slot is taken by another one probes the next slots
+	memset(&call_graph_profile, 0, sizeof(call_graph_profile));
+	uint32_t home_slot = find_child_call_node(PROFILE_ROOT_NODE, 0x300);
+	call_graph_profile.keys[home_slot] = ((uint64_t) PROFILE_ROOT_NODE << 16 | 0x302) + 1;
+	uint32_t probed_slot = find_child_call_node(PROFILE_ROOT_NODE, 0x300);
+	TEST_ASSERT_EQUAL_UINT32((home_slot + 1) % PROFILE_CALL_NODES, probed_slot);
+	TEST_ASSERT_EQUAL_UINT32(probed_slot, find_child_call_node(PROFILE_ROOT_NODE, 0x300));
+}
+
+#endif
+
+void test_farm_matches_single_runs() {
+	assert_farm_matches_single_runs(false, false);
+}
+
+void test_farm_lockstep_matches_single_runs() {
+	assert_farm_matches_single_runs(true, false);
+}
+
+void test_farm_mixes_quirk_profiles() {
+	assert_farm_matches_single_runs(false, true);
+	assert_farm_matches_single_runs(true, true);
+}
+
+void assert_lockstep_matches_single_runs(bool use_avx2) {
+	for (int i = 0; i < DIFFERENTIAL_ITERATIONS / 100; ++i) {
+		randomize_program(&cpu_state);
+		use_virtual_timers(&cpu_state, 1 + test_random() % 16);
+
+		CpuState *lanes[LOCKSTEP_MAX_LANES];
+		for (int lane = 0; lane < LOCKSTEP_MAX_LANES; ++lane) {
+			copy_state(&lane_states[lane], &cpu_state);
+			// Half of the lanes start out diverged
+			if (lane % 2 == 1) {
+				for (int r = 0; r < REGISTERS; ++r) {
+					lane_states[lane].register_bank[r] = test_random();
+				}
+			}
+			copy_state(&expected_lane_states[lane], &lane_states[lane]);
+			lanes[lane] = &lane_states[lane];
+		}
+
+		LockstepBatch batch;
+		TEST_ASSERT_TRUE(init_lockstep_batch(&batch, lanes, LOCKSTEP_MAX_LANES));
+		batch.use_avx2 = batch.use_avx2 && use_avx2;
+		run_lockstep(&batch, 150);
+		run_lockstep(&batch, 150);
+		sync_lockstep_batch(&batch);
+
+		for (int lane = 0; lane < LOCKSTEP_MAX_LANES; ++lane) {
+			run_instructions(&expected_lane_states[lane], 300);
+			TEST_ASSERT(state_equals(&expected_lane_states[lane], &lane_states[lane]));
+			TEST_ASSERT_EQUAL_UINT64(expected_lane_states[lane].cycles, lane_states[lane].cycles);
+			TEST_ASSERT_EQUAL_UINT32(expected_lane_states[lane].cycles_until_tick, lane_states[lane].cycles_until_tick);
+		}
+		if (batch.use_avx2) {
+			TEST_ASSERT_TRUE(batch.vector_instructions > 0);
+		}
+	}
+}
+
+void test_lockstep_vector_matches_single_runs() {
+	assert_lockstep_matches_single_runs(true);
+}
+
+void test_lockstep_scalar_matches_single_runs() {
+	assert_lockstep_matches_single_runs(false);
+}
+
+void test_lockstep_needs_virtual_timers() {
+	CpuState *lanes[] = {&cpu_state};
+	LockstepBatch batch;
+	TEST_ASSERT_FALSE(init_lockstep_batch(&batch, lanes, 1));
+	use_virtual_timers(&cpu_state, 10);
+	TEST_ASSERT_TRUE(init_lockstep_batch(&batch, lanes, 1));
+}
+
+#define REPLAY_TEST_PATH "test_replay.bin"
+
+void test_replay_matches_recording() {
+	// Counts the frames with key 5 held in V2, and draws random numbers in between
+	const uint8_t program[] = {
+		0xC3, 0xFF, // RAND V3 0xFF
+		0x61, 0x05, // SETR V1 5
+		0xE1, 0x9E, // SKEY V1
+		0x12, 0x00, // GOTO 0x200
+		0x72, 0x01, // ADDI V2 1
+		0x12, 0x00, // GOTO 0x200
+	};
+	uint8_t rom[ROM_SIZE] = {0};
+	memcpy(rom, program, sizeof(program));
+
+	init_state(&cpu_state, rom);
+	seed_random(&cpu_state, 1234);
+	ReplayRecorder recorder;
+	TEST_ASSERT_TRUE(start_replay_recording(&recorder, REPLAY_TEST_PATH, rom, &cpu_state, 7, 10));
+	for (int frame = 0; frame < 100; ++frame) {
+		uint16_t keys = (frame / 7) % 2 ? 1 << 5 : 0;
+		write_keyboard_mask(&cpu_state, keys);
+		run_instructions(&cpu_state, 7);
+		update_beeper_status(&cpu_state);
+		record_replay_frame(&recorder, keys, &cpu_state);
+	}
+	TEST_ASSERT_TRUE(finish_replay_recording(&recorder));
+
+	Replay replay;
+	TEST_ASSERT_TRUE(load_replay(&replay, REPLAY_TEST_PATH));
+	remove(REPLAY_TEST_PATH);
+	TEST_ASSERT_TRUE(check_replay_rom(&replay, rom, QUIRKS_DEFAULT));
+	TEST_ASSERT_FALSE(check_replay_rom(&replay, rom, QUIRKS_SCHIP));
+	QuirkProfile recorded_profile;
+	TEST_ASSERT_TRUE(find_quirk_profile(replay.quirks, &recorded_profile));
+	TEST_ASSERT_EQUAL_INT(QUIRKS_DEFAULT, recorded_profile);
+	TEST_ASSERT_EQUAL_UINT64(1234, replay.seed);
+
+	CpuState replayed_cpu_state;
+	init_state(&replayed_cpu_state, rom);
+	ReplayResult result;
+	TEST_ASSERT_TRUE(run_replay(&replay, &replayed_cpu_state, NULL, &result));
+	TEST_ASSERT_FALSE(result.diverged);
+	TEST_ASSERT_EQUAL_UINT32(100, result.frames);
+	TEST_ASSERT_EQUAL_UINT64(700, result.executed);
+	TEST_ASSERT_EQUAL_UINT32(10, result.hashes_checked);
+	TEST_ASSERT_TRUE(state_equals(&cpu_state, &replayed_cpu_state));
+
+	// Any difference in the state is caught at the next hash
+	init_state(&replayed_cpu_state, rom);
+	write_register_bank(&replayed_cpu_state, 0xE, 1);
+	TEST_ASSERT_TRUE(run_replay(&replay, &replayed_cpu_state, NULL, &result));
+	TEST_ASSERT_TRUE(result.diverged);
+	TEST_ASSERT_EQUAL_UINT32(9, result.diverged_frame);
+
+	free_replay(&replay);
+}
+
+int main() {
+	UNITY_BEGIN();
+
+	RUN_TEST(test_decode_opcode);
+	RUN_TEST(test_fetch_decoded_uses_cache);
+
+	RUN_TEST(test_threaded_single_instructions);
+	RUN_TEST(test_threaded_random_programs);
+
+	if (jit_init(&jit)) {
+		RUN_TEST(test_jit_random_programs);
+		RUN_TEST(test_jit_self_modifying_code);
+		RUN_TEST(test_jit_external_code_write);
+		RUN_TEST(test_jit_reinitialized_state);
+		RUN_TEST(test_jit_virtual_timers);
+		jit_destroy(&jit);
+	}
+
+	RUN_TEST(test_superinstructions_match_reference);
+	RUN_TEST(test_idle_loops_match_reference);
+	RUN_TEST(test_idle_loops_virtual_timers);
+	RUN_TEST(test_key_wait_matches_reference);
+	RUN_TEST(test_run_instructions);
+	RUN_TEST(test_run_instructions_virtual_timers);
+
+	RUN_TEST(test_lockstep_vector_matches_single_runs);
+	RUN_TEST(test_lockstep_scalar_matches_single_runs);
+	RUN_TEST(test_lockstep_needs_virtual_timers);
+
+	RUN_TEST(test_find_aot_blocks);
+	RUN_TEST(test_aot_falls_back_on_rewritten_code);
+	RUN_TEST(test_aot_reinitialized_state);
+	RUN_TEST(test_write_aot_program);
+#if CHIP8_PROFILE
+	RUN_TEST(test_profile_call_graph);
+#endif
+	RUN_TEST(test_farm_matches_single_runs);
+	RUN_TEST(test_farm_lockstep_matches_single_runs);
+	RUN_TEST(test_farm_mixes_quirk_profiles);
+
+	RUN_TEST(test_replay_matches_recording);
+
+	return UNITY_END();
+}
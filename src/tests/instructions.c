@@ -482,8 +482,10 @@ void test_dump_one_register_to_memory() {
 	for (uint8_t i = 0; i <= r; ++i) {
 		write_byte_memory(&expected_cpu_state, index + i, 0xF0 | i);
 	}
-#if OPTION_DUMP_INCREMENTS_I
+#if OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X_PLUS_ONE
 	write_index_register(&expected_cpu_state, index + r + 1);
+#elif OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X
+	write_index_register(&expected_cpu_state, index + r);
 #endif
 
 	save_registers(&cpu_state, instruction);
@@ -507,8 +509,10 @@ void test_dump_all_registers_to_memory() {
 	for (uint8_t i = 0; i <= r; ++i) {
 		write_byte_memory(&expected_cpu_state, index + i, 0xF0 | i);
 	}
-#if OPTION_DUMP_INCREMENTS_I
+#if OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X_PLUS_ONE
 	write_index_register(&expected_cpu_state, index + r + 1);
+#elif OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X
+	write_index_register(&expected_cpu_state, index + r);
 #endif
 
 	save_registers(&cpu_state, instruction);
@@ -533,6 +537,12 @@ void test_load_one_register_from_memory() {
 		write_register_bank(&expected_cpu_state, i, 0xF0 | i);
 	}
 
+#if OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X_PLUS_ONE
+	write_index_register(&expected_cpu_state, index + r + 1);
+#elif OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X
+	write_index_register(&expected_cpu_state, index + r);
+#endif
+
 	load_registers(&cpu_state, instruction);
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
 }
@@ -555,6 +565,12 @@ void test_load_all_registers_from_memory() {
 		write_register_bank(&expected_cpu_state, i, 0xF0 | i);
 	}
 
+#if OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X_PLUS_ONE
+	write_index_register(&expected_cpu_state, index + r + 1);
+#elif OPTION_INDEX_INCREMENT_ON_DUMP_AND_LOAD == INDEX_INCREMENT_BY_X
+	write_index_register(&expected_cpu_state, index + r);
+#endif
+
 	load_registers(&cpu_state, instruction);
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
 }
@@ -988,8 +1004,8 @@ void test_shift_right_underflow() {
 }
 
 void test_set_register_to_bitmasked_rand() {
-	srand(9943u); // NOLINT(cert-msc51-cpp)
-	// Resulting random byte should be 0xFC
+	seed_random(&cpu_state, 9943u);
+	// Resulting random byte should be 0x34
 
 	uint8_t x = 0x1;
 	uint8_t xv = 0b10101010;
@@ -1001,7 +1017,8 @@ void test_set_register_to_bitmasked_rand() {
 
 	CpuState expected_cpu_state;
 	copy_state(&expected_cpu_state, &cpu_state);
-	write_register_bank(&expected_cpu_state, x, 0xC4);
+	next_random_byte(&expected_cpu_state);
+	write_register_bank(&expected_cpu_state, x, 0x04);
 
 	set_register_to_bitmasked_rand(&cpu_state, instruction);
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
@@ -1075,9 +1092,46 @@ void test_wait_for_key_not_pressed() {
 	CpuState expected_cpu_state;
 	copy_state(&expected_cpu_state, &cpu_state);
 	write_register_pc(&expected_cpu_state, ROM_ADDRESS_START - 2);
+	expected_cpu_state.waiting_for_key = true;
 
 	wait_for_key(&cpu_state, instruction);
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+	TEST_ASSERT_TRUE(is_waiting_for_key(&cpu_state));
+}
+
+void test_wait_for_key_pressed_later() {
+	uint8_t x = 0x1;
+	uint8_t k = 9;
+
+	uint16_t instruction = 0xF00A; // FX0A
+	instruction |= x << INSTRUCTION_FIELD_REGISTER_X_OFFSET;
+
+	wait_for_key(&cpu_state, instruction);
+	write_register_pc(&cpu_state, ROM_ADDRESS_START);
+	set_key_pressed(&cpu_state, k, true);
+
+	CpuState expected_cpu_state;
+	copy_state(&expected_cpu_state, &cpu_state);
+	write_register_bank(&expected_cpu_state, x, k);
+	expected_cpu_state.waiting_for_key = false;
+
+	wait_for_key(&cpu_state, instruction);
+	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
+}
+
+void test_wait_for_key_release() {
+	uint8_t k = 0xC;
+	uint8_t key;
+
+	// A key already held down when the wait starts doesn't count until it's released
+	set_key_pressed(&cpu_state, 2, true);
+	TEST_ASSERT_FALSE(poll_key_wait(&cpu_state, true, &key));
+	set_key_pressed(&cpu_state, k, true);
+	TEST_ASSERT_FALSE(poll_key_wait(&cpu_state, true, &key));
+	set_key_pressed(&cpu_state, k, false);
+	TEST_ASSERT_TRUE(poll_key_wait(&cpu_state, true, &key));
+	TEST_ASSERT_EQUAL_UINT8(k, key);
+	TEST_ASSERT_FALSE(is_waiting_for_key(&cpu_state));
 }
 
 void test_wait_for_key_pressed() {
@@ -1115,6 +1169,40 @@ void test_point_to_char() {
 	TEST_ASSERT(state_equals(&expected_cpu_state, &cpu_state));
 }
 
+void test_quirk_profile_handlers() {
+	// SHIFTR V1 V2: the original interpreter shifts VY, later ones shift VX in place
+	write_register_bank(&cpu_state, 1, 0x81);
+	write_register_bank(&cpu_state, 2, 0x06);
+	shift_right_vip(&cpu_state, 0x8126);
+	TEST_ASSERT_EQUAL_UINT8(0x03, read_register_bank(&cpu_state, 1));
+	TEST_ASSERT_EQUAL_UINT8(0, read_register_bank(&cpu_state, STATUS_REGISTER));
+	write_register_bank(&cpu_state, 1, 0x81);
+	shift_right_schip(&cpu_state, 0x8126);
+	TEST_ASSERT_EQUAL_UINT8(0x40, read_register_bank(&cpu_state, 1));
+	TEST_ASSERT_EQUAL_UINT8(1, read_register_bank(&cpu_state, STATUS_REGISTER));
+
+	// JUMPR: B210 jumps to V0 + 0x210 on the VIP, to V2 + 0x10 on the CHIP-48
+	write_register_bank(&cpu_state, 0, 0x04);
+	jump_with_offset_vip(&cpu_state, 0xB210);
+	TEST_ASSERT_EQUAL_UINT16(0x214, cpu_state.program_counter);
+	jump_with_offset_chip48(&cpu_state, 0xB210);
+	TEST_ASSERT_EQUAL_UINT16(0x16, cpu_state.program_counter);
+
+	// DUMP 2 and LOAD 2: the VIP moves I past the registers, the CHIP-48 to the last one, the SCHIP leaves it alone
+	write_index_register(&cpu_state, 0x300);
+	save_registers_vip(&cpu_state, 0xF255);
+	TEST_ASSERT_EQUAL_UINT16(0x303, read_index_register(&cpu_state));
+	load_registers_vip(&cpu_state, 0xF265);
+	TEST_ASSERT_EQUAL_UINT16(0x306, read_index_register(&cpu_state));
+	save_registers_chip48(&cpu_state, 0xF255);
+	TEST_ASSERT_EQUAL_UINT16(0x308, read_index_register(&cpu_state));
+	load_registers_chip48(&cpu_state, 0xF265);
+	TEST_ASSERT_EQUAL_UINT16(0x30A, read_index_register(&cpu_state));
+	save_registers_schip(&cpu_state, 0xF255);
+	load_registers_schip(&cpu_state, 0xF265);
+	TEST_ASSERT_EQUAL_UINT16(0x30A, read_index_register(&cpu_state));
+}
+
 int main() {
 	UNITY_BEGIN();
 
@@ -1199,8 +1287,12 @@ int main() {
 
 	RUN_TEST(test_wait_for_key_not_pressed);
 	RUN_TEST(test_wait_for_key_pressed);
+	RUN_TEST(test_wait_for_key_pressed_later);
+	RUN_TEST(test_wait_for_key_release);
 
 	RUN_TEST(test_point_to_char);
 
+	RUN_TEST(test_quirk_profile_handlers);
+
 	return UNITY_END();
 }
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include "threaded.h"
+#include "cpu.h"
+
+/*
+ * Threaded-code interpreter.
+ * Every instruction is implemented inline with the same semantics as its handler in instructions.c,
+ * using the operands already extracted by the decode cache, and ends by dispatching the next instruction itself.
+ * Instructions that depend on quirks call the handler of the state's profile, picked by the decode cache.
+ */
+
+#define VF (cpu_state->register_bank[STATUS_REGISTER])
+#define VX (cpu_state->register_bank[decoded->x])
+#define VY (cpu_state->register_bank[decoded->y])
+#define SKIP() (cpu_state->program_counter += INSTRUCTION_SIZE)
+#define QUIRK_HANDLER() decoded->function(cpu_state, decoded->instruction)
+
+/*
+ * Fetch the next instruction, advancing the PC like fetch does.
+ * The decode cache is checked inline, only misses go through decode_cached.
+ * Superinstructions that fit in the remaining count are run right away, and the next instruction is fetched instead.
+ */
+#define FETCH_NEXT() do { \
+	for (;;) { \
+		if (executed == count) { \
+			goto done; \
+		} \
+		uint16_t pc = cpu_state->program_counter & ADDRESS_BITMASK; \
+		cpu_state->program_counter += INSTRUCTION_SIZE; \
+		if ((cpu_state->decoded_valid[pc / 64] >> (pc % 64)) & 1) { \
+			decoded = &cpu_state->decoded_instructions[pc]; \
+		} else { \
+			decoded = decode_cached(cpu_state, pc); \
+		} \
+		if ( \
+			decoded->superinstruction == SUPERINSTRUCTION_NONE || \
+			count - executed < SUPERINSTRUCTION_LENGTHS[decoded->superinstruction] \
+		) { \
+			++executed; \
+			break; \
+		} \
+		executed += execute_superinstruction(cpu_state, decoded, count - executed); \
+	} \
+} while (0)
+
+#if THREADED_COMPUTED_GOTO
+#define TARGET(opcode) label_##opcode:
+#define DISPATCH() do { FETCH_NEXT(); goto *DISPATCH_TABLE[decoded->opcode]; } while (0)
+#else
+#define TARGET(opcode) case opcode:
+#define DISPATCH() continue
+#endif
+
+uint32_t run_threaded(CpuState *cpu_state, uint32_t count) {
+	uint32_t executed = 0;
+	DecodedInstruction *decoded;
+
+#if THREADED_COMPUTED_GOTO
+	static void *const DISPATCH_TABLE[NUMBER_OF_OPCODES] = {
+		[OPCODE_INVALID] = &&label_OPCODE_INVALID,
+		[OPCODE_CLEAR_SCREEN] = &&label_OPCODE_CLEAR_SCREEN,
+		[OPCODE_RETURN_SUBROUTINE] = &&label_OPCODE_RETURN_SUBROUTINE,
+		[OPCODE_JUMP] = &&label_OPCODE_JUMP,
+		[OPCODE_JUMP_SUBROUTINE] = &&label_OPCODE_JUMP_SUBROUTINE,
+		[OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE] = &&label_OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE,
+		[OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE] = &&label_OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE,
+		[OPCODE_SKIP_IF_REGISTERS_EQUAL] = &&label_OPCODE_SKIP_IF_REGISTERS_EQUAL,
+		[OPCODE_SET_REGISTER_TO_IMMEDIATE] = &&label_OPCODE_SET_REGISTER_TO_IMMEDIATE,
+		[OPCODE_ADD_IMMEDIATE_TO_REGISTER] = &&label_OPCODE_ADD_IMMEDIATE_TO_REGISTER,
+		[OPCODE_COPY_REGISTER] = &&label_OPCODE_COPY_REGISTER,
+		[OPCODE_BITWISE_OR] = &&label_OPCODE_BITWISE_OR,
+		[OPCODE_BITWISE_AND] = &&label_OPCODE_BITWISE_AND,
+		[OPCODE_BITWISE_XOR] = &&label_OPCODE_BITWISE_XOR,
+		[OPCODE_ADD_REGISTER_TO_REGISTER] = &&label_OPCODE_ADD_REGISTER_TO_REGISTER,
+		[OPCODE_SUB_REGISTER_FROM_REGISTER] = &&label_OPCODE_SUB_REGISTER_FROM_REGISTER,
+		[OPCODE_SHIFT_RIGHT] = &&label_OPCODE_SHIFT_RIGHT,
+		[OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER] = &&label_OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER,
+		[OPCODE_SHIFT_LEFT] = &&label_OPCODE_SHIFT_LEFT,
+		[OPCODE_SKIP_IF_REGISTERS_DIFFERENT] = &&label_OPCODE_SKIP_IF_REGISTERS_DIFFERENT,
+		[OPCODE_SET_INDEX_REGISTER] = &&label_OPCODE_SET_INDEX_REGISTER,
+		[OPCODE_JUMP_WITH_OFFSET] = &&label_OPCODE_JUMP_WITH_OFFSET,
+		[OPCODE_SET_REGISTER_TO_BITMASKED_RAND] = &&label_OPCODE_SET_REGISTER_TO_BITMASKED_RAND,
+		[OPCODE_DRAW] = &&label_OPCODE_DRAW,
+		[OPCODE_SKIP_PRESSED] = &&label_OPCODE_SKIP_PRESSED,
+		[OPCODE_SKIP_NOT_PRESSED] = &&label_OPCODE_SKIP_NOT_PRESSED,
+		[OPCODE_READ_DELAY] = &&label_OPCODE_READ_DELAY,
+		[OPCODE_WAIT_FOR_KEY] = &&label_OPCODE_WAIT_FOR_KEY,
+		[OPCODE_SET_DELAY] = &&label_OPCODE_SET_DELAY,
+		[OPCODE_SET_SOUND] = &&label_OPCODE_SET_SOUND,
+		[OPCODE_ADD_TO_INDEX] = &&label_OPCODE_ADD_TO_INDEX,
+		[OPCODE_POINT_TO_CHAR] = &&label_OPCODE_POINT_TO_CHAR,
+		[OPCODE_DECIMAL_DECODE] = &&label_OPCODE_DECIMAL_DECODE,
+		[OPCODE_SAVE_REGISTERS] = &&label_OPCODE_SAVE_REGISTERS,
+		[OPCODE_LOAD_REGISTERS] = &&label_OPCODE_LOAD_REGISTERS,
+	};
+
+	DISPATCH();
+#else
+	for (;;) {
+		FETCH_NEXT();
+		switch (decoded->opcode) {
+#endif
+
+	TARGET(OPCODE_INVALID) {
+		fprintf(stderr, "Could not decode instruction: %X", decoded->instruction);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Graphics */
+
+	TARGET(OPCODE_CLEAR_SCREEN) {
+		fill_screen(cpu_state, COLOR_BLACK);
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_DRAW) {
+		draw(cpu_state, decoded->instruction);
+		DISPATCH();
+	}
+
+	/* Jumping and subroutines */
+
+	TARGET(OPCODE_JUMP) {
+		cpu_state->program_counter = decoded->nnn;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_JUMP_SUBROUTINE) {
+		stack_push(cpu_state, cpu_state->program_counter & ADDRESS_BITMASK);
+		cpu_state->program_counter = decoded->nnn;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_JUMP_WITH_OFFSET) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_RETURN_SUBROUTINE) {
+		cpu_state->program_counter = stack_pop(cpu_state) & ADDRESS_BITMASK;
+		DISPATCH();
+	}
+
+	/* Conditionals */
+
+	TARGET(OPCODE_SKIP_IF_EQUAL_TO_IMMEDIATE) {
+		if (VX == decoded->nn) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SKIP_IF_DIFFERENT_FROM_IMMEDIATE) {
+		if (VX != decoded->nn) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SKIP_IF_REGISTERS_EQUAL) {
+		if (VX == VY) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SKIP_IF_REGISTERS_DIFFERENT) {
+		if (VX != VY) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SKIP_PRESSED) {
+		if (cpu_state->keyboard[VX & 0x0F]) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SKIP_NOT_PRESSED) {
+		if (!cpu_state->keyboard[VX & 0x0F]) {
+			SKIP();
+		}
+		DISPATCH();
+	}
+
+	/* Registers */
+
+	TARGET(OPCODE_COPY_REGISTER) {
+		VX = VY;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SET_REGISTER_TO_IMMEDIATE) {
+		VX = decoded->nn;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SET_INDEX_REGISTER) {
+		cpu_state->index_register = decoded->nnn;
+		DISPATCH();
+	}
+
+	/* Memory */
+
+	TARGET(OPCODE_SAVE_REGISTERS) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_LOAD_REGISTERS) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	/* Arithmetic */
+
+	TARGET(OPCODE_ADD_IMMEDIATE_TO_REGISTER) {
+		VX += decoded->nn;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_ADD_TO_INDEX) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_ADD_REGISTER_TO_REGISTER) {
+		uint16_t result = VX + VY;
+		VF = result > 255 ? 1 : 0;
+		VX = result;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SUB_REGISTER_FROM_REGISTER) {
+		uint8_t vx_val = VX, vy_val = VY;
+		VF = vx_val > vy_val ? 1 : 0;
+		VX = vx_val - vy_val;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_NEGATIVE_SUB_REGISTER_FROM_REGISTER) {
+		uint8_t vx_val = VX, vy_val = VY;
+		VF = vy_val > vx_val ? 1 : 0;
+		VX = vy_val - vx_val;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_DECIMAL_DECODE) {
+		uint8_t val = VX;
+		uint16_t address = cpu_state->index_register;
+		write_byte_memory(cpu_state, address + 2, val % 10);
+		write_byte_memory(cpu_state, address + 1, (val / 10) % 10);
+		write_byte_memory(cpu_state, address, val / 100);
+		DISPATCH();
+	}
+
+	/* Bit operations */
+
+	TARGET(OPCODE_BITWISE_OR) {
+		VX |= VY;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_BITWISE_AND) {
+		VX &= VY;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_BITWISE_XOR) {
+		VX ^= VY;
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SHIFT_LEFT) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SHIFT_RIGHT) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	/* Misc */
+
+	TARGET(OPCODE_SET_REGISTER_TO_BITMASKED_RAND) {
+		uint8_t random_byte = next_random_byte(cpu_state);
+		VX = random_byte & decoded->nn;
+		DISPATCH();
+	}
+
+	/* I/O */
+
+	TARGET(OPCODE_READ_DELAY) {
+		VX = read_delay_timer(cpu_state);
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SET_DELAY) {
+		write_delay_timer(cpu_state, VX);
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_SET_SOUND) {
+		write_sound_timer(cpu_state, VX);
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_WAIT_FOR_KEY) {
+		QUIRK_HANDLER();
+		DISPATCH();
+	}
+
+	TARGET(OPCODE_POINT_TO_CHAR) {
+		cpu_state->index_register = character_address(VX & 0x0F) & ADDRESS_BITMASK;
+		DISPATCH();
+	}
+
+#if !THREADED_COMPUTED_GOTO
+		}
+	}
+#endif
+
+done:
+	return executed;
+}
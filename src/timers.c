@@ -1,6 +1,11 @@
 #include "timers.h"
 
-uint8_t read_timer(const TimerRegister *timer) {
+uint8_t read_timer(CpuState *cpu_state, const TimerRegister *timer) {
+	// Virtual timers are counted down in place
+	if (has_virtual_timers(cpu_state)) {
+		return timer->set_value;
+	}
+
 	if (timer->set_ts_millis == 0) {
 		return 0;
 	}
@@ -14,7 +19,7 @@ uint8_t read_timer(const TimerRegister *timer) {
 		time_elapsed = 0;
 	}
 
-	int64_t ticks_elapsed = (60 * time_elapsed) / 1000;
+	int64_t ticks_elapsed = (TIMER_FREQUENCY * time_elapsed) / 1000;
 
 	if (timer->set_value >= ticks_elapsed) {
 		return timer->set_value - ticks_elapsed;
@@ -22,25 +27,110 @@ uint8_t read_timer(const TimerRegister *timer) {
 	return 0;
 }
 
-void write_to_timer(TimerRegister *timer, uint8_t value) {
+void write_to_timer(CpuState *cpu_state, TimerRegister *timer, uint8_t value) {
+	if (has_virtual_timers(cpu_state)) {
+		timer->set_ts_millis = 0;
+		timer->set_value = value;
+		return;
+	}
+
 	int64_t current_time_millis = time_millis();
 	timer->set_ts_millis = current_time_millis;
 	timer->set_value = value;
 }
 
 void update_beeper_status(CpuState *cpu_state) {
-	uint8_t sound_ticks = read_timer(&cpu_state->sound_timer);
+	uint8_t sound_ticks = read_timer(cpu_state, &cpu_state->sound_timer);
 	set_beeper_state(cpu_state, sound_ticks > 0? true : false);
 }
 
 uint8_t read_delay_timer(CpuState *cpu_state) {
-	return read_timer(&cpu_state->delay_timer);
+	return read_timer(cpu_state, &cpu_state->delay_timer);
 }
 
 void write_delay_timer(CpuState *cpu_state, uint8_t delay) {
-	write_to_timer(&cpu_state->delay_timer, delay);
+	write_to_timer(cpu_state, &cpu_state->delay_timer, delay);
+}
+
+uint8_t read_sound_timer(CpuState *cpu_state) {
+	return read_timer(cpu_state, &cpu_state->sound_timer);
 }
 
 void write_sound_timer(CpuState *cpu_state, uint8_t delay) {
-	write_to_timer(&cpu_state->sound_timer, delay);
-}
\ No newline at end of file
+	write_to_timer(cpu_state, &cpu_state->sound_timer, delay);
+}
+
+bool has_virtual_timers(CpuState *cpu_state) {
+	return cpu_state->cycles_per_tick != 0;
+}
+
+/*
+ * Makes the timers tick once every cycles_per_tick instructions, keeping their current values.
+ * Timer values then only depend on the instructions executed, so runs are reproducible and can go faster than real time.
+ */
+void use_virtual_timers(CpuState *cpu_state, uint32_t cycles_per_tick) {
+	uint8_t delay = read_delay_timer(cpu_state);
+	uint8_t sound = read_timer(cpu_state, &cpu_state->sound_timer);
+
+	cpu_state->cycles_per_tick = cycles_per_tick > 0 ? cycles_per_tick : 1;
+	cpu_state->cycles_until_tick = cpu_state->cycles_per_tick;
+
+	write_delay_timer(cpu_state, delay);
+	write_sound_timer(cpu_state, sound);
+}
+
+void restart_wall_clock_timer(CpuState *cpu_state, TimerRegister *timer, uint8_t value) {
+	// A zero timer is left unset, like after initialization
+	if (value > 0) {
+		write_to_timer(cpu_state, timer, value);
+	} else {
+		timer->set_ts_millis = 0;
+		timer->set_value = 0;
+	}
+}
+
+void use_wall_clock_timers(CpuState *cpu_state) {
+	uint8_t delay = read_delay_timer(cpu_state);
+	uint8_t sound = read_timer(cpu_state, &cpu_state->sound_timer);
+
+	cpu_state->cycles_per_tick = 0;
+	cpu_state->cycles_until_tick = 0;
+
+	restart_wall_clock_timer(cpu_state, &cpu_state->delay_timer, delay);
+	restart_wall_clock_timer(cpu_state, &cpu_state->sound_timer, sound);
+}
+
+/*
+ * How many of the next count instructions can run before the virtual timers have to tick.
+ * Cores run in batches of this size, so a timer read always sees the value for its exact instruction.
+ */
+uint32_t cycles_until_timer_tick(CpuState *cpu_state, uint32_t count) {
+	if (has_virtual_timers(cpu_state) && cpu_state->cycles_until_tick < count) {
+		return cpu_state->cycles_until_tick;
+	}
+	return count;
+}
+
+void tick_timer(TimerRegister *timer) {
+	if (timer->set_value > 0) {
+		--timer->set_value;
+	}
+}
+
+/*
+ * Accounts for instructions that have been executed, ticking the virtual timers as many times as they're due.
+ */
+void advance_cycles(CpuState *cpu_state, uint32_t cycles) {
+	cpu_state->cycles += cycles;
+	if (!has_virtual_timers(cpu_state)) {
+		return;
+	}
+
+	while (cycles >= cpu_state->cycles_until_tick) {
+		cycles -= cpu_state->cycles_until_tick;
+		cpu_state->cycles_until_tick = cpu_state->cycles_per_tick;
+		tick_timer(&cpu_state->delay_timer);
+		tick_timer(&cpu_state->sound_timer);
+	}
+	cpu_state->cycles_until_tick -= cycles;
+}
@@ -20,6 +20,37 @@ void write_word_to_array(uint8_t *ptr, intptr_t offset_in_bytes, uint16_t value)
 	ptr[offset_in_bytes + 1] = second_byte;
 }
 
+/*
+ * Integers of the given size in bytes, stored least significant byte first regardless of the host
+ */
+
+uint64_t read_little_endian(const uint8_t *ptr, uint8_t bytes) {
+	uint64_t value = 0;
+	for (uint8_t i = bytes; i > 0; --i) {
+		value = value << 8 | ptr[i - 1];
+	}
+	return value;
+}
+
+void write_little_endian(uint8_t *ptr, uint8_t bytes, uint64_t value) {
+	for (uint8_t i = 0; i < bytes; ++i) {
+		ptr[i] = value & 0xFF;
+		value >>= 8;
+	}
+}
+
+/*
+ * 64-bit FNV-1a, a simple hash that's good enough to tell ROMs and states apart
+ */
+uint64_t fnv1a_hash(const uint8_t *data, size_t size) {
+	uint64_t hash = FNV1A_OFFSET_BASIS;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= data[i];
+		hash *= FNV1A_PRIME;
+	}
+	return hash;
+}
+
 /*
  * Field extraction
  */